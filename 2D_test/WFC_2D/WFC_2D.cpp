@@ -30,6 +30,10 @@
 //by xgy  2018.07.19
 //----------------------------------------------------------------------------------------
 #include "tilemap.hpp"
+#include "contradiction_heatmap.hpp"
+#include "chunk_library.hpp"
+#include "batch_wfc.hpp"
+#include "hierarchical_wfc.hpp"
 #include <unordered_set>
 #include "utils/utils.hpp"
 #include "utils/rapidxml_utils.hpp"
@@ -82,6 +86,10 @@ XMFLOAT4                    g_vMeshColor(0.7f, 0.7f, 0.7f, 1.0f);
 // ǰ
 //--------------------------------------------------------------------------------------
 void in_wfc();
+void benchmark_heuristics();
+void benchmark_chunks();
+void benchmark_batch();
+void benchmark_hierarchical();
 int flag = 0;
 
 //--------------------------------------------------------------------------------------
@@ -373,6 +381,18 @@ void CALLBACK OnKeyboard(UINT nChar, bool bKeyDown, bool bAltDown, void* pUserCo
 		case VK_F1:
 			in_wfc();
 			break;
+		case VK_F2:
+			benchmark_heuristics();
+			break;
+		case VK_F3:
+			benchmark_chunks();
+			break;
+		case VK_F4:
+			benchmark_batch();
+			break;
+		case VK_F5:
+			benchmark_hierarchical();
+			break;
 		}
 	}
 }
@@ -460,10 +480,12 @@ void read_overlapping_element(xml_node<>* node) noexcept {
 	cout << name << " started!" << endl;
 	std::optional<Array2D<Color>> m = read_image("C:/Users/xugaoyuan/Desktop/wfc_2d_test/2D_test/samples/" + name + ".png");
 	OverlappingWFCOptions options = { periodic_input, periodic_output, height, width, symmetry, ground, N };
+	std::shared_ptr<const OverlappingModel<Color>> model = OverlappingWFC<Color>::compile(*m, options);
+	WFCSnapshotCache cache;
 	for (unsigned i = 0; i < screenshots; i++) {
 		for (unsigned test = 0; test < 10; test++) {
 			int seed = random_device()();
-			OverlappingWFC<Color> wfc(*m, options, seed);
+			OverlappingWFC<Color> wfc(*m, options, model, seed, cache);
 			std::optional<Array2D<Color>> success = wfc.run();
 			if (success.has_value()) {
 				write_image_png("C:/Users/xugaoyuan/Desktop/wfc_2d_test/2D_test/results/" + name + to_string(i) + ".png", *success);
@@ -614,19 +636,38 @@ read_neighbors(xml_node<> *root_node) {
 }
 
 /**
-* ȡtilemap㷨
+* ʽ֣samples.xmlеheuristicԣ
 */
-void read_simpletiled_instance(xml_node<> *node,
-	const string &current_dir) noexcept {
-	string name = rapidxml::get_attribute(node, "name");
-	string subset = rapidxml::get_attribute(node, "subset", "tiles");
-	bool periodic_output =
-		(rapidxml::get_attribute(node, "periodic", "False") == "True");
-	unsigned width = stoi(rapidxml::get_attribute(node, "width", "48"));
-	unsigned height = stoi(rapidxml::get_attribute(node, "height", "48"));
+const vector<pair<string, Heuristic>> heuristic_names = {
+	{ "entropy", Heuristic::entropy }, { "mrv", Heuristic::mrv },
+	{ "scanline", Heuristic::scanline }, { "frontier", Heuristic::frontier },
+	{ "hilbert", Heuristic::hilbert } };
 
-	cout << name << " " << subset << " started!" << endl;
+/**
+* benchmark_heuristicsĬϱȽϵʽfrontierhilbertȻsamples.xmlѡ
+* ڲԵĴשǵìܱscanline࣬Ҳ죬ԲĬб
+*/
+const vector<pair<string, Heuristic>> benchmarked_heuristics = {
+	{ "entropy", Heuristic::entropy }, { "mrv", Heuristic::mrv },
+	{ "scanline", Heuristic::scanline } };
 
+/**
+* ϢתΪѡcellʽ
+*/
+Heuristic to_heuristic(const string &heuristic_name) {
+	for (const pair<string, Heuristic> &heuristic : heuristic_names) {
+		if (heuristic.first == heuristic_name) {
+			return heuristic.second;
+		}
+	}
+	return Heuristic::entropy;
+}
+
+/**
+* ȡשϲģ
+*/
+std::shared_ptr<const TilingModel<Color>> load_tiling_model(const string &name,
+	const string &subset, const string &current_dir) {
 	ifstream config_file("C:/Users/xugaoyuan/Desktop/wfc_2d_test/2D_test/samples/" + name + "/data.xml");
 	vector<char> buffer((istreambuf_iterator<char>(config_file)),
 		istreambuf_iterator<char>());
@@ -665,10 +706,32 @@ void read_simpletiled_instance(xml_node<> *node,
 			tiles_id[neighbor2], orientation2));
 	}
 
+	return TilingWFC<Color>::compile(tiles, neighbors_ids);
+}
+
+/**
+* ȡtilemap㷨
+*/
+void read_simpletiled_instance(xml_node<> *node,
+	const string &current_dir) noexcept {
+	string name = rapidxml::get_attribute(node, "name");
+	string subset = rapidxml::get_attribute(node, "subset", "tiles");
+	bool periodic_output =
+		(rapidxml::get_attribute(node, "periodic", "False") == "True");
+	unsigned width = stoi(rapidxml::get_attribute(node, "width", "48"));
+	unsigned height = stoi(rapidxml::get_attribute(node, "height", "48"));
+	Heuristic heuristic =
+		to_heuristic(rapidxml::get_attribute(node, "heuristic", "entropy"));
+
+	cout << name << " " << subset << " started!" << endl;
+
+	std::shared_ptr<const TilingModel<Color>> model =
+		load_tiling_model(name, subset, current_dir);
+	WFCSnapshotCache cache;
 	for (unsigned test = 0; test < 10; test++) {
 		int seed = random_device()();
-		TilingWFC<Color> wfc(tiles, neighbors_ids, height, width, { periodic_output },
-			seed);
+		TilingWFC<Color> wfc(model, height, width, { periodic_output, heuristic },
+			seed, cache);
 		std::optional<Array2D<Color>> success = wfc.run();
 		if (success.has_value()) {
 			write_image_png("C:/Users/xugaoyuan/Desktop/wfc_2d_test/2D_test/results/" + name + "_" + subset + ".png", *success);
@@ -714,3 +777,142 @@ void in_wfc()
 	int elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds> (end - start).count();
 	std::cout << "All samples done in " << elapsed_s << "s, " << elapsed_ms % 1000 << "ms.\n";
 }
+
+/**
+* ȽѡcellʽSummerCastleͬӸɴΣ
+* ìܣʧܣıʱ䣬ԼìܵĴש
+*/
+void benchmark_heuristics()
+{
+	const string dir_path = "C:/Users/xugaoyuan/Desktop/wfc_2d_test/2D_test/samples";
+	const unsigned size = 30;
+	const unsigned runs = 50;
+	for (const string &name : { string("Summer"), string("Castle") }) {
+		std::shared_ptr<const TilingModel<Color>> model =
+			load_tiling_model(name, "tiles", dir_path);
+		for (const pair<string, Heuristic> &heuristic : benchmarked_heuristics) {
+			WFCSnapshotCache cache;
+			ContradictionHeatmap heatmap(size, size, model->id_to_oriented_tile.size());
+			std::chrono::time_point<std::chrono::system_clock> start =
+				std::chrono::system_clock::now();
+			for (unsigned seed = 0; seed < runs; seed++) {
+				TilingWFC<Color> wfc(model, size, size, { false, heuristic.second }, seed, cache);
+				if (!wfc.run().has_value()) {
+					heatmap.add(*wfc.get_contradiction());
+				}
+			}
+			int elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>
+				(std::chrono::system_clock::now() - start).count();
+			cout << name << " " << heuristic.first
+				<< ": " << heatmap.size() << "/" << runs << " contradictions, "
+				<< elapsed_ms << "ms";
+			std::vector<unsigned> worst = heatmap.worst_patterns();
+			if (!worst.empty()) {
+				cout << ", worst tile " << model->id_to_oriented_tile[worst[0]].first
+					<< " orientation " << model->id_to_oriented_tile[worst[0]].second
+					<< " (" << heatmap.get_patterns()[worst[0]] << ")";
+			}
+			cout << endl;
+		}
+	}
+}
+
+/**
+* ԤɴͼⱣresultsУʱɲ棬
+* Ȼƴ64x64飨513x513cellпʱ
+*/
+void benchmark_chunks()
+{
+	const string dir_path = "C:/Users/xugaoyuan/Desktop/wfc_2d_test/2D_test/samples";
+	const string library_path = "C:/Users/xugaoyuan/Desktop/wfc_2d_test/2D_test/results/Summer.chunks";
+	const unsigned chunk_size = 9;
+	const unsigned chunks = 64;
+	std::shared_ptr<const TilingModel<Color>> model =
+		load_tiling_model("Summer", "tiles", dir_path);
+	ChunkLibrary library(model->compiled, chunk_size);
+	std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
+	if (!library.load(library_path)) {
+		library.build(6, 4, 0);
+		library.save(library_path);
+	}
+	int elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>
+		(std::chrono::system_clock::now() - start).count();
+	cout << "library: " << library.size() << " chunks, " << elapsed_ms << "ms" << endl;
+
+	ChunkAssemblyStats stats;
+	start = std::chrono::system_clock::now();
+	std::optional<Array2D<unsigned>> ids = assemble_chunks(library, chunks, chunks, 0, &stats);
+	elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>
+		(std::chrono::system_clock::now() - start).count();
+	cout << (ids.has_value() ? "assembled: " : "failed: ") << stats.hits << " hits, "
+		<< stats.live << " live, " << elapsed_ms << "ms" << endl;
+}
+
+/**
+* ȽС⣺Summer40968x8ı壬ֱеWFC
+* 64ʵͬеBatchWFCÿɵı
+*/
+void benchmark_batch()
+{
+	const string dir_path = "C:/Users/xugaoyuan/Desktop/wfc_2d_test/2D_test/samples";
+	const unsigned size = 8;
+	const unsigned variants = 4096;
+	std::shared_ptr<const TilingModel<Color>> model =
+		load_tiling_model("Summer", "tiles", dir_path);
+	std::vector<uint64_t> seeds;
+	for (unsigned seed = 0; seed < variants; seed++) {
+		seeds.push_back(seed);
+	}
+	for (Heuristic heuristic : { Heuristic::entropy, Heuristic::scanline }) {
+		unsigned successes = 0;
+		std::chrono::time_point<std::chrono::system_clock> start =
+			std::chrono::system_clock::now();
+		for (unsigned seed = 0; seed < variants; seed++) {
+			WFC wfc(false, seed, model->compiled, size, size, heuristic);
+			successes += wfc.run().has_value();
+		}
+		double single_s = std::chrono::duration<double>
+			(std::chrono::system_clock::now() - start).count();
+
+		unsigned batch_successes = 0;
+		start = std::chrono::system_clock::now();
+		for (const std::optional<Array2D<unsigned>> &result :
+			run_batched(false, seeds, model->compiled, size, size, heuristic)) {
+			batch_successes += result.has_value();
+		}
+		double batch_s = std::chrono::duration<double>
+			(std::chrono::system_clock::now() - start).count();
+		cout << (heuristic == Heuristic::entropy ? "entropy" : "scanline")
+			<< ": WFC " << (unsigned)(variants / single_s) << " variants/s ("
+			<< successes << " ok), batch " << (unsigned)(variants / batch_s)
+			<< " variants/s (" << batch_successes << " ok)" << endl;
+	}
+}
+
+/**
+* ֲɴͼSummerΪģͣ64x64Ĵ
+* ڶ߳ϸÿڲ513x513cellʱϸ
+*/
+void benchmark_hierarchical()
+{
+	const string dir_path = "C:/Users/xugaoyuan/Desktop/wfc_2d_test/2D_test/samples";
+	const string library_path = "C:/Users/xugaoyuan/Desktop/wfc_2d_test/2D_test/results/Summer.chunks";
+	const unsigned blocks = 64;
+	std::shared_ptr<const TilingModel<Color>> model =
+		load_tiling_model("Summer", "tiles", dir_path);
+	ChunkLibrary library(model->compiled, 9);
+	if (!library.load(library_path)) {
+		library.build(6, 4, 0);
+		library.save(library_path);
+	}
+	CoarseModel coarse(library);
+
+	HierarchicalStats stats;
+	std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
+	std::optional<Array2D<unsigned>> ids = run_hierarchical(coarse, blocks, blocks, 0, 0, &stats);
+	int elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>
+		(std::chrono::system_clock::now() - start).count();
+	cout << (ids.has_value() ? "generated: " : "failed: ") << stats.coarse_attempts
+		<< " coarse attempts, " << stats.refined << " refined, " << stats.kept << " kept, "
+		<< elapsed_ms << "ms" << endl;
+}
@@ -0,0 +1,466 @@
+#ifndef FAST_WFC_BATCH_WFC_HPP_
+#define FAST_WFC_BATCH_WFC_HPP_
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <memory>
+#include <optional>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "compiled_model.hpp"
+#include "counter_rng.hpp"
+#include "direction.hpp"
+#include "hilbert.hpp"
+#include "utils/array2D.hpp"
+#include "wave.hpp"
+
+/**
+ * Run up to 64 independent WFC instances of the same model and the same size
+ * in lockstep, one instance per lane. This is meant for many tiny outputs,
+ * where a WFC per output spends most of its time in its own small loops.
+ *
+ * The state is stored as a structure of arrays across the lanes: the wave is
+ * a 64 bits mask per (cell, pattern), bit lane being set if pattern is still
+ * possible in the cell of the lane, and the memoisation of a cell is
+ * contiguous over the lanes.
+ *
+ * The propagation doesn't use support counters, which the lanes would almost
+ * never update together. When patterns are removed from a cell in some
+ * lanes, the patterns of the neighbors that were compatible with them are
+ * revised: a pattern keeps the lanes where one of its compatible patterns is
+ * still in the cell. Every and/or works on all the lanes at once. The
+ * propagation goes by rounds, so that the changes of a cell in several lanes
+ * are propagated together.
+ *
+ * Every lane makes the same choices as a WFC with the same heuristic and the
+ * seed of the lane. With Heuristic::entropy, the results only differ when two
+ * entropies are equal up to the rounding errors. With Heuristic::scanline and
+ * Heuristic::hilbert, the lanes mostly observe the same cells at the same
+ * steps and share their propagation: this is where the batch is faster than
+ * one WFC per seed, the more so as the outputs are small. With
+ * Heuristic::entropy, the lanes observe different cells from the first step,
+ * and the batch is not faster. The other heuristics fall back to
+ * Heuristic::entropy. A lane stops at its first contradiction, the other
+ * lanes go on.
+ *
+ * The batch only solves 2D outputs of the simple tiled and overlapping
+ * models. The 3D solver has no batched counterpart: a 3D output is solved by
+ * one genericWFC per seed.
+ */
+class BatchWFC {
+public:
+  /**
+   * The maximum number of lanes of a batch.
+   */
+  static constexpr unsigned max_lanes = 64;
+
+private:
+  std::shared_ptr<const CompiledModel> model;
+
+  const unsigned nb_patterns;
+  const unsigned height;
+  const unsigned width;
+  const unsigned size;
+  const bool periodic_output;
+
+  /**
+   * The heuristic used to select the observed cells.
+   */
+  const Heuristic heuristic;
+
+  /**
+   * The seed of every lane.
+   */
+  const std::vector<uint64_t> seeds;
+  const unsigned nb_lanes;
+
+  /**
+   * wave[index * nb_patterns + pattern] has bit lane set if pattern can be
+   * placed in cell index of lane.
+   */
+  std::vector<uint64_t> wave;
+
+  /**
+   * The memoisation of cell index of lane is at index * nb_lanes + lane (see
+   * EntropyMemoisation). plogp_sum and entropy are only kept for
+   * Heuristic::entropy.
+   */
+  std::vector<double> plogp_sum;
+  std::vector<double> sum;
+  std::vector<double> entropy;
+  std::vector<unsigned> remaining;
+
+  /**
+   * removed[index * nb_patterns + pattern] is the mask of the lanes where
+   * pattern was removed from cell index and not propagated yet, and
+   * changed[index] is the union of the masks of cell index. propagating
+   * contains the cells with a non zero changed mask.
+   */
+  std::vector<uint64_t> removed;
+  std::vector<uint64_t> changed;
+  std::vector<unsigned> propagating;
+
+  /**
+   * A mask per pattern, used by propagate and observe.
+   */
+  std::vector<uint64_t> masks;
+
+  /**
+   * The order of the observed cells for Heuristic::scanline (empty) and
+   * Heuristic::hilbert, and the position of every lane in it.
+   */
+  std::vector<unsigned> order;
+  std::vector<unsigned> cursor;
+
+  /**
+   * The lanes still running, the lanes that succeeded, and the lanes that
+   * met a contradiction.
+   */
+  uint64_t running;
+  uint64_t succeeded = 0;
+  uint64_t failed = 0;
+
+  /**
+   * The number of observations done. All the running lanes observe at every
+   * step, so it is also the step of every lane.
+   */
+  unsigned step = 0;
+
+  /**
+   * Remove pattern from cell index in the running lanes of lanes, and queue
+   * the cell for the propagation.
+   */
+  void remove(unsigned index, unsigned pattern, uint64_t lanes) noexcept {
+    uint64_t &bits = wave[index * nb_patterns + pattern];
+    lanes &= bits & running;
+    if (!lanes) {
+      return;
+    }
+    bits &= ~lanes;
+    removed[index * nb_patterns + pattern] |= lanes;
+    if (!changed[index]) {
+      propagating.push_back(index);
+    }
+    changed[index] |= lanes;
+
+    const double frequency = model->patterns_frequencies[pattern];
+    const double plogp = model->plogp_patterns_frequencies[pattern];
+    double *cell_sum = &sum[index * nb_lanes];
+    unsigned *cell_remaining = &remaining[index * nb_lanes];
+    for (uint64_t mask = lanes; mask; mask &= mask - 1) {
+      unsigned lane = count_trailing_zeros(mask);
+      cell_sum[lane] -= frequency;
+      if (heuristic == Heuristic::entropy) {
+        double &cell_plogp_sum = plogp_sum[index * nb_lanes + lane];
+        cell_plogp_sum -= plogp;
+        entropy[index * nb_lanes + lane] =
+            log(cell_sum[lane]) - cell_plogp_sum / cell_sum[lane];
+      }
+      if (--cell_remaining[lane] == 0) {
+        failed |= (uint64_t)1 << lane;
+      }
+    }
+    running &= ~failed;
+  }
+
+  /**
+   * Propagate the queued removals in every running lane, until the queue is
+   * empty. The lanes emptying a cell are stopped.
+   */
+  void propagate() noexcept {
+    std::vector<unsigned> round;
+    std::vector<unsigned> removed_patterns;
+    while (!propagating.empty()) {
+      round.swap(propagating);
+      propagating.clear();
+      for (unsigned index1 : round) {
+        uint64_t lanes = changed[index1] & running;
+        changed[index1] = 0;
+        const uint64_t *cell1 = &wave[index1 * nb_patterns];
+        uint64_t *removed1 = &removed[index1 * nb_patterns];
+        removed_patterns.clear();
+        for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+          if (removed1[pattern]) {
+            removed_patterns.push_back(pattern);
+          }
+        }
+        if (!lanes) {
+          for (unsigned pattern : removed_patterns) {
+            removed1[pattern] = 0;
+          }
+          continue;
+        }
+
+        int y1 = index1 / width;
+        int x1 = index1 % width;
+        for (unsigned direction = 0; direction < 4; direction++) {
+          int x2 = x1 + directions_x[direction];
+          int y2 = y1 + directions_y[direction];
+          if (periodic_output) {
+            x2 = (x2 + (int)width) % width;
+            y2 = (y2 + (int)height) % height;
+          } else if (x2 < 0 || x2 >= (int)width || y2 < 0 ||
+                     y2 >= (int)height) {
+            continue;
+          }
+          unsigned index2 = x2 + y2 * width;
+          const uint64_t *cell2 = &wave[index2 * nb_patterns];
+
+          // masks[pattern] is the mask of the lanes where a pattern
+          // compatible with pattern was removed from index1.
+          std::fill(masks.begin(), masks.end(), 0);
+          for (unsigned pattern : removed_patterns) {
+            uint64_t removed_lanes = removed1[pattern] & lanes;
+            for (const unsigned *it = model->neighbors_begin(pattern, direction),
+                                *it_end = model->neighbors_end(pattern, direction);
+                 it < it_end; ++it) {
+              masks[*it] |= removed_lanes;
+            }
+          }
+
+          // Then pattern loses the lanes where none of its compatible
+          // patterns is left in index1.
+          const unsigned opposite = get_opposite_direction(direction);
+          for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+            uint64_t unsupported = cell2[pattern] & masks[pattern];
+            for (const unsigned *it = model->neighbors_begin(pattern, opposite),
+                                *it_end = model->neighbors_end(pattern, opposite);
+                 unsupported && it < it_end; ++it) {
+              unsupported &= ~cell1[*it];
+            }
+            if (unsupported) {
+              remove(index2, pattern, unsupported);
+            }
+          }
+        }
+        for (unsigned pattern : removed_patterns) {
+          removed1[pattern] = 0;
+        }
+      }
+    }
+  }
+
+  /**
+   * Ban every pattern from the cells having a neighbor in a direction where
+   * the pattern has no compatible neighbor, in every lane, as WFC::prepare
+   * does. The propagation never removes these patterns by itself.
+   */
+  void ban_unsupported() noexcept {
+    for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+      for (unsigned direction = 0; direction < 4; direction++) {
+        if (model->initial_compatible[pattern][direction] != 0) {
+          continue;
+        }
+        const int dy = directions_y[direction];
+        const int dx = directions_x[direction];
+        const unsigned y_min = (dy > 0 && !periodic_output) ? 1 : 0;
+        const unsigned y_max =
+            (dy < 0 && !periodic_output) ? height - 1 : height;
+        const unsigned x_min = (dx > 0 && !periodic_output) ? 1 : 0;
+        const unsigned x_max = (dx < 0 && !periodic_output) ? width - 1 : width;
+        for (unsigned y = y_min; y < y_max; y++) {
+          for (unsigned x = x_min; x < x_max; x++) {
+            remove(x + y * width, pattern, running);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Return the cell observed by lane, -1 if every cell of lane is decided.
+   * argmin is the cell chosen by the entropy heuristic for every lane.
+   */
+  int select_cell(unsigned lane, const int *argmin) noexcept {
+    if (heuristic == Heuristic::entropy) {
+      return argmin[lane];
+    }
+    while (cursor[lane] < size) {
+      unsigned index = order.empty() ? cursor[lane] : order[cursor[lane]];
+      if (remaining[index * nb_lanes + lane] != 1) {
+        return index;
+      }
+      cursor[lane]++;
+    }
+    return -1;
+  }
+
+  /**
+   * Observe one cell in every running lane, chosen by the heuristic. The
+   * lanes where every cell is decided succeed.
+   */
+  void observe() noexcept {
+    // The cell with the lowest entropy plus the noise of every lane, as in
+    // Wave::get_min_entropy.
+    double min[max_lanes];
+    int argmin[max_lanes];
+    if (heuristic == Heuristic::entropy) {
+      const double max_noise = abs(model->half_min_plogp);
+      std::fill(min, min + nb_lanes, std::numeric_limits<double>::infinity());
+      std::fill(argmin, argmin + nb_lanes, -1);
+      for (unsigned index = 0; index < size; index++) {
+        const unsigned *cell_remaining = &remaining[index * nb_lanes];
+        const double *cell_entropy = &entropy[index * nb_lanes];
+        for (uint64_t mask = running; mask; mask &= mask - 1) {
+          unsigned lane = count_trailing_zeros(mask);
+          if (cell_remaining[lane] == 1 || cell_entropy[lane] > min[lane]) {
+            continue;
+          }
+          double noise = counter_uniform(seeds[lane], index, step,
+                                         RandomStream::noise, max_noise);
+          if (cell_entropy[lane] + noise < min[lane]) {
+            min[lane] = cell_entropy[lane] + noise;
+            argmin[lane] = index;
+          }
+        }
+      }
+    }
+
+    // The (cell, lane) observed, sorted by cell so that the lanes observing
+    // the same cell remove its other patterns together.
+    std::vector<std::pair<unsigned, unsigned>> observed;
+    for (uint64_t mask = running; mask; mask &= mask - 1) {
+      unsigned lane = count_trailing_zeros(mask);
+      int index = select_cell(lane, argmin);
+      if (index < 0) {
+        succeeded |= (uint64_t)1 << lane;
+        running &= ~((uint64_t)1 << lane);
+      } else {
+        observed.emplace_back(index, lane);
+      }
+    }
+    std::sort(observed.begin(), observed.end());
+
+    for (size_t first = 0; first < observed.size();) {
+      unsigned index = observed[first].first;
+      const uint64_t *cell = &wave[index * nb_patterns];
+      uint64_t lanes = 0;
+      std::fill(masks.begin(), masks.end(), 0);
+      for (; first < observed.size() && observed[first].first == index;
+           first++) {
+        unsigned lane = observed[first].second;
+        uint64_t bit = (uint64_t)1 << lane;
+        lanes |= bit;
+
+        // Same choice as Wave::choose_pattern.
+        double random_value =
+            counter_uniform(seeds[lane], index, step, RandomStream::observe,
+                            sum[index * nb_lanes + lane]);
+        unsigned chosen_value = nb_patterns - 1;
+        for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+          if (cell[pattern] & bit) {
+            chosen_value = pattern;
+            random_value -= model->patterns_frequencies[pattern];
+            if (random_value <= 0) {
+              break;
+            }
+          }
+        }
+        masks[chosen_value] |= bit;
+      }
+      for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+        remove(index, pattern, lanes & ~masks[pattern]);
+      }
+    }
+    step++;
+  }
+
+public:
+  /**
+   * Initialize one lane per seed, seeds containing at most max_lanes seeds.
+   */
+  BatchWFC(bool periodic_output, const std::vector<uint64_t> &seeds,
+           std::shared_ptr<const CompiledModel> model, unsigned wave_height,
+           unsigned wave_width, Heuristic heuristic = Heuristic::entropy) noexcept
+      : model(model), nb_patterns(model->nb_patterns), height(wave_height),
+        width(wave_width), size(wave_height * wave_width),
+        periodic_output(periodic_output),
+        heuristic(heuristic == Heuristic::scanline ||
+                          heuristic == Heuristic::hilbert
+                      ? heuristic
+                      : Heuristic::entropy),
+        seeds(seeds), nb_lanes((unsigned)seeds.size()),
+        wave(size * nb_patterns,
+             nb_lanes == 64 ? ~(uint64_t)0 : ((uint64_t)1 << nb_lanes) - 1),
+        sum(size * nb_lanes, model->base_sum),
+        remaining(size * nb_lanes, nb_patterns),
+        removed(size * nb_patterns, 0), changed(size, 0),
+        masks(nb_patterns, 0), cursor(nb_lanes, 0),
+        running(wave.empty() ? 0 : wave[0]) {
+    if (this->heuristic == Heuristic::entropy) {
+      plogp_sum.assign(size * nb_lanes, model->base_plogp_sum);
+      entropy.assign(size * nb_lanes, model->base_entropy);
+    }
+    if (this->heuristic == Heuristic::hilbert) {
+      order = hilbert_order(height, width);
+    }
+  }
+
+  /**
+   * Run every lane to its end. results[lane] is the output of lane, or
+   * nullopt if it met a contradiction.
+   */
+  std::vector<std::optional<Array2D<unsigned>>> run() noexcept {
+    ban_unsupported();
+    propagate();
+    while (running) {
+      observe();
+      propagate();
+    }
+    std::vector<std::optional<Array2D<unsigned>>> results(nb_lanes);
+    for (unsigned lane = 0; lane < nb_lanes; lane++) {
+      if (!((succeeded >> lane) & 1)) {
+        continue;
+      }
+      Array2D<unsigned> output(height, width);
+      for (unsigned index = 0; index < size; index++) {
+        for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+          if ((wave[index * nb_patterns + pattern] >> lane) & 1) {
+            output.data[index] = pattern;
+            break;
+          }
+        }
+      }
+      results[lane] = std::move(output);
+    }
+    return results;
+  }
+
+  /**
+   * The mask of the lanes that succeeded and of the lanes that met a
+   * contradiction.
+   */
+  uint64_t get_succeeded() const noexcept { return succeeded; }
+  uint64_t get_failed() const noexcept { return failed; }
+};
+
+/**
+ * Run one WFC per seed, in batches of lanes lanes (at most
+ * BatchWFC::max_lanes). results[i] is the output of seeds[i], or nullopt if
+ * it met a contradiction.
+ */
+inline std::vector<std::optional<Array2D<unsigned>>>
+run_batched(bool periodic_output, const std::vector<uint64_t> &seeds,
+            std::shared_ptr<const CompiledModel> model, unsigned wave_height,
+            unsigned wave_width, Heuristic heuristic = Heuristic::entropy,
+            unsigned lanes = BatchWFC::max_lanes) noexcept {
+  lanes = std::max(1u, std::min(lanes, BatchWFC::max_lanes));
+  std::vector<std::optional<Array2D<unsigned>>> results;
+  results.reserve(seeds.size());
+  for (size_t first = 0; first < seeds.size(); first += lanes) {
+    std::vector<uint64_t> batch(
+        seeds.begin() + first,
+        seeds.begin() + std::min(seeds.size(), first + lanes));
+    BatchWFC wfc(periodic_output, batch, model, wave_height, wave_width,
+                 heuristic);
+    for (std::optional<Array2D<unsigned>> &result : wfc.run()) {
+      results.push_back(std::move(result));
+    }
+  }
+  return results;
+}
+
+#endif // FAST_WFC_BATCH_WFC_HPP_
@@ -0,0 +1,538 @@
+#ifndef FAST_WFC_CHUNK_LIBRARY_HPP_
+#define FAST_WFC_CHUNK_LIBRARY_HPP_
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "compiled_model.hpp"
+#include "constraint_layer.hpp"
+#include "counter_rng.hpp"
+#include "utils/array2D.hpp"
+#include "wfc.hpp"
+
+/**
+ * The statistics of assemble_chunks.
+ */
+struct ChunkAssemblyStats {
+  unsigned hits = 0;     // Chunks found in the library.
+  unsigned live = 0;     // Chunks solved with a live WFC.
+  unsigned failures = 0; // Chunks that couldn't be solved.
+};
+
+/**
+ * A library of pre-solved square chunks of pattern ids, indexed by the
+ * signatures of their top row and left column.
+ *
+ * Neighbor chunks overlap by one row or column: the bottom row of a chunk is
+ * the top row of the chunk below it, and its right column is the left column
+ * of the chunk on its right. Every adjacency of the assembled grid is then
+ * inside a chunk, so a chunk fits as soon as its top row and left column are
+ * the ones already placed.
+ *
+ * build() generates the chunks like Wang tiles: every border is one of a few
+ * seams sharing the same corner pattern, and the library holds chunks for
+ * every pair (top seam, left seam), so that the lookups of assemble_chunks
+ * almost never miss.
+ */
+class ChunkLibrary {
+private:
+  /**
+   * The identifier and the version of the file format.
+   */
+  static constexpr char magic[8] = {'W', 'F', 'C', 'C', 'H', 'N', 'K', '1'};
+
+  /**
+   * The kind of a key of the index.
+   */
+  enum KeyKind : uint64_t { top = 1, left = 2, both = 3 };
+
+  std::shared_ptr<const CompiledModel> model;
+
+  /**
+   * The number of cells on a side of a chunk, overlap included.
+   */
+  unsigned chunk_size;
+
+  /**
+   * The chunks of the library.
+   */
+  std::vector<Array2D<unsigned>> chunks;
+
+  /**
+   * The chunks of every key (see key).
+   */
+  std::unordered_multimap<uint64_t, unsigned> index;
+
+  /**
+   * Return the hash of an edge (a row or a column) of a chunk, get(k)
+   * returning its k-th cell.
+   */
+  template <typename Get> uint64_t edge_hash(const Get &get) const noexcept {
+    uint64_t hash = chunk_size;
+    for (unsigned k = 0; k < chunk_size; k++) {
+      hash = splitmix64(hash ^ get(k));
+    }
+    return hash;
+  }
+
+  /**
+   * Return the key of the index for the given edge hashes.
+   */
+  static uint64_t key(KeyKind kind, uint64_t top_hash,
+                      uint64_t left_hash) noexcept {
+    return splitmix64((kind == left ? left_hash : top_hash) ^
+                      (kind == both ? splitmix64(left_hash) : 0) ^ kind);
+  }
+
+  /**
+   * Return a hash of the compiled model, so that a library is not loaded for
+   * another model.
+   */
+  uint64_t model_hash() const noexcept {
+    uint64_t hash = splitmix64(model->nb_patterns);
+    for (unsigned value : model->propagator_offsets) {
+      hash = splitmix64(hash ^ value);
+    }
+    for (unsigned value : model->propagator_data) {
+      hash = splitmix64(hash ^ value);
+    }
+    return hash;
+  }
+
+  /**
+   * Add the keys of chunk id to the index.
+   */
+  void index_chunk(unsigned id) noexcept {
+    const Array2D<unsigned> &chunk = chunks[id];
+    uint64_t top_hash = edge_hash([&](unsigned k) { return chunk.get(0, k); });
+    uint64_t left_hash = edge_hash([&](unsigned k) { return chunk.get(k, 0); });
+    for (KeyKind kind : {top, left, both}) {
+      index.emplace(key(kind, top_hash, left_hash), id);
+    }
+  }
+
+  /**
+   * Return true if chunk id has the pattern of every known cell (the cells
+   * with a non negative value).
+   */
+  bool matches(unsigned id, const Array2D<int> &known) const noexcept {
+    for (unsigned i = 0; i < chunk_size * chunk_size; i++) {
+      if (known.data[i] >= 0 && (unsigned)known.data[i] != chunks[id].data[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Fill the library with Wang-style chunks around the corner given by the
+   * center of corner_chunk (see build). Return false if no chunk was added.
+   */
+  bool build_around(const Array2D<unsigned> &corner_chunk, unsigned nb_seams,
+                    unsigned chunks_per_pair, uint64_t seed) noexcept {
+    const unsigned last = chunk_size - 1;
+    const unsigned middle = chunk_size / 2;
+    auto patch = [&](int di, int dj) {
+      return (int)corner_chunk.get(middle + di, middle + dj);
+    };
+
+    std::vector<std::vector<unsigned>> rows;
+    std::vector<std::vector<unsigned>> columns;
+    for (unsigned s = 0; s < nb_seams; s++) {
+      Array2D<int> ends(chunk_size, chunk_size, -1);
+      ends.get(middle, 0) = ends.get(middle, last) = ends.get(0, middle) =
+          ends.get(last, middle) = patch(0, 0);
+      ends.get(middle, 1) = patch(0, 1);
+      ends.get(middle, last - 1) = patch(0, -1);
+      ends.get(1, middle) = patch(1, 0);
+      ends.get(last - 1, middle) = patch(-1, 0);
+      std::optional<Array2D<unsigned>> chunk =
+          solve(ends, counter_random(seed, 1, s, RandomStream::select));
+      if (!chunk.has_value()) {
+        continue;
+      }
+      std::vector<unsigned> row(chunk_size);
+      std::vector<unsigned> column(chunk_size);
+      for (unsigned k = 0; k < chunk_size; k++) {
+        row[k] = chunk->get(middle, k);
+        column[k] = chunk->get(k, middle);
+      }
+      if (std::find(rows.begin(), rows.end(), row) == rows.end()) {
+        rows.push_back(row);
+      }
+      if (std::find(columns.begin(), columns.end(), column) == columns.end()) {
+        columns.push_back(column);
+      }
+    }
+    if (rows.empty() || columns.empty()) {
+      return false;
+    }
+
+    // The chunks solved, with the indices of their 4 seams.
+    std::vector<Array2D<unsigned>> solved;
+    std::vector<std::array<unsigned, 4>> solved_seams;
+    uint64_t counter = 0;
+    for (unsigned t = 0; t < rows.size(); t++) {
+      for (unsigned l = 0; l < columns.size(); l++) {
+        for (unsigned c = 0; c < chunks_per_pair; c++) {
+          // A pair of bottom and right seams may have no solution, a few are
+          // tried.
+          for (unsigned attempt = 0; attempt < 8; attempt++, counter++) {
+            unsigned b =
+                counter_random(seed, 2, counter, RandomStream::select) %
+                rows.size();
+            unsigned r =
+                counter_random(seed, 3, counter, RandomStream::select) %
+                columns.size();
+            Array2D<int> borders(chunk_size, chunk_size, -1);
+            for (unsigned k = 0; k < chunk_size; k++) {
+              borders.get(0, k) = rows[t][k];
+              borders.get(k, 0) = columns[l][k];
+              borders.get(last, k) = rows[b][k];
+              borders.get(k, last) = columns[r][k];
+            }
+            std::optional<Array2D<unsigned>> chunk = solve(
+                borders, counter_random(seed, 4, counter, RandomStream::select),
+                2);
+            if (chunk.has_value()) {
+              solved.push_back(*chunk);
+              solved_seams.push_back({t, l, b, r});
+              break;
+            }
+          }
+        }
+      }
+    }
+
+    // A lookup misses when the bottom and right seams of the chunks above and
+    // on the left form a pair without chunk. The seam with the most pairs
+    // without chunk is removed, with the chunks using it, until every pair of
+    // the remaining seams has a chunk.
+    std::vector<bool> row_used(rows.size(), true);
+    std::vector<bool> column_used(columns.size(), true);
+    auto usable = [&](const std::array<unsigned, 4> &seams) {
+      return row_used[seams[0]] && column_used[seams[1]] &&
+             row_used[seams[2]] && column_used[seams[3]];
+    };
+    while (true) {
+      Array2D<unsigned> covered(rows.size(), columns.size(), 0);
+      for (const std::array<unsigned, 4> &seams : solved_seams) {
+        if (usable(seams)) {
+          covered.get(seams[0], seams[1])++;
+        }
+      }
+      std::vector<unsigned> row_missing(rows.size(), 0);
+      std::vector<unsigned> column_missing(columns.size(), 0);
+      for (unsigned t = 0; t < rows.size(); t++) {
+        for (unsigned l = 0; l < columns.size(); l++) {
+          if (row_used[t] && column_used[l] && covered.get(t, l) == 0) {
+            row_missing[t]++;
+            column_missing[l]++;
+          }
+        }
+      }
+      auto worst_row = std::max_element(row_missing.begin(), row_missing.end());
+      auto worst_column =
+          std::max_element(column_missing.begin(), column_missing.end());
+      if (*worst_row == 0 && *worst_column == 0) {
+        break;
+      }
+      if (*worst_row >= *worst_column) {
+        row_used[worst_row - row_missing.begin()] = false;
+      } else {
+        column_used[worst_column - column_missing.begin()] = false;
+      }
+    }
+
+    size_t nb_chunks = chunks.size();
+    for (unsigned c = 0; c < solved.size(); c++) {
+      if (usable(solved_seams[c])) {
+        add(solved[c]);
+      }
+    }
+    return chunks.size() > nb_chunks;
+  }
+
+public:
+  /**
+   * Build an empty library of chunks of chunk_size x chunk_size cells.
+   * build() needs chunk_size to be at least 5.
+   */
+  ChunkLibrary(std::shared_ptr<const CompiledModel> model,
+               unsigned chunk_size) noexcept
+      : model(model), chunk_size(chunk_size) {}
+
+  /**
+   * The model of the chunks.
+   */
+  std::shared_ptr<const CompiledModel> get_model() const noexcept {
+    return model;
+  }
+
+  /**
+   * The number of cells on a side of a chunk.
+   */
+  unsigned get_chunk_size() const noexcept { return chunk_size; }
+
+  /**
+   * The number of chunks in the library.
+   */
+  size_t size() const noexcept { return chunks.size(); }
+
+  /**
+   * Return chunk id.
+   */
+  const Array2D<unsigned> &get(unsigned id) const noexcept {
+    return chunks[id];
+  }
+
+  /**
+   * Add a chunk to the library.
+   */
+  void add(const Array2D<unsigned> &chunk) noexcept {
+    chunks.push_back(chunk);
+    index_chunk(chunks.size() - 1);
+  }
+
+  /**
+   * Return a chunk having the pattern of every known cell, or -1. The lookup
+   * uses the top row and the left column when they are fully known. When
+   * several chunks fit, one is chosen from (seed, position).
+   */
+  int find(const Array2D<int> &known, uint64_t seed,
+           uint64_t position) const noexcept {
+    bool top_known = true;
+    bool left_known = true;
+    for (unsigned k = 0; k < chunk_size; k++) {
+      top_known = top_known && known.get(0, k) >= 0;
+      left_known = left_known && known.get(k, 0) >= 0;
+    }
+
+    std::vector<unsigned> candidates;
+    if (!top_known && !left_known) {
+      for (unsigned id = 0; id < chunks.size(); id++) {
+        if (matches(id, known)) {
+          candidates.push_back(id);
+        }
+      }
+    } else {
+      uint64_t top_hash =
+          top_known ? edge_hash([&](unsigned k) { return known.get(0, k); }) : 0;
+      uint64_t left_hash =
+          left_known ? edge_hash([&](unsigned k) { return known.get(k, 0); }) : 0;
+      KeyKind kind = top_known ? (left_known ? both : top) : left;
+      auto range = index.equal_range(key(kind, top_hash, left_hash));
+      for (auto it = range.first; it != range.second; ++it) {
+        if (matches(it->second, known)) {
+          candidates.push_back(it->second);
+        }
+      }
+      // The order of the multimap is unspecified.
+      std::sort(candidates.begin(), candidates.end());
+    }
+
+    if (candidates.empty()) {
+      return -1;
+    }
+    return candidates[counter_random(seed, position, 0, RandomStream::select) %
+                      candidates.size()];
+  }
+
+  /**
+   * Solve a chunk having the pattern of every known cell with a live WFC.
+   * Return nullopt if no chunk was found in attempts runs.
+   */
+  std::optional<Array2D<unsigned>> solve(const Array2D<int> &known,
+                                         uint64_t seed,
+                                         unsigned attempts = 10) const
+      noexcept {
+    ConstraintLayer layer =
+        ConstraintLayer::from_patterns(known, model->nb_patterns);
+    for (unsigned attempt = 0; attempt < attempts; attempt++) {
+      WFC wfc(false,
+              (int)counter_random(seed, 0, attempt, RandomStream::observe),
+              model, chunk_size, chunk_size);
+      // The contradiction doesn't depend on the seed.
+      if (wfc.add_constraints(layer)) {
+        return std::nullopt;
+      }
+      std::optional<Array2D<unsigned>> result = wfc.run();
+      if (result.has_value()) {
+        return result;
+      }
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * Fill the library with Wang-style chunks. The 3x3 cells around the center
+   * of a free chunk give the corner of every chunk and the cells next to it
+   * on the seams, so that the seams meet the same way at every corner.
+   * nb_seams chunks whose middle row and middle column start and end with
+   * these cells give the seams (these middle rows and columns, which are
+   * known to fit between two chunks). Then for every pair (top seam, left
+   * seam), chunks_per_pair chunks are solved with a random seam on each of
+   * their 4 borders. Seams are dropped until every pair of the remaining
+   * seams has a chunk. Some corners leave no seam, then another free chunk
+   * is tried.
+   */
+  void build(unsigned nb_seams, unsigned chunks_per_pair,
+             uint64_t seed) noexcept {
+    Array2D<int> known(chunk_size, chunk_size, -1);
+    for (unsigned attempt = 0; attempt < 8; attempt++) {
+      std::optional<Array2D<unsigned>> corner_chunk =
+          solve(known, counter_random(seed, 0, attempt, RandomStream::select));
+      if (corner_chunk.has_value() &&
+          build_around(*corner_chunk, nb_seams, chunks_per_pair,
+                       counter_random(seed, 1, attempt, RandomStream::select))) {
+        return;
+      }
+    }
+  }
+
+  /**
+   * Write the library to path. The file contains a header, the index sorted
+   * by key (so that it can be searched in place, for example once mapped in
+   * memory), then the chunks. Return false if the file couldn't be written.
+   */
+  bool save(const std::string &path) const noexcept {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+      return false;
+    }
+    std::vector<std::pair<uint64_t, uint32_t>> entries(index.begin(),
+                                                       index.end());
+    std::sort(entries.begin(), entries.end());
+    uint64_t hash = model_hash();
+    uint32_t header[3] = {chunk_size, (uint32_t)chunks.size(),
+                          (uint32_t)entries.size()};
+    file.write(magic, sizeof(magic));
+    file.write((const char *)&hash, sizeof(hash));
+    file.write((const char *)header, sizeof(header));
+    for (const std::pair<uint64_t, uint32_t> &entry : entries) {
+      file.write((const char *)&entry.first, sizeof(entry.first));
+      file.write((const char *)&entry.second, sizeof(entry.second));
+    }
+    for (const Array2D<unsigned> &chunk : chunks) {
+      for (unsigned value : chunk.data) {
+        uint32_t id = value;
+        file.write((const char *)&id, sizeof(id));
+      }
+    }
+    return (bool)file;
+  }
+
+  /**
+   * Replace the content of the library by the one of the file path. Return
+   * false if the file couldn't be read, or if it was written for another
+   * model or chunk size.
+   */
+  bool load(const std::string &path) noexcept {
+    std::ifstream file(path, std::ios::binary);
+    char file_magic[8];
+    uint64_t hash;
+    uint32_t header[3];
+    if (!file.read(file_magic, sizeof(file_magic)) ||
+        memcmp(file_magic, magic, sizeof(magic)) != 0 ||
+        !file.read((char *)&hash, sizeof(hash)) ||
+        !file.read((char *)header, sizeof(header)) || hash != model_hash() ||
+        header[0] != chunk_size) {
+      return false;
+    }
+    std::unordered_multimap<uint64_t, unsigned> file_index;
+    for (uint32_t e = 0; e < header[2]; e++) {
+      uint64_t entry_key;
+      uint32_t id;
+      if (!file.read((char *)&entry_key, sizeof(entry_key)) ||
+          !file.read((char *)&id, sizeof(id)) || id >= header[1]) {
+        return false;
+      }
+      file_index.emplace(entry_key, id);
+    }
+    std::vector<Array2D<unsigned>> file_chunks(
+        header[1], Array2D<unsigned>(chunk_size, chunk_size));
+    std::vector<uint32_t> buffer(chunk_size * chunk_size);
+    for (Array2D<unsigned> &chunk : file_chunks) {
+      if (!file.read((char *)buffer.data(), buffer.size() * sizeof(uint32_t))) {
+        return false;
+      }
+      chunk.data.assign(buffer.begin(), buffer.end());
+    }
+    chunks = std::move(file_chunks);
+    index = std::move(file_index);
+    return true;
+  }
+};
+
+/**
+ * Fill a grid of chunks_height x chunks_width chunks, that is
+ * chunks_height * (chunk_size - 1) + 1 x chunks_width * (chunk_size - 1) + 1
+ * cells. The chunks are placed in scanline order: each one is looked up in
+ * the library from the cells already placed (its top row and left column),
+ * and is only solved with a live WFC when no chunk fits. If learn is true, the
+ * chunks solved live are added to the library. Return nullopt if a chunk
+ * couldn't be solved.
+ */
+inline std::optional<Array2D<unsigned>>
+assemble_chunks(ChunkLibrary &library, unsigned chunks_height,
+                unsigned chunks_width, uint64_t seed,
+                ChunkAssemblyStats *stats = nullptr,
+                bool learn = true) noexcept {
+  const unsigned size = library.get_chunk_size();
+  const unsigned step = size - 1;
+  Array2D<int> grid(chunks_height * step + 1, chunks_width * step + 1, -1);
+  Array2D<int> known(size, size);
+  ChunkAssemblyStats local_stats;
+  if (!stats) {
+    stats = &local_stats;
+  }
+
+  for (unsigned ci = 0; ci < chunks_height; ci++) {
+    for (unsigned cj = 0; cj < chunks_width; cj++) {
+      for (unsigned i = 0; i < size; i++) {
+        for (unsigned j = 0; j < size; j++) {
+          known.get(i, j) = grid.get(ci * step + i, cj * step + j);
+        }
+      }
+      unsigned position = ci * chunks_width + cj;
+      const Array2D<unsigned> *chunk = nullptr;
+      std::optional<Array2D<unsigned>> solved;
+      int id = library.find(known, seed, position);
+      if (id >= 0) {
+        stats->hits++;
+        chunk = &library.get(id);
+      } else {
+        solved = library.solve(
+            known, counter_random(seed, position, 1, RandomStream::select));
+        if (!solved.has_value()) {
+          stats->failures++;
+          return std::nullopt;
+        }
+        stats->live++;
+        if (learn) {
+          library.add(*solved);
+        }
+        chunk = &*solved;
+      }
+      for (unsigned i = 0; i < size; i++) {
+        for (unsigned j = 0; j < size; j++) {
+          grid.get(ci * step + i, cj * step + j) = chunk->get(i, j);
+        }
+      }
+    }
+  }
+
+  Array2D<unsigned> output(grid.height, grid.width);
+  output.data.assign(grid.data.begin(), grid.data.end());
+  return output;
+}
+
+#endif // FAST_WFC_CHUNK_LIBRARY_HPP_
@@ -0,0 +1,133 @@
+#ifndef FAST_WFC_COMPILED_MODEL_HPP_
+#define FAST_WFC_COMPILED_MODEL_HPP_
+
+#include "../../common/wfc_engine.hpp"
+#include "direction.hpp"
+#include <array>
+#include <limits>
+#include <math.h>
+#include <memory>
+#include <vector>
+
+/**
+ * The immutable part of a model, compiled once and shared by every solver.
+ * Wave, Propagator and WFC only keep a shared_ptr<const CompiledModel>, so
+ * running many solvers on the same model only costs one wave and one set of
+ * support counters per solver.
+ */
+struct CompiledModel {
+  /**
+   * propagator[pattern1][direction] contains all the patterns that can be
+   * placed next to pattern1 in the direction direction.
+   */
+  using PropagatorState = std::vector<std::array<std::vector<unsigned>, 4>>;
+
+  /**
+   * The number of distinct patterns.
+   */
+  unsigned nb_patterns;
+
+  /**
+   * The patterns frequencies p, and the precomputation of p * log(p).
+   */
+  std::vector<double> patterns_frequencies;
+  std::vector<double> plogp_patterns_frequencies;
+
+  /**
+   * The precomputation of min (p * log(p)) / 2.
+   * This is used to define the maximum value of the noise.
+   */
+  double half_min_plogp;
+
+  /**
+   * The entropy memoisation of a cell where every pattern is possible.
+   */
+  double base_plogp_sum;
+  double base_sum;
+  double base_log_sum;
+  double base_entropy;
+
+  /**
+   * The propagator stored in CSR form: the patterns compatible with pattern in
+   * direction are propagator_data[propagator_offsets[pattern * 4 + direction]]
+   * up to propagator_data[propagator_offsets[pattern * 4 + direction + 1]].
+   */
+  std::vector<unsigned> propagator_offsets;
+  std::vector<unsigned> propagator_data;
+
+  /**
+   * The value of compatible for a cell where every pattern is possible.
+   */
+  std::vector<std::array<int, 4>> initial_compatible;
+
+  /**
+   * The largest number of decrements of a compatible counter, which gives
+   * the width of the counters (see CompatibleCounters).
+   */
+  unsigned max_support;
+
+  /**
+   * Return the first pattern compatible with pattern in direction.
+   */
+  const unsigned *neighbors_begin(unsigned pattern,
+                                  unsigned direction) const noexcept {
+    return propagator_data.data() + propagator_offsets[pattern * 4 + direction];
+  }
+
+  /**
+   * Return the end of the patterns compatible with pattern in direction.
+   */
+  const unsigned *neighbors_end(unsigned pattern,
+                                unsigned direction) const noexcept {
+    return propagator_data.data() +
+           propagator_offsets[pattern * 4 + direction + 1];
+  }
+
+  /**
+   * Compile a model from its frequencies and its propagator.
+   */
+  static std::shared_ptr<const CompiledModel>
+  compile(const std::vector<double> &patterns_frequencies,
+          const PropagatorState &propagator) {
+    auto model = std::make_shared<CompiledModel>();
+    model->nb_patterns = propagator.size();
+    model->patterns_frequencies = patterns_frequencies;
+
+    model->half_min_plogp = std::numeric_limits<double>::infinity();
+    model->base_plogp_sum = 0;
+    model->base_sum = 0;
+    for (unsigned i = 0; i < model->nb_patterns; i++) {
+      double plogp = patterns_frequencies[i] * log(patterns_frequencies[i]);
+      model->plogp_patterns_frequencies.push_back(plogp);
+      model->half_min_plogp = std::min(model->half_min_plogp, plogp / 2.0);
+      model->base_plogp_sum += plogp;
+      model->base_sum += patterns_frequencies[i];
+    }
+    model->base_log_sum = log(model->base_sum);
+    model->base_entropy =
+        model->base_log_sum - model->base_plogp_sum / model->base_sum;
+
+    model->propagator_offsets.reserve(model->nb_patterns * 4 + 1);
+    model->propagator_offsets.push_back(0);
+    for (unsigned pattern = 0; pattern < model->nb_patterns; pattern++) {
+      for (unsigned direction = 0; direction < 4; direction++) {
+        const std::vector<unsigned> &patterns = propagator[pattern][direction];
+        model->propagator_data.insert(model->propagator_data.end(),
+                                      patterns.begin(), patterns.end());
+        model->propagator_offsets.push_back(model->propagator_data.size());
+      }
+    }
+
+    model->initial_compatible.resize(model->nb_patterns);
+    for (unsigned pattern = 0; pattern < model->nb_patterns; pattern++) {
+      for (unsigned direction = 0; direction < 4; direction++) {
+        model->initial_compatible[pattern][direction] =
+            propagator[pattern][get_opposite_direction(direction)].size();
+      }
+    }
+    model->max_support = max_compatible_support<4>(*model);
+    return model;
+  }
+};
+
+#endif // FAST_WFC_COMPILED_MODEL_HPP_
@@ -0,0 +1,163 @@
+#ifndef FAST_WFC_CONSTRAINT_LAYER_HPP_
+#define FAST_WFC_CONSTRAINT_LAYER_HPP_
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+
+#include "utils/array2D.hpp"
+#include "utils/array3D.hpp"
+
+/**
+ * The cell (i,j) of the wave where a contradiction was found.
+ * When the cell was emptied by the propagation, pattern is the last pattern
+ * removed from it and direction the direction (see direction.hpp) from the
+ * neighbor whose removal of source_pattern took away its last support.
+ * They are -1 when the cell was emptied directly (by a constraint layer).
+ * layer_mismatch is true when a constraint layer was not applied because its
+ * dimensions are not the ones of the wave, the cell is then (0,0).
+ */
+struct Contradiction {
+  unsigned i;
+  unsigned j;
+  int pattern = -1;
+  int direction = -1;
+  int source_pattern = -1;
+  bool layer_mismatch = false;
+};
+
+/**
+ * Identify the content of a constraint layer in a WFCSnapshotCache. hash is
+ * computed once per layer, and the contents are only compared when two keys
+ * have the same hash. A key without content stands for no layer.
+ */
+struct ConstraintKey {
+  size_t hash = 0;
+  std::shared_ptr<const Array3D<uint8_t>> allowed;
+
+  bool operator==(const ConstraintKey &other) const noexcept {
+    if (hash != other.hash) {
+      return false;
+    }
+    if (allowed == other.allowed) {
+      return true;
+    }
+    return allowed && other.allowed &&
+           allowed->height == other.allowed->height &&
+           allowed->width == other.allowed->width &&
+           allowed->depth == other.allowed->depth &&
+           allowed->data == other.allowed->data;
+  }
+};
+
+/**
+ * A layer of constraints applied to the whole wave before the first
+ * observation. allowed.get(i, j, pattern) is 0 if pattern is banned from
+ * cell (i,j). Every pattern is allowed by default.
+ */
+struct ConstraintLayer {
+  Array3D<uint8_t> allowed;
+
+  /**
+   * The key of the layer, computed by the first call to key() and reset by
+   * the functions changing the layer. A layer changed through allowed
+   * directly after a call to key() keeps its old key.
+   */
+  mutable ConstraintKey cached_key;
+
+  /**
+   * Build a layer allowing every pattern in every cell.
+   */
+  ConstraintLayer(unsigned wave_height, unsigned wave_width,
+                  unsigned nb_patterns) noexcept
+      : allowed(wave_height, wave_width, nb_patterns, 1) {}
+
+  /**
+   * Build a layer from a grid of pattern ids. Cells with a negative id are
+   * left free, the other cells can only contain their pattern.
+   */
+  static ConstraintLayer from_patterns(const Array2D<int> &patterns,
+                                       unsigned nb_patterns) noexcept {
+    ConstraintLayer layer(patterns.height, patterns.width, nb_patterns);
+    for (unsigned i = 0; i < patterns.height; i++) {
+      for (unsigned j = 0; j < patterns.width; j++) {
+        if (patterns.get(i, j) >= 0) {
+          layer.fix(i, j, patterns.get(i, j));
+        }
+      }
+    }
+    return layer;
+  }
+
+  /**
+   * Only allow pattern in cell (i,j).
+   */
+  void fix(unsigned i, unsigned j, unsigned pattern) noexcept {
+    cached_key.allowed.reset();
+    for (unsigned k = 0; k < allowed.depth; k++) {
+      allowed.get(i, j, k) = (k == pattern);
+    }
+  }
+
+  /**
+   * Only allow the given patterns in cell (i,j).
+   */
+  void allow_only(unsigned i, unsigned j,
+                  const std::vector<unsigned> &patterns) noexcept {
+    cached_key.allowed.reset();
+    for (unsigned k = 0; k < allowed.depth; k++) {
+      allowed.get(i, j, k) = 0;
+    }
+    for (unsigned pattern : patterns) {
+      allowed.get(i, j, pattern) = 1;
+    }
+  }
+
+  /**
+   * Ban pattern from cell (i,j).
+   */
+  void ban(unsigned i, unsigned j, unsigned pattern) noexcept {
+    cached_key.allowed.reset();
+    allowed.get(i, j, pattern) = 0;
+  }
+
+  /**
+   * Return true if the layer can be applied to a wave of wave_height x
+   * wave_width cells and nb_patterns patterns.
+   */
+  bool matches(unsigned wave_height, unsigned wave_width,
+               unsigned nb_patterns) const noexcept {
+    return allowed.height == wave_height && allowed.width == wave_width &&
+           allowed.depth == nb_patterns;
+  }
+
+  /**
+   * Return a pointer to the allowed patterns of cell index.
+   */
+  const uint8_t *get(unsigned index) const noexcept {
+    return allowed.data.data() + index * allowed.depth;
+  }
+
+  /**
+   * Return the key identifying the content of the layer in a
+   * WFCSnapshotCache. The content is hashed and copied once, the next calls
+   * share it until the layer is changed.
+   */
+  ConstraintKey key() const {
+    if (!cached_key.allowed) {
+      size_t hash = std::hash<std::string_view>()(std::string_view(
+          (const char *)allowed.data.data(), allowed.data.size()));
+      for (size_t value : {(size_t)allowed.height, (size_t)allowed.width,
+                           (size_t)allowed.depth}) {
+        hash ^= value + (size_t)0x9e3779b9 + (hash << 6) + (hash >> 2);
+      }
+      cached_key.hash = hash;
+      cached_key.allowed = std::make_shared<const Array3D<uint8_t>>(allowed);
+    }
+    return cached_key;
+  }
+};
+
+#endif // FAST_WFC_CONSTRAINT_LAYER_HPP_
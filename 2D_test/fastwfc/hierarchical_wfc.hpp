@@ -0,0 +1,240 @@
+#ifndef FAST_WFC_HIERARCHICAL_WFC_HPP_
+#define FAST_WFC_HIERARCHICAL_WFC_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "chunk_library.hpp"
+#include "compiled_model.hpp"
+#include "constraint_layer.hpp"
+#include "counter_rng.hpp"
+#include "direction.hpp"
+#include "utils/array2D.hpp"
+#include "wfc.hpp"
+
+/**
+ * The statistics of run_hierarchical.
+ */
+struct HierarchicalStats {
+  unsigned coarse_attempts = 0; // Runs of the coarse WFC.
+  unsigned refined = 0;         // Blocks refined by the fine WFC.
+  unsigned kept = 0;            // Blocks whose refinement failed, kept as is.
+};
+
+/**
+ * A coarse model whose patterns (the super-tiles) are the chunks of a
+ * ChunkLibrary: square blocks of fine pattern ids, where neighbor blocks
+ * overlap by one row or column. Two blocks can be placed next to each other
+ * if their shared border is the same, so a grid of blocks solved by a WFC on
+ * the coarse model is a valid fine output. The Wang-style chunks of
+ * ChunkLibrary::build make a good coarse model, since every pair of their
+ * seams has a block.
+ */
+class CoarseModel {
+private:
+  std::shared_ptr<const CompiledModel> fine;
+
+  /**
+   * The number of fine cells on a side of a block, shared borders included.
+   */
+  unsigned block_size;
+
+  /**
+   * The blocks, the coarse pattern i being blocks[i].
+   */
+  std::vector<Array2D<unsigned>> blocks;
+
+  std::shared_ptr<const CompiledModel> compiled;
+
+  /**
+   * Return the border of block in direction.
+   */
+  std::vector<unsigned> border(const Array2D<unsigned> &block,
+                               unsigned direction) const noexcept {
+    const unsigned last = block_size - 1;
+    std::vector<unsigned> cells(block_size);
+    for (unsigned k = 0; k < block_size; k++) {
+      if (directions_x[direction] != 0) {
+        cells[k] = block.get(k, directions_x[direction] > 0 ? last : 0);
+      } else {
+        cells[k] = block.get(directions_y[direction] > 0 ? last : 0, k);
+      }
+    }
+    return cells;
+  }
+
+public:
+  /**
+   * Build the coarse model of the chunks of library, with the same weight.
+   */
+  CoarseModel(const ChunkLibrary &library) noexcept
+      : fine(library.get_model()), block_size(library.get_chunk_size()) {
+    for (unsigned id = 0; id < library.size(); id++) {
+      blocks.push_back(library.get(id));
+    }
+
+    // The blocks having every border, for every direction.
+    std::array<std::map<std::vector<unsigned>, std::vector<unsigned>>, 4>
+        by_border;
+    for (unsigned b = 0; b < blocks.size(); b++) {
+      for (unsigned direction = 0; direction < 4; direction++) {
+        by_border[direction][border(blocks[b], direction)].push_back(b);
+      }
+    }
+
+    // b can be placed next to a in direction if the border of a in
+    // direction is the border of b in the opposite direction.
+    CompiledModel::PropagatorState propagator(blocks.size());
+    for (unsigned a = 0; a < blocks.size(); a++) {
+      for (unsigned direction = 0; direction < 4; direction++) {
+        const std::map<std::vector<unsigned>, std::vector<unsigned>> &blocks_by =
+            by_border[get_opposite_direction(direction)];
+        auto it = blocks_by.find(border(blocks[a], direction));
+        if (it != blocks_by.end()) {
+          propagator[a][direction] = it->second;
+        }
+      }
+    }
+    compiled = CompiledModel::compile(
+        std::vector<double>(blocks.size(), 1.0), propagator);
+  }
+
+  std::shared_ptr<const CompiledModel> get_fine() const noexcept {
+    return fine;
+  }
+
+  std::shared_ptr<const CompiledModel> get_compiled() const noexcept {
+    return compiled;
+  }
+
+  unsigned get_block_size() const noexcept { return block_size; }
+
+  /**
+   * Return the block of coarse pattern id.
+   */
+  const Array2D<unsigned> &get_block(unsigned id) const noexcept {
+    return blocks[id];
+  }
+};
+
+/**
+ * Generate a fine output of coarse_height x coarse_width blocks, that is
+ * coarse_height * (block_size - 1) + 1 x coarse_width * (block_size - 1) + 1
+ * cells, in two passes.
+ *
+ * The coarse model is solved first, up to attempts runs: a coarse grid is
+ * small, so a contradiction only costs a cheap restart. The borders of the
+ * coarse blocks are then fixed, and the inside of every block is solved again
+ * by the fine WFC. The borders are shared with the neighbor blocks, so the
+ * blocks are refined independently, on nb_threads threads (0 for one per
+ * core), and a refinement can't break the output: when the fine WFC meets a
+ * contradiction, the inside of the coarse block is kept. The seed of a block
+ * only depends on its position, so the output doesn't depend on nb_threads.
+ * Return nullopt if the coarse model couldn't be solved.
+ */
+inline std::optional<Array2D<unsigned>>
+run_hierarchical(const CoarseModel &coarse, unsigned coarse_height,
+                 unsigned coarse_width, uint64_t seed, unsigned nb_threads = 0,
+                 HierarchicalStats *stats = nullptr,
+                 unsigned attempts = 10) noexcept {
+  HierarchicalStats local_stats;
+  if (!stats) {
+    stats = &local_stats;
+  }
+  const std::shared_ptr<const CompiledModel> &compiled = coarse.get_compiled();
+  std::optional<Array2D<unsigned>> labels;
+  for (unsigned attempt = 0; attempt < attempts && !labels.has_value();
+       attempt++) {
+    stats->coarse_attempts++;
+    WFC wfc(false,
+            (int)counter_random(seed, 0, attempt, RandomStream::observe),
+            compiled, coarse_height, coarse_width, Heuristic::scanline);
+    labels = wfc.run();
+  }
+  if (!labels.has_value()) {
+    return std::nullopt;
+  }
+
+  const unsigned size = coarse.get_block_size();
+  const unsigned step = size - 1;
+  const unsigned nb_blocks = coarse_height * coarse_width;
+  Array2D<unsigned> output(coarse_height * step + 1, coarse_width * step + 1);
+
+  // The borders, written before the threads start, which then only write
+  // the inside of their blocks.
+  for (unsigned block = 0; block < nb_blocks; block++) {
+    const Array2D<unsigned> &label = coarse.get_block(labels->data[block]);
+    unsigned i0 = block / coarse_width * step;
+    unsigned j0 = block % coarse_width * step;
+    for (unsigned k = 0; k < size; k++) {
+      output.get(i0, j0 + k) = label.get(0, k);
+      output.get(i0 + step, j0 + k) = label.get(step, k);
+      output.get(i0 + k, j0) = label.get(k, 0);
+      output.get(i0 + k, j0 + step) = label.get(k, step);
+    }
+  }
+
+  std::atomic<unsigned> next_block(0);
+  std::atomic<unsigned> kept(0);
+  auto worker = [&]() {
+    Array2D<int> known(size, size, -1);
+    for (unsigned block = next_block++; block < nb_blocks;
+         block = next_block++) {
+      const Array2D<unsigned> &label = coarse.get_block(labels->data[block]);
+      for (unsigned k = 0; k < size; k++) {
+        known.get(0, k) = label.get(0, k);
+        known.get(step, k) = label.get(step, k);
+        known.get(k, 0) = label.get(k, 0);
+        known.get(k, step) = label.get(k, step);
+      }
+      ConstraintLayer layer =
+          ConstraintLayer::from_patterns(known, coarse.get_fine()->nb_patterns);
+      std::optional<Array2D<unsigned>> refined;
+      for (unsigned attempt = 1; attempt <= 3 && !refined.has_value();
+           attempt++) {
+        WFC wfc(false,
+                (int)counter_random(seed, block, attempt, RandomStream::observe),
+                coarse.get_fine(), size, size);
+        if (wfc.add_constraints(layer)) {
+          break;
+        }
+        refined = wfc.run();
+      }
+      if (!refined.has_value()) {
+        kept++;
+      }
+      const Array2D<unsigned> &result = refined.has_value() ? *refined : label;
+      unsigned i0 = block / coarse_width * step;
+      unsigned j0 = block % coarse_width * step;
+      for (unsigned i = 1; i < step; i++) {
+        for (unsigned j = 1; j < step; j++) {
+          output.get(i0 + i, j0 + j) = result.get(i, j);
+        }
+      }
+    }
+  };
+
+  if (nb_threads == 0) {
+    nb_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < nb_threads; t++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  stats->kept += kept;
+  stats->refined += nb_blocks - kept;
+  return output;
+}
+
+#endif // FAST_WFC_HIERARCHICAL_WFC_HPP_
@@ -1,10 +1,15 @@
 #ifndef FAST_WFC_OVERLAPPING_WFC_HPP_
 #define FAST_WFC_OVERLAPPING_WFC_HPP_
 
+#include <memory>
+#include <string>
+#include <tuple>
 #include <vector>
 #include <unordered_map>
 
 #include "utils/array2D.hpp"
+#include "constraint_layer.hpp"
+#include "snapshot_cache.hpp"
 #include "wfc.hpp"
 
 /**
@@ -18,6 +23,7 @@ struct OverlappingWFCOptions {
 	unsigned symmetry; // The number of symmetries (the order is defined in wfc).
 	bool ground;       // True if the ground needs to be set (see init_ground).
 	unsigned pattern_size; // The width and height in pixel of the patterns.
+	Heuristic heuristic = Heuristic::entropy; // The choice of the next cell.
 
 	/**
 	* Get the wave height given these options.
@@ -34,6 +40,16 @@ struct OverlappingWFCOptions {
 	}
 };
 
+/**
+* The immutable part of an overlapping model, shared by every OverlappingWFC
+* built on the same input and options.
+* صģͣɱOverlappingWFC
+*/
+template <typename T> struct OverlappingModel {
+	std::vector<Array2D<T>> patterns;
+	std::shared_ptr<const CompiledModel> compiled;
+};
+
 /**
 * Class generating a new image with the overlapping WFC algorithm.
 * wfc㷨һµλͼ
@@ -53,10 +69,10 @@ private:
 	OverlappingWFCOptions options;
 
 	/**
-	* The array of the different patterns extracted from the input.
-	* ͼȡĲͬͼ
+	* The different patterns extracted from the input, and the compiled model.
+	* ͼȡĲͬͼԼģ
 	*/
-	std::vector<Array2D<T>> patterns;
+	std::shared_ptr<const OverlappingModel<T>> model;
 
 	/**
 	* The underlying generic WFC algorithm.
@@ -64,37 +80,6 @@ private:
 	*/
 	WFC wfc;
 
-	/**
-	* Constructor initializing the wfc.
-	* This constructor is called by the other constructors.
-	* This is necessary in order to initialize wfc only once.
-	* 캯
-	*/
-	OverlappingWFC(
-		const Array2D<T> &input, const OverlappingWFCOptions &options,
-		const int &seed,
-		const std::pair<std::vector<Array2D<T>>, std::vector<double>> &patterns,
-		const std::vector<std::array<std::vector<unsigned>, 4>>
-		&propagator) noexcept
-		: input(input), options(options), patterns(patterns.first),
-		wfc(options.periodic_output, seed, patterns.second, propagator,
-			options.get_wave_height(), options.get_wave_width()) {
-		// If necessary, the ground is set.
-		if (options.ground) {
-			init_ground(wfc, input, patterns.first, options);
-		}
-	}
-
-	/**
-	* Constructor used only to call the other constructor with more computed parameters.
-	* 캯иʱ캯
-	*/
-	OverlappingWFC(const Array2D<T> &input, const OverlappingWFCOptions &options,
-		const int &seed,
-		const std::pair<std::vector<Array2D<T>>, std::vector<double>>
-		&patterns) noexcept
-		: OverlappingWFC(input, options, seed, patterns,
-			generate_compatible(patterns.first)) {}
 
 	/**
 	* Init the ground of the output image.
@@ -283,6 +268,7 @@ private:
 	* 2dͼidתΪ
 	*/
 	Array2D<T> to_image(const Array2D<unsigned> &output_patterns) const noexcept {
+		const std::vector<Array2D<T>> &patterns = model->patterns;
 		Array2D<T> output = Array2D<T>(options.out_height, options.out_width);
 
 		if (options.periodic_output) {
@@ -327,13 +313,116 @@ private:
 	}
 
 public:
+	/**
+	* Extract the patterns of the input and compile the model.
+	* The result can be shared by many OverlappingWFC.
+	* ȡͼģͣɱOverlappingWFC
+	*/
+	static std::shared_ptr<const OverlappingModel<T>>
+		compile(const Array2D<T> &input,
+			const OverlappingWFCOptions &options) noexcept {
+		auto model = std::make_shared<OverlappingModel<T>>();
+		std::vector<double> patterns_frequency;
+		std::tie(model->patterns, patterns_frequency) =
+			get_patterns(input, options);
+		model->compiled = CompiledModel::compile(
+			patterns_frequency, generate_compatible(model->patterns));
+		return model;
+	}
+
+	/**
+	* Constructor using a shared model compiled from the same input and options.
+	* 캯ʹùģ
+	*/
+	OverlappingWFC(const Array2D<T> &input, const OverlappingWFCOptions &options,
+		std::shared_ptr<const OverlappingModel<T>> model, int seed) noexcept
+		: input(input), options(options), model(model),
+		wfc(options.periodic_output, seed, model->compiled,
+			options.get_wave_height(), options.get_wave_width(),
+			options.heuristic) {
+		// If necessary, the ground is set.
+		if (options.ground) {
+			init_ground(wfc, input, model->patterns, options);
+		}
+	}
+
+	/**
+	* Constructor starting from the cached state after the ground has been set
+	* and propagated. The snapshot is computed on the first use of a key.
+	* 캯ӻĳʼԼտʼ
+	*/
+	OverlappingWFC(const Array2D<T> &input, const OverlappingWFCOptions &options,
+		std::shared_ptr<const OverlappingModel<T>> model, int seed,
+		WFCSnapshotCache &cache,
+		const ConstraintLayer *constraints = nullptr) noexcept
+		: input(input), options(options), model(model),
+		wfc(*cache.get({ model->compiled, options.get_wave_height(),
+			options.get_wave_width(), options.periodic_output, options.heuristic,
+			options.ground ? "ground" : "",
+			constraints ? constraints->key() : ConstraintKey() },
+			[&](WFC &solver) {
+				if (options.ground) {
+					init_ground(solver, input, model->patterns, options);
+				}
+				if (constraints) {
+					solver.add_constraints(*constraints);
+				}
+			}), seed) {}
+
 	/**
 	* The constructor used by the user.
 	* ûɵõĹ캯
 	*/
 	OverlappingWFC(const Array2D<T> &input, const OverlappingWFCOptions &options,
 		int seed) noexcept
-		: OverlappingWFC(input, options, seed, get_patterns(input, options)) {}
+		: OverlappingWFC(input, options, compile(input, options), seed) {}
+
+	/**
+	* Build a constraint layer from an image mask of the size of the output.
+	* Every pixel of the mask different from free_color must appear in the
+	* output, so a pattern is only allowed where it agrees with the mask.
+	* ͬСͼƬԼ
+	* free_colorر
+	*/
+	ConstraintLayer constraints_from_image(const Array2D<T> &mask,
+		const T &free_color) const noexcept {
+		const std::vector<Array2D<T>> &patterns = model->patterns;
+		ConstraintLayer layer(options.get_wave_height(), options.get_wave_width(),
+			patterns.size());
+		for (unsigned i = 0; i < options.get_wave_height(); i++) {
+			for (unsigned j = 0; j < options.get_wave_width(); j++) {
+				for (unsigned p = 0; p < patterns.size(); p++) {
+					for (unsigned dy = 0; dy < options.pattern_size; dy++) {
+						for (unsigned dx = 0; dx < options.pattern_size; dx++) {
+							const T &color = mask.get((i + dy) % mask.height,
+								(j + dx) % mask.width);
+							if (color != free_color && color != patterns[p].get(dy, dx)) {
+								layer.ban(i, j, p);
+							}
+						}
+					}
+				}
+			}
+		}
+		return layer;
+	}
+
+	/**
+	* Apply a whole layer of constraints (see WFC::add_constraints).
+	* ӦԼ
+	*/
+	std::optional<Contradiction>
+		add_constraints(const ConstraintLayer &constraints) noexcept {
+		return wfc.add_constraints(constraints);
+	}
+
+	/**
+	* Return the contradiction of a failed run (see WFC::get_contradiction).
+	* ʧеì
+	*/
+	std::optional<Contradiction> get_contradiction() const noexcept {
+		return wfc.get_contradiction();
+	}
 
 	/**
 	* Run the WFC algorithm, and return the result if the algorithm succeeded.
@@ -1,9 +1,12 @@
 #ifndef FAST_WFC_PROPAGATOR_HPP_
 #define FAST_WFC_PROPAGATOR_HPP_
 
+#include "../../common/wfc_engine.hpp"
+#include "compiled_model.hpp"
+#include "constraint_layer.hpp"
 #include "direction.hpp"
-#include "utils/array3D.hpp"
 #include "wave.hpp"
+#include <optional>
 #include <tuple>
 #include <vector>
 #include <array>
@@ -13,19 +16,27 @@
  */
 class Propagator {
 public:
-  using PropagatorState = std::vector<std::array<std::vector<unsigned>, 4>>;
+  using PropagatorState = CompiledModel::PropagatorState;
+
+  /**
+   * The shared kernels (see wfc_engine.hpp), on the axes (y, x).
+   */
+  using BoundedEngine = WFCEngine<2, BoundedTopology>;
+  using PeriodicEngine = WFCEngine<2, PeriodicTopology>;
+  using Item = BoundedEngine::Item;
 
 private:
   /**
-   * The size of the patterns.
+   * The compiled model shared by every solver. It contains the propagator:
+   * the patterns that can be placed next to pattern1 in the direction
+   * direction.
    */
-  const unsigned patterns_size;
+  std::shared_ptr<const CompiledModel> model;
 
   /**
-   * propagator[pattern1][direction] contains all the patterns that can
-   * be placed in next to pattern1 in the direction direction.
+   * The size of the patterns.
    */
-  PropagatorState propagator_state;
+  const unsigned patterns_size;
 
   /**
    * The wave width and height.
@@ -39,53 +50,69 @@ private:
   const bool periodic_output;
 
   /**
-   * All the tuples (y, x, pattern) that should be propagated.
-   * The tuple should be propagated when wave.get(y, x, pattern) is set to
+   * All the cells ({y, x}, pattern) that should be propagated.
+   * The item should be propagated when wave.get(y, x, pattern) is set to
    * false.
    */
-  std::vector<std::tuple<unsigned, unsigned, unsigned>> propagating;
+  std::vector<Item> propagating;
 
   /**
-   * compatible.get(y, x, pattern)[direction] contains the number of patterns
-   * present in the wave that can be placed in the cell next to (y,x) in the
-   * opposite direction of direction without being in contradiction with pattern
-   * placed in (y,x). If wave.get(y, x, pattern) is set to false, then
-   * compatible.get(y, x, pattern) has every element negative or null
+   * The counters of pattern in the cell y * wave_width + x contain for every
+   * direction the number of patterns present in the wave that can be placed
+   * in the cell next to (y,x) in the opposite direction of direction without
+   * being in contradiction with pattern placed in (y,x). If wave.get(y, x,
+   * pattern) is set to false, then its counters are all null. They are stored
+   * with the narrowest type allowed by the maximum support of the model.
    */
-  Array3D<std::array<int, 4>> compatible;
+  CompatibleCounters<4> compatible;
 
   /**
-   * Initialize compatible.
+   * The first cell emptied by the propagation, with the pattern and the
+   * direction that emptied it. Once it is set, the propagation stops and the
+   * remaining elements are dropped.
    */
-  void init_compatible() noexcept {
-    std::array<int, 4> value;
-    // We compute the number of pattern compatible in all directions.
-    for (unsigned y = 0; y < wave_height; y++) {
-      for (unsigned x = 0; x < wave_width; x++) {
-        for (unsigned pattern = 0; pattern < patterns_size; pattern++) {
-          for (int direction = 0; direction < 4; direction++) {
-            value[direction] =
-                propagator_state[pattern][get_opposite_direction(direction)]
-                    .size();
-          }
-          compatible.get(y, x, pattern) = value;
-        }
-      }
+  std::optional<Contradiction> contradiction;
+
+  /**
+   * Propagate the elements of propagating with the kernels compiled for
+   * Bound, the bound of the number of patterns of the model, and for the
+   * type of the counters.
+   */
+  template <typename Bound, typename Counters>
+  bool propagate_bounded(Wave &wave, Counters &counts) noexcept {
+    // The propagation itself is the kernel shared with the 3D engine.
+    const BoundedEngine::Coordinates sizes = {wave.height, wave.width};
+    auto index_of = [&](const BoundedEngine::Coordinates &cell) {
+      return BoundedEngine::linear_index(sizes, cell);
+    };
+    std::optional<BoundedEngine::Conflict> conflict =
+        periodic_output
+            ? PeriodicEngine::propagate<Bound>(*model, sizes, index_of, counts,
+                                               propagating, wave)
+            : BoundedEngine::propagate<Bound>(*model, sizes, index_of, counts,
+                                              propagating, wave);
+    if (conflict) {
+      contradiction =
+          Contradiction{conflict->cell[0], conflict->cell[1],
+                        (int)conflict->pattern, (int)conflict->direction,
+                        (int)conflict->source_pattern};
+      return false;
     }
+    return true;
   }
 
 public:
   /**
    * Constructor building the propagator and initializing compatible.
+   * The number of patterns compatible in all directions is precomputed in
+   * the model.
    */
   Propagator(unsigned wave_height, unsigned wave_width, bool periodic_output,
-             PropagatorState propagator_state) noexcept
-      : patterns_size(propagator_state.size()),
-        propagator_state(propagator_state), wave_width(wave_width),
+             std::shared_ptr<const CompiledModel> model) noexcept
+      : model(model), patterns_size(model->nb_patterns), wave_width(wave_width),
         wave_height(wave_height), periodic_output(periodic_output),
-        compatible(wave_height, wave_width, patterns_size) {
-    init_compatible();
-  }
+        compatible(wave_height * wave_width, patterns_size, model->max_support,
+                   model->initial_compatible.data()) {}
 
   /**
    * Add an element to the propagator.
@@ -93,70 +120,41 @@ public:
    */
   void add_to_propagator(unsigned y, unsigned x, unsigned pattern) noexcept {
     // All the direction are set to 0, since the pattern cannot be set in (y,x).
-    std::array<int, 4> temp = {};
-    compatible.get(y, x, pattern) = temp;
-    propagating.emplace_back(y, x, pattern);
+    compatible.clear(y * wave_width + x, pattern);
+    propagating.push_back({{y, x}, pattern});
   }
 
   /**
    * Propagate the information given with add_to_propagator.
+   * Stop at the first cell with no possible pattern left and return false,
+   * the contradiction is then given by get_contradiction.
    */
-  void propagate(Wave &wave) noexcept {
-
-    // We propagate every element while there is element to propagate.
-    while (propagating.size() != 0) {
-
-      // The cell and pattern that has been set to false.
-      unsigned y1, x1, pattern;
-      std::tie(y1, x1, pattern) = propagating.back();
-      propagating.pop_back();
-
-      // We propagate the information in all 4 directions.
-      for (unsigned direction = 0; direction < 4; direction++) {
-
-        // We get the next cell in the direction direction.
-        int dx = directions_x[direction];
-        int dy = directions_y[direction];
-        int x2, y2;
-        if (periodic_output) {
-          x2 = ((int)x1 + dx + (int)wave.width) % wave.width;
-          y2 = ((int)y1 + dy + (int)wave.height) % wave.height;
-        } else {
-          x2 = x1 + dx;
-          y2 = y1 + dy;
-          if (x2 < 0 || x2 >= (int)wave.width) {
-            continue;
-          }
-          if (y2 < 0 || y2 >= (int)wave.height) {
-            continue;
-          }
-        }
-
-        // The index of the second cell, and the patterns compatible
-        unsigned i2 = x2 + y2 * wave.width;
-        const std::vector<unsigned> &patterns =
-            propagator_state[pattern][direction];
-
-        // For every pattern that could be placed in that cell without being in
-        // contradiction with pattern1
-        for (auto it = patterns.begin(), it_end = patterns.end(); it < it_end;
-             ++it) {
-
-          // We decrease the number of compatible patterns in the opposite
-          // direction If the pattern was discarded from the wave, the element
-          // is still negative, which is not a problem
-          std::array<int, 4> &value = compatible.get(y2, x2, *it);
-          value[direction]--;
-
-          // If the element was set to 0 with this operation, we need to remove
-          // the pattern from the wave, and propagate the information
-          if (value[direction] == 0) {
-            add_to_propagator(y2, x2, *it);
-            wave.set(i2, *it, false);
-          }
-        }
-      }
+  bool propagate(Wave &wave) noexcept {
+    if (contradiction) {
+      propagating.clear();
+      return false;
     }
+    // The wave was already in contradiction before the propagation (for
+    // example a constraint layer emptied a cell).
+    if (wave.impossible()) {
+      unsigned index = wave.get_contradiction_index();
+      contradiction = Contradiction{index / wave.width, index % wave.width};
+      propagating.clear();
+      return false;
+    }
+
+    return with_pattern_bound(patterns_size, [&](auto bound) {
+      return compatible.visit([&](auto &counts) {
+        return propagate_bounded<decltype(bound)>(wave, counts);
+      });
+    });
+  }
+
+  /**
+   * Return the contradiction found by the propagation, if any.
+   */
+  const std::optional<Contradiction> &get_contradiction() const noexcept {
+    return contradiction;
   }
 };
 
@@ -0,0 +1,94 @@
+#ifndef FAST_WFC_SNAPSHOT_CACHE_HPP_
+#define FAST_WFC_SNAPSHOT_CACHE_HPP_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "compiled_model.hpp"
+#include "wfc.hpp"
+
+/**
+ * Identify the state of a WFC after its initial constraints: the model, the
+ * size of the wave, the heuristic, a description of the other constraints
+ * applied before the first observation (ground, ...), and the key of the
+ * constraint layer applied, if any.
+ */
+struct WFCSnapshotKey {
+  std::shared_ptr<const CompiledModel> model;
+  unsigned wave_height;
+  unsigned wave_width;
+  bool periodic_output;
+  Heuristic heuristic;
+  std::string constraints;
+  ConstraintKey layer;
+
+  bool operator==(const WFCSnapshotKey &other) const noexcept {
+    return model == other.model && wave_height == other.wave_height &&
+           wave_width == other.wave_width &&
+           periodic_output == other.periodic_output &&
+           heuristic == other.heuristic &&
+           constraints == other.constraints && layer == other.layer;
+  }
+};
+
+namespace std {
+template <> class hash<WFCSnapshotKey> {
+public:
+  size_t operator()(const WFCSnapshotKey &key) const noexcept {
+    size_t seed = hash<const CompiledModel *>()(key.model.get());
+    for (size_t value :
+         {(size_t)key.wave_height, (size_t)key.wave_width,
+          (size_t)key.periodic_output, (size_t)key.heuristic,
+          hash<std::string>()(key.constraints), key.layer.hash}) {
+      seed ^= value + (size_t)0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+    return seed;
+  }
+};
+} // namespace std
+
+/**
+ * Cache of the WFC states obtained after the initial constraints have been
+ * applied and propagated. Every run with the same key starts from a copy of
+ * the snapshot instead of redoing the same prologue.
+ */
+class WFCSnapshotCache {
+private:
+  std::unordered_map<WFCSnapshotKey, std::shared_ptr<const WFC>> snapshots;
+
+public:
+  /**
+   * Return the snapshot of key. If it is not in the cache, it is computed by
+   * applying prologue to a fresh WFC, then calling prepare.
+   */
+  std::shared_ptr<const WFC>
+  get(const WFCSnapshotKey &key,
+      const std::function<void(WFC &)> &prologue) noexcept {
+    auto it = snapshots.find(key);
+    if (it != snapshots.end()) {
+      return it->second;
+    }
+    WFC wfc(key.periodic_output, 0, key.model, key.wave_height, key.wave_width,
+            key.heuristic);
+    prologue(wfc);
+    wfc.prepare();
+    std::shared_ptr<const WFC> snapshot =
+        std::make_shared<const WFC>(std::move(wfc));
+    snapshots.emplace(key, snapshot);
+    return snapshot;
+  }
+
+  /**
+   * The number of snapshots in the cache.
+   */
+  size_t size() const noexcept { return snapshots.size(); }
+
+  /**
+   * Remove every snapshot.
+   */
+  void clear() noexcept { snapshots.clear(); }
+};
+
+#endif // FAST_WFC_SNAPSHOT_CACHE_HPP_
@@ -1,8 +1,12 @@
 
+#include <memory>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "utils/array2D.hpp"
+#include "constraint_layer.hpp"
+#include "snapshot_cache.hpp"
 #include "wfc.hpp"
 
 /**
@@ -32,7 +36,7 @@ unsigned nb_of_possible_orientations(const Symmetry &symmetry) {
  * 瓷砖结构
  */
 template <typename T> struct Tile {
-  std::vector<Array2D<T>> data; // 位置
+  std::vector<Array2D<T>> data; // 基础图像，或每个方向一个图像（见get）
   Symmetry symmetry;            // 对称结构
   double weight;				// 
 
@@ -107,38 +111,31 @@ template <typename T> struct Tile {
   }
 
   /**
-   * 根据瓷砖类型产生所有旋转
+   * 方向的数量，每个方向没有单独的图像时由对称结构决定
    */
-  static std::vector<Array2D<T>> generate_oriented(Array2D<T> data,
-                                                   Symmetry symmetry) noexcept {
-    std::vector<Array2D<T>> oriented;
-    oriented.push_back(data);
+  unsigned nb_orientations() const noexcept {
+    return data.size() > 1 ? (unsigned)data.size()
+                           : nb_of_possible_orientations(symmetry);
+  }
 
-    switch (symmetry) {
-    case Symmetry::I:
-    case Symmetry::backslash:
-      oriented.push_back(data.rotated());
-      break;
-    case Symmetry::T:
-    case Symmetry::L:
-      oriented.push_back(data = data.rotated());
-      oriented.push_back(data = data.rotated());
-      oriented.push_back(data = data.rotated());
-      break;
-    case Symmetry::P:
-      oriented.push_back(data = data.rotated());
-      oriented.push_back(data = data.rotated());
-      oriented.push_back(data = data.rotated());
-      oriented.push_back(data = data.rotated().reflected());
-      oriented.push_back(data = data.rotated());
-      oriented.push_back(data = data.rotated());
-      oriented.push_back(data = data.rotated());
-      break;
-    default:
-      break;
+  /**
+   * 方向orientation的图像在(y, x)的像素。没有单独图像的方向不保存旋转的副本，
+   * 而是把坐标变换回基础图像：先逆时针旋转orientation % 4次，方向4到7再左右翻转
+   */
+  const T &get(unsigned orientation, unsigned y, unsigned x) const noexcept {
+    if (data.size() > 1) {
+      return data[orientation].get(y, x);
     }
-
-    return oriented;
+    const unsigned last = data[0].width - 1;
+    for (unsigned r = 0; r < orientation % 4; r++) {
+      unsigned x2 = last - y;
+      y = x;
+      x = x2;
+    }
+    if (orientation >= 4) {
+      x = last - x;
+    }
+    return data[0].get(y, x);
   }
 
   /**
@@ -151,13 +148,22 @@ template <typename T> struct Tile {
    * 创建瓷砖
    */
   Tile(Array2D<T> data, Symmetry symmetry, double weight) noexcept
-      : data(generate_oriented(data, symmetry)), symmetry(symmetry),
-        weight(weight) {}
+      : data{data}, symmetry(symmetry), weight(weight) {}
 };
 
+/**
+ * 编译后的瓷砖模型，不可修改，可被任意多个TilingWFC共享
+ */
+template <typename T> struct TilingModel {
+  std::vector<Tile<T>> tiles;
+  std::vector<std::pair<unsigned, unsigned>> id_to_oriented_tile;
+  std::vector<std::vector<unsigned>> oriented_tile_ids;
+  std::shared_ptr<const CompiledModel> compiled;
+};
 
 struct TilingWFCOptions {
   bool periodic_output;
+  Heuristic heuristic = Heuristic::entropy; // 选择下一个观察的cell的方法
 };
 
 /**
@@ -166,15 +172,9 @@ struct TilingWFCOptions {
 template <typename T> class TilingWFC {
 private:
   /**
-   * 存储瓷砖
+   * 共享的瓷砖模型
    */
-  std::vector<Tile<T>> tiles;
-
-  std::vector<std::pair<unsigned, unsigned>> id_to_oriented_tile;
-
-  std::vector<std::vector<unsigned>> oriented_tile_ids;
-
-
+  std::shared_ptr<const TilingModel<T>> model;
 
   TilingWFCOptions options;
 
@@ -195,7 +195,7 @@ private:
     unsigned id = 0;
     for (unsigned i = 0; i < tiles.size(); i++) {
       oriented_tile_ids.push_back({});
-      for (unsigned j = 0; j < tiles[i].data.size(); j++) {
+      for (unsigned j = 0; j < tiles[i].nb_orientations(); j++) {
         id_to_oriented_tile.push_back({i, j});
         oriented_tile_ids[i].push_back(id);
         id++;
@@ -211,9 +211,9 @@ private:
   static std::vector<std::array<std::vector<unsigned>, 4>> generate_propagator(
       const std::vector<std::tuple<unsigned, unsigned, unsigned, unsigned>>
           &neighbors,
-      std::vector<Tile<T>> tiles,
-      std::vector<std::pair<unsigned, unsigned>> id_to_oriented_tile,
-      std::vector<std::vector<unsigned>> oriented_tile_ids) {
+      const std::vector<Tile<T>> &tiles,
+      const std::vector<std::pair<unsigned, unsigned>> &id_to_oriented_tile,
+      const std::vector<std::vector<unsigned>> &oriented_tile_ids) {
     size_t nb_oriented_tiles = id_to_oriented_tile.size();
     std::vector<std::array<std::vector<bool>, 4>> dense_propagator(
         nb_oriented_tiles, {std::vector<bool>(nb_oriented_tiles, false),
@@ -277,8 +277,8 @@ private:
   get_tiles_weights(const std::vector<Tile<T>> &tiles) {
     std::vector<double> frequencies;
     for (size_t i = 0; i < tiles.size(); ++i) {
-      for (size_t j = 0; j < tiles[i].data.size(); ++j) {
-        frequencies.push_back(tiles[i].weight / tiles[i].data.size());
+      for (size_t j = 0; j < tiles[i].nb_orientations(); ++j) {
+        frequencies.push_back(tiles[i].weight / tiles[i].nb_orientations());
       }
     }
     return frequencies;
@@ -288,6 +288,18 @@ private:
    * 转换数据
    */
   Array2D<T> id_to_tiling(Array2D<unsigned> ids) {
+    return to_tiling(*model, ids);
+  }
+
+public:
+  /**
+   * 将瓷砖模型的形状id网格（例如assemble_chunks的结果）转换为图像
+   */
+  static Array2D<T> to_tiling(const TilingModel<T> &model,
+                              const Array2D<unsigned> &ids) {
+    const std::vector<Tile<T>> &tiles = model.tiles;
+    const std::vector<std::pair<unsigned, unsigned>> &id_to_oriented_tile =
+        model.id_to_oriented_tile;
     unsigned size = tiles[0].data[0].height;
     Array2D<T> tiling(size * ids.height, size * ids.width);
     for (unsigned i = 0; i < ids.height; i++) {
@@ -297,7 +309,7 @@ private:
         for (unsigned y = 0; y < size; y++) {
           for (unsigned x = 0; x < size; x++) {
             tiling.get(i * size + y, j * size + x) =
-                tiles[oriented_tile.first].data[oriented_tile.second].get(y, x);
+                tiles[oriented_tile.first].get(oriented_tile.second, y, x);
           }
         }
       }
@@ -305,7 +317,52 @@ private:
     return tiling;
   }
 
-public:
+  /**
+   * 编译瓷砖模型，结果可被多个TilingWFC共享
+   */
+  static std::shared_ptr<const TilingModel<T>>
+  compile(const std::vector<Tile<T>> &tiles,
+          const std::vector<std::tuple<unsigned, unsigned, unsigned, unsigned>>
+              &neighbors) {
+    auto model = std::make_shared<TilingModel<T>>();
+    model->tiles = tiles;
+    std::tie(model->id_to_oriented_tile, model->oriented_tile_ids) =
+        generate_oriented_tile_ids(tiles);
+    model->compiled = CompiledModel::compile(
+        get_tiles_weights(tiles),
+        generate_propagator(neighbors, tiles, model->id_to_oriented_tile,
+                            model->oriented_tile_ids));
+    return model;
+  }
+
+  /**
+   * 构造函数，使用共享的瓷砖模型
+   */
+  TilingWFC(std::shared_ptr<const TilingModel<T>> model, const unsigned height,
+            const unsigned width, const TilingWFCOptions &options, int seed)
+      : model(model), options(options),
+        wfc(options.periodic_output, seed, model->compiled, height, width,
+            options.heuristic) {}
+
+  /**
+   * 构造函数，从缓存的初始约束快照开始
+   */
+  TilingWFC(std::shared_ptr<const TilingModel<T>> model, const unsigned height,
+            const unsigned width, const TilingWFCOptions &options, int seed,
+            WFCSnapshotCache &cache,
+            const ConstraintLayer *constraints = nullptr)
+      : model(model), options(options),
+        wfc(*cache.get(
+                {model->compiled, height, width, options.periodic_output,
+                 options.heuristic, "",
+                 constraints ? constraints->key() : ConstraintKey()},
+                [&](WFC &solver) {
+                  if (constraints) {
+                    solver.add_constraints(*constraints);
+                  }
+                }),
+            seed) {}
+
   /**
    * 构造函数
    */
@@ -315,14 +372,39 @@ public:
           &neighbors,
       const unsigned height, const unsigned width,
       const TilingWFCOptions &options, int seed)
-      : tiles(tiles),
-        id_to_oriented_tile(generate_oriented_tile_ids(tiles).first),
-        oriented_tile_ids(generate_oriented_tile_ids(tiles).second),
-        options(options),
-        wfc(options.periodic_output, seed, get_tiles_weights(tiles),
-            generate_propagator(neighbors, tiles, id_to_oriented_tile,
-                                oriented_tile_ids),
-            height, width) {}
+      : TilingWFC(compile(tiles, neighbors), height, width, options, seed) {}
+
+  /**
+   * 由瓷砖id网格生成约束层，负数表示不约束，否则只允许该瓷砖的所有方向
+   */
+  ConstraintLayer constraints_from_tiles(const Array2D<int> &tile_ids) const
+      noexcept {
+    ConstraintLayer layer(tile_ids.height, tile_ids.width,
+                          model->id_to_oriented_tile.size());
+    for (unsigned i = 0; i < tile_ids.height; i++) {
+      for (unsigned j = 0; j < tile_ids.width; j++) {
+        if (tile_ids.get(i, j) >= 0) {
+          layer.allow_only(i, j, model->oriented_tile_ids[tile_ids.get(i, j)]);
+        }
+      }
+    }
+    return layer;
+  }
+
+  /**
+   * 批量应用约束层，返回第一个矛盾的cell
+   */
+  std::optional<Contradiction>
+  add_constraints(const ConstraintLayer &constraints) noexcept {
+    return wfc.add_constraints(constraints);
+  }
+
+  /**
+   * 返回失败运行的矛盾（见WFC::get_contradiction）
+   */
+  std::optional<Contradiction> get_contradiction() const noexcept {
+    return wfc.get_contradiction();
+  }
 
   /**
    * 运行算法入口
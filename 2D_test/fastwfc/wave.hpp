@@ -1,13 +1,23 @@
 #ifndef FAST_WFC_WAVE_HPP_
 #define FAST_WFC_WAVE_HPP_
 
+#include "../../common/wfc_engine.hpp"
+#include "compiled_model.hpp"
+#include "counter_rng.hpp"
+#include "hilbert.hpp"
 #include "utils/array2D.hpp"
+#include <algorithm>
 #include <iostream>
 #include <limits>
 #include <math.h>
+#include <memory>
+#include <queue>
 #include <random>
 #include <stdint.h>
 #include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 /**
 * Struct containing the values needed to compute the entropy of all the cells.
@@ -25,6 +35,39 @@ struct EntropyMemoisation {
 	std::vector<double> entropy;       // The entropy of the cell.
 };
 
+/**
+* Return the index of the lowest set bit of x, which must not be 0.
+* xλ1λ
+*/
+inline unsigned count_trailing_zeros(uint64_t x) noexcept {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return index;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+/**
+* The heuristic used to choose the next cell to observe.
+* ѡһ۲cellʽ
+*/
+enum class Heuristic {
+	entropy, // The cell with the lowest entropy (plus a small noise).
+	         // ϢСcell
+	mrv,     // A random cell among the ones with the fewest remaining patterns.
+	         // The entropy isn't memoised in this mode.
+	         // ʣͼٵcellһģʽ²Ϣ
+	scanline, // The first undecided cell in row-major order.
+	          // ˳ĵһδȷcell
+	frontier, // The cell with the lowest entropy among the ones next to a
+	          // decided cell, so that the decided region grows as one piece.
+	          // ȷcellڵcellϢСһ
+	hilbert   // The first undecided cell along a Hilbert curve.
+	          // ϣߵĵһδȷcell
+};
+
 /**
 * Contains the pattern possibilities in every cell.
 * Also contains information about cell entropy.
@@ -34,22 +77,10 @@ struct EntropyMemoisation {
 class Wave {
 private:
 	/**
-	* The patterns frequencies p given to wfc.
-	* ͼp
-	*/
-	const std::vector<double> patterns_frequencies;
-
-	/**
-	* The precomputation of p * log(p).
-	* p*logpֵ
+	* The compiled model shared by every solver (frequencies, p * log(p), ...).
+	* ıģ
 	*/
-	const std::vector<double> plogp_patterns_frequencies;
-
-	/**
-	* The precomputation of min (p * log(p)) / 2.
-	* This is used to define the maximum value of the noise.
-	*/
-	const double half_min_plogp;
+	std::shared_ptr<const CompiledModel> model;
 
 	/**
 	* The memoisation of important values for the computation of entropy.
@@ -63,6 +94,12 @@ private:
 	*/
 	bool is_impossible;
 
+	/**
+	* The first cell where every pattern has been removed, or -1.
+	* һͼƳcellûΪ-1
+	*/
+	int contradiction_index;
+
 	/**
 	* The number of distinct patterns.
 	* ͬ״ͼ
@@ -70,34 +107,210 @@ private:
 	const unsigned nb_patterns;
 
 	/**
-	* The actual wave. data.get(index, pattern) is equal to 0 if the pattern can
-	* be placed in the cell index.
+	* The number of 64 bits words used to store the patterns of one cell: the
+	* fixed width of the bound of the model (see pattern_bound_words).
+	* ÿcellʹõ64λֵģ͵ͼ޾
+	*/
+	const unsigned nb_words;
+
+	/**
+	* The actual wave, stored as one bitset per cell. The bit pattern % 64 of
+	* data[index * nb_words + pattern / 64] is set if the pattern can be placed
+	* in the cell index.
+	* ÿcellͼλϴ洢
+	*/
+	std::vector<uint64_t> data;
+
+	/**
+	* The heuristic used by select_cell.
+	* ѡcellʽ
+	*/
+	const Heuristic heuristic;
+
+	/**
+	* Bucket queue used by the mrv heuristic: buckets[n] contains the cells
+	* with n remaining patterns (n >= 2), and bucket_position[index] the
+	* position of cell index in its bucket. Every bucket lower than min_bucket
+	* is empty.
+	* mrvʹõͰУbuckets[n]ʣnͼcell
+	*/
+	std::vector<std::vector<unsigned>> buckets;
+	std::vector<unsigned> bucket_position;
+	unsigned min_bucket;
+
+	/**
+	* Used by the scanline and hilbert heuristics: the cells are observed in
+	* the order given by order (row-major if null), and every cell before
+	* position cursor is decided.
+	* scanlinehilbertʹãorder˳۲cellcursor֮ǰcellȷ
+	*/
+	std::shared_ptr<const std::vector<unsigned>> order;
+	unsigned cursor = 0;
+
+	/**
+	* Used by the frontier heuristic: a min-heap of (entropy, cell) for the
+	* undecided cells next to a decided cell. An entry is pushed every time
+	* the entropy of such a cell changes, the outdated ones are skipped when
+	* they reach the top.
+	* frontierʹãȷcellڵδȷcellСѣʱڶѶʱ
 	*/
-	Array2D<uint8_t> data;
+	std::priority_queue<std::pair<double, unsigned>,
+		std::vector<std::pair<double, unsigned>>,
+		std::greater<std::pair<double, unsigned>>> frontier;
+	std::vector<uint8_t> in_frontier;
+
+	/**
+	* Return true if the entropy needs to be memoised for the heuristic.
+	* ʽҪϢʱtrue
+	*/
+	bool memoise_entropy() const noexcept {
+		return heuristic == Heuristic::entropy || heuristic == Heuristic::frontier;
+	}
 
 	/**
-	* Return distribution * log(distribution).
-	* p*logp
+	* Add the cell index to the frontier, or update its entropy in it.
+	* cellfrontierϢ
 	*/
-	static std::vector<double>
-		get_plogp(const std::vector<double> &distribution) noexcept {
-		std::vector<double> plogp;
-		for (unsigned i = 0; i < distribution.size(); i++) {
-			plogp.push_back(distribution[i] * log(distribution[i]));
+	void push_frontier(unsigned index) noexcept {
+		if (memoisation.nb_patterns[index] >= 2) {
+			in_frontier[index] = true;
+			frontier.push({ memoisation.entropy[index], index });
 		}
-		return plogp;
 	}
 
 	/**
-	* Return min(v) / 2.
-	* Сֵ / 2
+	* Add the undecided neighbors of the decided cell index to the frontier.
+	* ȷcellδȷھӼfrontier
 	*/
-	static double get_half_min(const std::vector<double> &v) noexcept {
-		double half_min = std::numeric_limits<double>::infinity();
-		for (unsigned i = 0; i < v.size(); i++) {
-			half_min = std::min(half_min, v[i] / 2.0);
+	void expand_frontier(unsigned index) noexcept {
+		unsigned i = index / width;
+		unsigned j = index % width;
+		if (i > 0) {
+			push_frontier(index - width);
+		}
+		if (i + 1 < height) {
+			push_frontier(index + width);
+		}
+		if (j > 0) {
+			push_frontier(index - 1);
+		}
+		if (j + 1 < width) {
+			push_frontier(index + 1);
 		}
-		return half_min;
+	}
+
+	/**
+	* Set the number of patterns of cell index, moving it to its new bucket.
+	* cellͼƶµͰ
+	*/
+	void update_nb_patterns(unsigned index, unsigned nb) noexcept {
+		if (heuristic == Heuristic::mrv) {
+			unsigned old_nb = memoisation.nb_patterns[index];
+			if (old_nb >= 2) {
+				std::vector<unsigned> &bucket = buckets[old_nb];
+				unsigned last = bucket.back();
+				bucket[bucket_position[index]] = last;
+				bucket_position[last] = bucket_position[index];
+				bucket.pop_back();
+			}
+			if (nb >= 2) {
+				bucket_position[index] = buckets[nb].size();
+				buckets[nb].push_back(index);
+				min_bucket = std::min(min_bucket, nb);
+			}
+		}
+		memoisation.nb_patterns[index] = nb;
+		if (heuristic == Heuristic::frontier) {
+			if (nb == 1) {
+				expand_frontier(index);
+			}
+			else if (in_frontier[index]) {
+				push_frontier(index);
+			}
+		}
+		// If there is no patterns possible in the cell, then there is a
+		// contradiction.
+		if (nb == 0) {
+			set_impossible(index);
+		}
+	}
+
+	/**
+	* Mark the wave as impossible, remembering the first cell in contradiction.
+	* waveìܣ¼һìܵcell
+	*/
+	void set_impossible(unsigned index) noexcept {
+		if (!is_impossible) {
+			contradiction_index = index;
+		}
+		is_impossible = true;
+	}
+
+	/**
+	* Return the index in data of the word holding pattern in cell index.
+	* Words is the number of words of a cell if it is known at compile time,
+	* 0 otherwise.
+	* cellͼڵdataе
+	*/
+	template <unsigned Words>
+	unsigned word_index(unsigned index, unsigned pattern) const noexcept {
+		return Words == 1 ? index : index * (Words != 0 ? Words : nb_words) + pattern / 64;
+	}
+
+	/**
+	* Update the memoisation of cell index after pattern was removed from it.
+	* ͼcellƳصļ¼
+	*/
+	void forget(unsigned index, unsigned pattern) noexcept {
+		memoisation.sum[index] -= model->patterns_frequencies[pattern];
+		if (memoise_entropy()) {
+			memoisation.plogp_sum[index] -= model->plogp_patterns_frequencies[pattern];
+			memoisation.log_sum[index] = log(memoisation.sum[index]);
+			memoisation.entropy[index] =
+				memoisation.log_sum[index] -
+				memoisation.plogp_sum[index] / memoisation.sum[index];
+		}
+		update_nb_patterns(index, memoisation.nb_patterns[index] - 1);
+	}
+
+	/**
+	* for_each_pattern with Words words per cell (see word_index).
+	*/
+	template <unsigned Words, typename F>
+	void visit_patterns(unsigned index, F &f) const {
+		const unsigned words = Words != 0 ? Words : nb_words;
+		const uint64_t *cell = &data[index * words];
+		for (unsigned w = 0; w < words; w++) {
+			uint64_t word = cell[w];
+			while (word) {
+				f(w * 64 + count_trailing_zeros(word));
+				word &= word - 1;
+			}
+		}
+	}
+
+	/**
+	* choose_pattern with Words words per cell (see word_index).
+	*/
+	template <unsigned Words>
+	unsigned choose_in(unsigned index, double random_value) const noexcept {
+		const unsigned words = Words != 0 ? Words : nb_words;
+		const uint64_t *cell = &data[index * words];
+		// Because of rounding errors, random_value may never reach 0. In that
+		// case the last possible pattern is chosen.
+		unsigned chosen_value = nb_patterns - 1;
+		for (unsigned w = 0; w < words; w++) {
+			uint64_t word = cell[w];
+			while (word) {
+				chosen_value = w * 64 + count_trailing_zeros(word);
+				word &= word - 1;
+				random_value -= model->patterns_frequencies[chosen_value];
+				if (random_value <= 0) {
+					return chosen_value;
+				}
+			}
+		}
+		return chosen_value;
 	}
 
 public:
@@ -114,31 +327,44 @@ public:
 	* ʼwaveÿcell
 	*/
 	Wave(unsigned height, unsigned width,
-		const std::vector<double> &patterns_frequencies) noexcept
-		: patterns_frequencies(patterns_frequencies),
-		plogp_patterns_frequencies(get_plogp(patterns_frequencies)),
-		half_min_plogp(get_half_min(plogp_patterns_frequencies)),
-		is_impossible(false), nb_patterns(patterns_frequencies.size()),
-		data(width * height, nb_patterns, 1), width(width), height(height),
+		std::shared_ptr<const CompiledModel> model,
+		Heuristic heuristic = Heuristic::entropy) noexcept
+		: model(model), is_impossible(false), contradiction_index(-1),
+		nb_patterns(model->nb_patterns),
+		nb_words(pattern_bound_words(nb_patterns)), data(width * height * nb_words, 0),
+		heuristic(heuristic), min_bucket(nb_patterns + 1),
+		width(width), height(height),
 		size(height * width) {
 		// Initialize the memoisation of entropy.
-		double base_entropy = 0;
-		double base_s = 0;
-		double half_min_plogp = std::numeric_limits<double>::infinity();
-		for (unsigned i = 0; i < nb_patterns; i++) {
-			half_min_plogp =
-				std::min(half_min_plogp, plogp_patterns_frequencies[i] / 2.0);
-			base_entropy += plogp_patterns_frequencies[i];
-			base_s += patterns_frequencies[i];
-		}
-		double log_base_s = log(base_s);
-		double entropy_base = log_base_s - base_entropy / base_s;
-		memoisation.plogp_sum = std::vector<double>(width * height, base_entropy);
-		memoisation.sum = std::vector<double>(width * height, base_s);
-		memoisation.log_sum = std::vector<double>(width * height, log_base_s);
+		memoisation.plogp_sum = std::vector<double>(width * height, model->base_plogp_sum);
+		memoisation.sum = std::vector<double>(width * height, model->base_sum);
+		memoisation.log_sum = std::vector<double>(width * height, model->base_log_sum);
 		memoisation.nb_patterns =
 			std::vector<unsigned>(width * height, nb_patterns);
-		memoisation.entropy = std::vector<double>(width * height, entropy_base);
+		memoisation.entropy = std::vector<double>(width * height, model->base_entropy);
+		for (unsigned index = 0; index < size; index++) {
+			for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+				data[index * nb_words + pattern / 64] |= (uint64_t)1 << (pattern % 64);
+			}
+		}
+		if (heuristic == Heuristic::mrv) {
+			buckets.resize(nb_patterns + 1);
+			bucket_position.resize(size);
+			if (nb_patterns >= 2) {
+				for (unsigned index = 0; index < size; index++) {
+					bucket_position[index] = index;
+					buckets[nb_patterns].push_back(index);
+				}
+				min_bucket = nb_patterns;
+			}
+		}
+		if (heuristic == Heuristic::hilbert) {
+			order = std::make_shared<const std::vector<unsigned>>(
+				hilbert_order(height, width));
+		}
+		if (heuristic == Heuristic::frontier) {
+			in_frontier.resize(size, false);
+		}
 	}
 
 	/**
@@ -146,7 +372,40 @@ public:
 	* trueͼܷcell
 	*/
 	bool get(unsigned index, unsigned pattern) const noexcept {
-		return data.get(index, pattern);
+		return (data[index * nb_words + pattern / 64] >> (pattern % 64)) & 1;
+	}
+
+	/**
+	* Call f(pattern) for every pattern that can be placed in cell index, in
+	* increasing order. Only the non empty words of the bitset are visited.
+	* f can remove patterns from the cell.
+	* ˳cellпܵͼֻʷǿյ
+	*/
+	template <typename F> void for_each_pattern(unsigned index, F f) const {
+		with_pattern_bound(nb_patterns, [&](auto bound) {
+			visit_patterns<decltype(bound)::nb_words>(index, f);
+		});
+	}
+
+	/**
+	* Return the sum of the frequencies of the patterns still possible in cell
+	* index (memoised).
+	* cellԿܵͼƵ֮
+	*/
+	double get_sum(unsigned index) const noexcept {
+		return memoisation.sum[index];
+	}
+
+	/**
+	* Choose a pattern of cell index according to the pattern distribution.
+	* random_value should be uniform in [0, get_sum(index)]. Only the patterns
+	* still possible are visited.
+	* ݷֲѡcellеһͼֻԿܵͼ
+	*/
+	unsigned choose_pattern(unsigned index, double random_value) const noexcept {
+		return with_pattern_bound(nb_patterns, [&](auto bound) {
+			return choose_in<decltype(bound)::nb_words>(index, random_value);
+		});
 	}
 
 	/**
@@ -162,25 +421,80 @@ public:
 	* ͼcellеֵ
 	*/
 	void set(unsigned index, unsigned pattern, bool value) noexcept {
-		bool old_value = data.get(index, pattern);
+		bool old_value = get(index, pattern);
 		// If the value isn't changed, nothing needs to be done.
 		if (old_value == value) {
 			return;
 		}
 		// Otherwise, the memoisation should be updated.
-		data.get(index, pattern) = value;
-		memoisation.plogp_sum[index] -= plogp_patterns_frequencies[pattern];
-		memoisation.sum[index] -= patterns_frequencies[pattern];
-		memoisation.log_sum[index] = log(memoisation.sum[index]);
-		memoisation.nb_patterns[index]--;
-		memoisation.entropy[index] =
-			memoisation.log_sum[index] -
-			memoisation.plogp_sum[index] / memoisation.sum[index];
-		// If there is no patterns possible in the cell, then there is a
-		// contradiction.
-		if (memoisation.nb_patterns[index] == 0) {
-			is_impossible = true;
+		if (value) {
+			data[index * nb_words + pattern / 64] |= (uint64_t)1 << (pattern % 64);
 		}
+		else {
+			data[index * nb_words + pattern / 64] &= ~((uint64_t)1 << (pattern % 64));
+		}
+		forget(index, pattern);
+	}
+
+	/**
+	* Remove pattern from cell index, like set(index, pattern, false), with
+	* Words words per cell if it is known at compile time (0 otherwise). Used
+	* by the propagation kernels compiled for the bound of the model.
+	* ƳcellеͼWordsΪʱ֪ÿcellδ֪Ϊ0
+	*/
+	template <unsigned Words> void remove(unsigned index, unsigned pattern) noexcept {
+		uint64_t &word = data[word_index<Words>(index, pattern)];
+		const uint64_t mask = (uint64_t)1 << (pattern % 64);
+		if (!(word & mask)) {
+			return;
+		}
+		word &= ~mask;
+		forget(index, pattern);
+	}
+
+	/**
+	* Remove every pattern not allowed in cell index, and update the
+	* memoisation only once.
+	* Ƴcellвͼֻһ
+	*/
+	void restrict(unsigned index, const uint8_t *allowed) noexcept {
+		unsigned removed = 0;
+		for_each_pattern(index, [&](unsigned k) {
+			if (!allowed[k]) {
+				data[index * nb_words + k / 64] &= ~((uint64_t)1 << (k % 64));
+				memoisation.sum[index] -= model->patterns_frequencies[k];
+				if (memoise_entropy()) {
+					memoisation.plogp_sum[index] -= model->plogp_patterns_frequencies[k];
+				}
+				removed++;
+			}
+		});
+		if (removed == 0) {
+			return;
+		}
+		if (memoise_entropy()) {
+			memoisation.log_sum[index] = log(memoisation.sum[index]);
+			memoisation.entropy[index] =
+				memoisation.log_sum[index] -
+				memoisation.plogp_sum[index] / memoisation.sum[index];
+		}
+		update_nb_patterns(index, memoisation.nb_patterns[index] - removed);
+	}
+
+	/**
+	* Return the first cell where a contradiction was found, or -1.
+	* صһìܵcellû򷵻-1
+	*/
+	int get_contradiction_index() const noexcept {
+		return contradiction_index;
+	}
+
+	/**
+	* Return true if a cell has no possible pattern left.
+	* truecellûпܵͼ
+	*/
+	bool impossible() const noexcept {
+		return is_impossible;
 	}
 
 	/**
@@ -198,13 +512,16 @@ public:
 	* زΪ0Сص
 	* мcontradictionwaveУ򷵻-2
 	* cell壬-1
+	* The noise of a cell only depends on (seed, cell, step), so the chosen cell
+	* doesn't depend on the order in which the cells are visited.
+	* ÿcellֻȡ(seed, cell, step)˳޹
 	*/
-	int get_min_entropy(std::minstd_rand &gen) const noexcept {
+	int get_min_entropy(uint64_t seed, unsigned step) const noexcept {
 		if (is_impossible) {
 			return -2;
 		}
 
-		std::uniform_real_distribution<> dis(0, abs(half_min_plogp));
+		const double max_noise = abs(model->half_min_plogp);
 
 		// The minimum entropy (plus a small noise)
 		double min = std::numeric_limits<double>::infinity();
@@ -230,7 +547,8 @@ public:
 				// Then, we add noise to decide randomly which will be chosen.
 				// noise is smaller than the smallest p * log(p), so the minimum entropy
 				// will always be chosen.
-				double noise = dis(gen);
+				double noise =
+					counter_uniform(seed, i, step, RandomStream::noise, max_noise);
 				if (entropy + noise < min) {
 					min = entropy + noise;
 					argmin = i;
@@ -240,6 +558,88 @@ public:
 
 		return argmin;
 	}
+
+	/**
+	* Return a random cell among the undecided cells with the fewest remaining
+	* patterns, using the bucket queue. The return values are the same as
+	* get_min_entropy.
+	* ʣͼٵδȷcellеһ
+	*/
+	int get_min_remaining(uint64_t seed, unsigned step) noexcept {
+		if (is_impossible) {
+			return -2;
+		}
+		while (min_bucket <= nb_patterns && buckets[min_bucket].empty()) {
+			min_bucket++;
+		}
+		if (min_bucket > nb_patterns) {
+			return -1;
+		}
+		const std::vector<unsigned> &bucket = buckets[min_bucket];
+		return bucket[counter_random(seed, 0, step, RandomStream::select) %
+			bucket.size()];
+	}
+
+	/**
+	* Return the first undecided cell in the order of the wave, advancing the
+	* cursor over the decided ones. The return values are the same as
+	* get_min_entropy.
+	* ˳еһδȷcell
+	*/
+	int get_next_in_order() noexcept {
+		if (is_impossible) {
+			return -2;
+		}
+		while (cursor < size) {
+			unsigned index = order ? (*order)[cursor] : cursor;
+			if (memoisation.nb_patterns[index] != 1) {
+				return index;
+			}
+			cursor++;
+		}
+		return -1;
+	}
+
+	/**
+	* Return the cell with the lowest entropy in the frontier. If the frontier
+	* is empty (first observation, or every cell next to the decided region is
+	* decided), fall back to get_min_entropy to start a new region.
+	* frontierϢСcellfrontierΪʱʹget_min_entropy
+	*/
+	int get_min_frontier(uint64_t seed, unsigned step) noexcept {
+		if (is_impossible) {
+			return -2;
+		}
+		while (!frontier.empty()) {
+			std::pair<double, unsigned> top = frontier.top();
+			if (memoisation.nb_patterns[top.second] >= 2 &&
+				memoisation.entropy[top.second] == top.first) {
+				return top.second;
+			}
+			frontier.pop();
+		}
+		return get_min_entropy(seed, step);
+	}
+
+	/**
+	* Return the next cell to observe according to the heuristic of the wave.
+	* If there is a contradiction in the wave, return -2.
+	* If every cell is decided, return -1.
+	* ʽһ۲cell
+	*/
+	int select_cell(uint64_t seed, unsigned step) noexcept {
+		switch (heuristic) {
+		case Heuristic::mrv:
+			return get_min_remaining(seed, step);
+		case Heuristic::scanline:
+		case Heuristic::hilbert:
+			return get_next_in_order();
+		case Heuristic::frontier:
+			return get_min_frontier(seed, step);
+		default:
+			return get_min_entropy(seed, step);
+		}
+	}
 };
 
 #endif // FAST_WFC_WAVE_HPP_
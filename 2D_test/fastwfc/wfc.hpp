@@ -3,9 +3,12 @@
 
 #include <cmath>
 #include <limits>
+#include <memory>
 #include <random>
 #include <unordered_map>
 
+#include "constraint_layer.hpp"
+#include "direction.hpp"
 #include "utils/array2D.hpp"
 #include "propagator.hpp"
 #include "wave.hpp"
@@ -17,10 +20,17 @@
 class WFC {
 private:
   /**
-   * The random number generator.
+   * The seed of the counter-based random numbers (see counter_rng.hpp).
    * 
    */
-  std::minstd_rand gen;
+  uint64_t seed;
+
+  /**
+   * The number of observations done, used as the counter of the random
+   * numbers so that a run only depends on the seed.
+   * ѽеĹ۲
+   */
+  unsigned step = 0;
 
   /**
    * The wave, indicating which patterns can be put in which cell.
@@ -29,10 +39,10 @@ private:
   Wave wave;
 
   /**
-   * The distribution of the patterns as given in input.
-   * иķֲģʽ
+   * The compiled model (distribution of the patterns and propagator).
+   * ıģͣиķֲģʽʹݹ
    */
-  const std::vector<double> patterns_frequencies;
+  std::shared_ptr<const CompiledModel> model;
 
   /**
    * The number of distinct patterns.
@@ -40,12 +50,24 @@ private:
    */
   const unsigned nb_patterns;
 
+  /**
+   * True if the output is toric.
+   * Ƿƽ
+   */
+  bool periodic_output;
+
   /**
    * The propagator, used to propagate the information in the wave.
    * ڴwaveеϢ
    */
   Propagator propagator;
 
+  /**
+   * True once the initial constraints have been applied and propagated.
+   * ʼԼѾӦòʱΪtrue
+   */
+  bool prepared = false;
+
   /**
    * Transform the wave to a valid output (a 2d array of patterns that aren't in contradiction). 
    * This function should be used only when all cell of the wave are defined.
@@ -55,11 +77,7 @@ private:
   Array2D<unsigned> wave_to_output() const noexcept {
     Array2D<unsigned> output_patterns(wave.height, wave.width);
     for (unsigned i = 0; i < wave.size; i++) {
-      for (unsigned k = 0; k < nb_patterns; k++) {
-        if (wave.get(i, k)) {
-          output_patterns.data[i] = k;
-        }
-      }
+      wave.for_each_pattern(i, [&](unsigned k) { output_patterns.data[i] = k; });
     }
     return output_patterns;
   }
@@ -73,14 +91,36 @@ public:
       Propagator::PropagatorState propagator, unsigned wave_height,
       unsigned wave_width)
   noexcept
-    : gen(seed), wave(wave_height, wave_width, patterns_frequencies),
-        patterns_frequencies(patterns_frequencies),
-        nb_patterns(propagator.size()),
-        propagator(wave.height, wave.width, periodic_output, propagator) {}
+    : WFC(periodic_output, seed,
+          CompiledModel::compile(patterns_frequencies, propagator),
+          wave_height, wave_width) {}
+
+  /**
+   * Constructor sharing an already compiled model with other solvers.
+   * 캯ѱģ
+   */
+  WFC(bool periodic_output, int seed,
+      std::shared_ptr<const CompiledModel> model, unsigned wave_height,
+      unsigned wave_width, Heuristic heuristic = Heuristic::entropy)
+  noexcept
+    : seed(seed), wave(wave_height, wave_width, model, heuristic), model(model),
+        nb_patterns(model->nb_patterns), periodic_output(periodic_output),
+        propagator(wave.height, wave.width, periodic_output, model) {}
+
+  /**
+   * Start a new run from a snapshot (see prepare), with another seed.
+   * ӿտʼµУʹµ
+   */
+  WFC(const WFC &snapshot, int seed) noexcept : WFC(snapshot) {
+    this->seed = seed;
+  }
 
   /**
    * add Constrained synthesis
    * by xgy 2018.7.23
+   * Only allow pattern in cell index. The information is propagated by the
+   * next propagation.
+   * cellԼԼʹadd_constraints
    */
   void constrainedSynthesis(unsigned index, unsigned pattern, bool value) {
 	  for (unsigned k = 0; k < nb_patterns; k++) {
@@ -91,16 +131,110 @@ public:
 		  }
 	  }
   }
-  
+
+  /**
+   * Apply a whole layer of constraints: every banned pattern is removed from
+   * the wave in one sweep, then the information is propagated once.
+   * Return the first cell in contradiction if the constraints can't be
+   * satisfied, or a layer_mismatch contradiction without changing the wave if
+   * the layer wasn't built for this wave and model.
+   * ӦԼ㣺һƳбֹͼȻֻһ
+   * Լ޷㣬صһìܵcellԼĳߴ粻ʱ޸wave
+   */
+  std::optional<Contradiction>
+  add_constraints(const ConstraintLayer &layer) noexcept {
+    if (!layer.matches(wave.height, wave.width, nb_patterns)) {
+      Contradiction mismatch{0, 0};
+      mismatch.layer_mismatch = true;
+      return mismatch;
+    }
+    for (unsigned index = 0; index < wave.size; index++) {
+      const uint8_t *allowed = layer.get(index);
+      wave.for_each_pattern(index, [&](unsigned k) {
+        if (!allowed[k]) {
+          propagator.add_to_propagator(index / wave.width, index % wave.width,
+                                       k);
+        }
+      });
+      wave.restrict(index, allowed);
+    }
+    propagator.propagate(wave);
+    return get_contradiction();
+  }
+
+  /**
+   * Return the first cell in contradiction, if any. When the contradiction
+   * was found by the propagation, it also gives the pattern and the direction
+   * that caused it.
+   * صһìܵcellɴݷʱìܵͼκͷ
+   */
+  std::optional<Contradiction> get_contradiction() const noexcept {
+    if (propagator.get_contradiction()) {
+      return propagator.get_contradiction();
+    }
+    int index = wave.get_contradiction_index();
+    if (index < 0) {
+      return std::nullopt;
+    }
+    return Contradiction{(unsigned)index / wave.width,
+                         (unsigned)index % wave.width};
+  }
+
+  /**
+   * Ban every pattern from the cells having a neighbor in a direction where
+   * the pattern has no compatible neighbor. The propagation only removes a
+   * pattern when one of its counters drops to 0, so a counter starting at 0
+   * never removes it. A model without such patterns touches no cell.
+   * ֹͼûκμھӵķھӵcell
+   */
+  void ban_unsupported() noexcept {
+    for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+      for (unsigned direction = 0; direction < 4; direction++) {
+        if (model->initial_compatible[pattern][direction] != 0) {
+          continue;
+        }
+        // compatible[direction] counts the neighbor in the opposite
+        // direction: only the cells without it keep the pattern, and a toric
+        // output has none.
+        const int di = directions_y[direction];
+        const int dj = directions_x[direction];
+        const unsigned i_min = (di > 0 && !periodic_output) ? 1 : 0;
+        const unsigned i_max =
+            (di < 0 && !periodic_output) ? wave.height - 1 : wave.height;
+        const unsigned j_min = (dj > 0 && !periodic_output) ? 1 : 0;
+        const unsigned j_max =
+            (dj < 0 && !periodic_output) ? wave.width - 1 : wave.width;
+        for (unsigned i = i_min; i < i_max; i++) {
+          for (unsigned j = j_min; j < j_max; j++) {
+            remove_wave_pattern(i, j, pattern);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Apply the initial constraints and propagate them.
+   * The state after this call only depends on the model, the size of the
+   * wave and the constraints, so it can be snapshotted and reused by runs
+   * with other seeds.
+   * ӦóʼԼݣ֮״̬޹أΪո
+   */
+  void prepare() noexcept {
+    if (prepared) {
+      return;
+    }
+    ban_unsupported();
+    propagator.propagate(wave);
+    prepared = true;
+  }
 
   /**
    * Run the algorithm, and return a result if it succeeded.
    * 㷨ɹĻһ
    */
   std::optional<Array2D<unsigned>> run() noexcept {
-
-	 // ָʼͼƬλ
-	constrainedSynthesis(5, 5, false);
+    prepare();
     while (true) {
       // Define the value of an undefined cell.
 	  // δֵ
@@ -114,9 +248,12 @@ public:
         return wave_to_output();
       }
 
-      // Propagate the information.
-	  // Ϣ
-      propagator.propagate(wave);
+      // Propagate the information, the run fails as soon as a cell is
+      // emptied.
+	  // Ϣһcellվʧ
+      if (!propagator.propagate(wave)) {
+        return std::nullopt;
+      }
     }
   }
 
@@ -138,9 +275,10 @@ public:
    * صֵ
    */
   ObserveStatus observe() noexcept {
-    // Get the cell with lowest entropy.
-	// õص
-    int argmin = wave.get_min_entropy(gen);
+    // Get the cell with lowest entropy (or the next cell given by the
+    // heuristic of the wave).
+	// õص񣨻ʽһ
+    int argmin = wave.select_cell(seed, step);
 
     // If there is a contradiction, the algorithm has failed.
 	// ͻfailure
@@ -155,43 +293,33 @@ public:
       return success;
     }
 
-    // Choose an element according to the pattern distribution
-	// ݷֲṹѡһԪ
-    double s = 0;
-    for (unsigned k = 0; k < nb_patterns; k++) {
-      s += wave.get(argmin, k) ? patterns_frequencies[k] : 0;
-    }
-
-    std::uniform_real_distribution<> dis(0, s);
-    double random_value = dis(gen);
-    unsigned chosen_value = nb_patterns - 1;
-
-    for (unsigned k = 0; k < nb_patterns; k++) {
-      random_value -= wave.get(argmin, k) ? patterns_frequencies[k] : 0;
-      if (random_value <= 0) {
-        chosen_value = k;
-        break;
-      }
-    }
+    // Choose an element according to the pattern distribution.
+    // The sum of the frequencies is memoised in the wave, and only the
+    // patterns still possible are visited.
+	// ݷֲṹѡһԪأƵ֮waveд洢ֻԿܵͼ
+    unsigned chosen_value = wave.choose_pattern(
+        argmin, counter_uniform(seed, argmin, step, RandomStream::observe,
+                                wave.get_sum(argmin)));
+    step++;
 
     // And define the cell with the pattern.
 	// ͼ
-    for (unsigned k = 0; k < nb_patterns; k++) {
-      if (wave.get(argmin, k) != (k == chosen_value)) {
+    wave.for_each_pattern(argmin, [&](unsigned k) {
+      if (k != chosen_value) {
         propagator.add_to_propagator(argmin / wave.width, argmin % wave.width,
                                      k);
         wave.set(argmin, k, false);
       }
-    }
+    });
 
     return to_continue;
   }
 
   /**
-   * Propagate the information of the wave.
-   * ݲϢ
+   * Propagate the information of the wave, return false on a contradiction.
+   * ݲϢìʱfalse
    */
-  void propagate() noexcept { propagator.propagate(wave); }
+  bool propagate() noexcept { return propagator.propagate(wave); }
 
   /**
    * Remove pattern from cell (i,j).
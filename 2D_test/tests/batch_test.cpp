@@ -0,0 +1,115 @@
+/**
+* Check that run_batched gives, for every seed, the output of a WFC run with
+* the same seed and heuristic, for the heuristics where the lanes make the
+* same choices as WFC (scanline and hilbert), whatever the number of lanes.
+*
+* The models are random. In one of them, some patterns have no compatible
+* neighbor in a direction, so that both solvers have to ban them from the
+* cells having a neighbor in that direction.
+*
+* Build and run from this directory:
+*	g++ -std=c++17 -O2 -I../fastwfc -I.. batch_test.cpp -o batch_test
+*	./batch_test
+* The program returns 0 if every seed gives the same output.
+*/
+#include <stdint.h>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "batch_wfc.hpp"
+#include "wfc.hpp"
+
+namespace {
+
+const unsigned nb_seeds = 100;
+
+struct TestModel {
+	const char *name;
+	std::shared_ptr<const CompiledModel> model;
+	bool periodic_output;
+	unsigned height;
+	unsigned width;
+};
+
+/**
+* Return a model of nb_patterns patterns where two patterns are compatible
+* in a direction with probability 1/2. The first nb_unsupported patterns
+* have no compatible pattern in direction 0.
+*/
+std::shared_ptr<const CompiledModel> random_model(unsigned nb_patterns, uint64_t seed,
+	unsigned nb_unsupported) {
+	CompiledModel::PropagatorState propagator(nb_patterns);
+	for (unsigned direction = 0; direction < 2; direction++) {
+		for (unsigned a = 0; a < nb_patterns; a++) {
+			for (unsigned b = 0; b < nb_patterns; b++) {
+				if (direction == 0 && a < nb_unsupported) {
+					continue;
+				}
+				if (counter_random(seed, a * nb_patterns + b, direction,
+					RandomStream::select) % 2 == 0) {
+					propagator[a][direction].push_back(b);
+					propagator[b][get_opposite_direction(direction)].push_back(a);
+				}
+			}
+		}
+	}
+	std::vector<double> frequencies(nb_patterns);
+	for (unsigned k = 0; k < nb_patterns; k++) {
+		frequencies[k] = 0.5 + k % 5;
+	}
+	return CompiledModel::compile(frequencies, propagator);
+}
+
+}
+
+int main() {
+	const std::vector<TestModel> models = {
+		{ "random", random_model(12, 1, 0), false, 6, 6 },
+		{ "unsupported", random_model(12, 2, 3), false, 6, 6 },
+		{ "periodic", random_model(12, 3, 0), true, 5, 8 },
+	};
+	const Heuristic heuristics[] = { Heuristic::scanline, Heuristic::hilbert };
+	const char *heuristic_names[] = { "scanline", "hilbert" };
+	const unsigned lanes[] = { 1, 7, BatchWFC::max_lanes };
+
+	std::vector<uint64_t> seeds(nb_seeds);
+	for (unsigned i = 0; i < nb_seeds; i++) {
+		seeds[i] = i;
+	}
+
+	unsigned failures = 0;
+	for (const TestModel &test : models) {
+		for (unsigned h = 0; h < 2; h++) {
+			std::vector<std::optional<Array2D<unsigned>>> expected;
+			unsigned successes = 0;
+			for (uint64_t seed : seeds) {
+				WFC wfc(test.periodic_output, (int)seed, test.model, test.height,
+					test.width, heuristics[h]);
+				expected.push_back(wfc.run());
+				successes += expected.back().has_value();
+			}
+			for (unsigned nb_lanes : lanes) {
+				std::vector<std::optional<Array2D<unsigned>>> results = run_batched(
+					test.periodic_output, seeds, test.model, test.height, test.width,
+					heuristics[h], nb_lanes);
+				for (unsigned i = 0; i < nb_seeds; i++) {
+					if (results[i].has_value() != expected[i].has_value() ||
+						(results[i] && results[i]->data != expected[i]->data)) {
+						std::cout << "FAIL " << test.name << " " << heuristic_names[h]
+							<< " seed " << seeds[i] << " lanes " << nb_lanes << "\n";
+						failures++;
+					}
+				}
+			}
+			std::cout << test.name << " " << heuristic_names[h] << ": " << successes
+				<< "/" << nb_seeds << " successes\n";
+		}
+	}
+	if (failures != 0) {
+		std::cout << failures << " outputs were different\n";
+		return 1;
+	}
+	std::cout << "every seed gave the same output\n";
+	return 0;
+}
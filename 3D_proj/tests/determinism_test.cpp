@@ -0,0 +1,151 @@
+/**
+* Check that the outputs of genericWFC only depend on the model, the
+* constraints and the seed: not on the number of propagation threads, nor on
+* the layout of the cells in memory, for every heuristic.
+*
+* The models are random, and a constraint layer bans most of the patterns of
+* every cell, so that the propagation of the constraints goes over the
+* threshold of the parallel propagation. One of the models gives the same
+* frequency to every pattern, so that the noise is 0 and the ties between
+* cells are broken by their index.
+*
+* Build and run from this directory:
+*	g++ -std=c++17 -O2 -pthread -I../wfc determinism_test.cpp -o determinism_test
+*	./determinism_test
+* The program returns 0 if every configuration gives the same outputs.
+*/
+#include <stdint.h>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "counter_rng.hpp"
+#include "genericWFC.hpp"
+
+namespace {
+
+const unsigned size = 16;
+const unsigned nb_seeds = 8;
+
+struct TestModel {
+	const char *name;
+	std::shared_ptr<const CompiledModel> model;
+	bool periodic_output;
+};
+
+/**
+* Return a model of nb_patterns patterns where two patterns are compatible
+* in a direction with probability 7/8, using equal frequencies if
+* equal_frequencies is true.
+*/
+std::shared_ptr<const CompiledModel> random_model(unsigned nb_patterns, uint64_t seed,
+	bool equal_frequencies) {
+	Propagator::PropagatorState propagator(nb_patterns);
+	for (unsigned direction = 0; direction < 3; direction++) {
+		for (unsigned a = 0; a < nb_patterns; a++) {
+			for (unsigned b = 0; b < nb_patterns; b++) {
+				if (a == b || (counter_random(seed, a * nb_patterns + b, direction,
+					RandomStream::select) % 8 < 7)) {
+					propagator[a][direction].push_back(b);
+					propagator[b][get_opposite_direction(direction)].push_back(a);
+				}
+			}
+		}
+	}
+	std::vector<double> frequencies(nb_patterns, 1.0);
+	if (!equal_frequencies) {
+		for (unsigned k = 0; k < nb_patterns; k++) {
+			frequencies[k] = 0.5 + k % 5;
+		}
+	}
+	return CompiledModel::compile(frequencies, propagator,
+		std::vector<int>(nb_patterns, 0), std::vector<int>(nb_patterns, size));
+}
+
+/**
+* Return a layer banning 60% of the patterns of every cell.
+*/
+ConstraintLayer random_bans(unsigned nb_patterns, uint64_t seed) {
+	ConstraintLayer layer(size, size, size, nb_patterns);
+	for (unsigned i = 0; i < size; i++) {
+		for (unsigned j = 0; j < size; j++) {
+			for (unsigned k = 0; k < size; k++) {
+				for (unsigned p = 0; p < nb_patterns; p++) {
+					if (counter_uniform(seed, (i * size + j) * size + k, p,
+						RandomStream::noise, 1.0) < 0.6) {
+						layer.ban(i, j, k, p);
+					}
+				}
+			}
+		}
+	}
+	return layer;
+}
+
+/**
+* Return a hash of the output of a run, 0 if it failed.
+*/
+uint64_t run(const TestModel &test, const ConstraintLayer &layer, int seed,
+	Heuristic heuristic, Layout layout, unsigned threads) {
+	genericWFC wfc(test.periodic_output, seed, test.model, size, size, size,
+		heuristic, layout, threads);
+	if (wfc.add_constraints(layer)) {
+		return 0;
+	}
+	std::optional<Array3D<unsigned>> output = wfc.run();
+	if (!output) {
+		return 0;
+	}
+	uint64_t hash = 1;
+	for (unsigned pattern : output->data) {
+		hash = splitmix64(hash ^ pattern);
+	}
+	return hash;
+}
+
+}
+
+int main() {
+	const unsigned nb_patterns = 24;
+	const std::vector<TestModel> models = {
+		{ "random", random_model(nb_patterns, 1, false), false },
+		{ "equal frequencies", random_model(nb_patterns, 2, true), false },
+		{ "periodic", random_model(nb_patterns, 3, false), true },
+	};
+	const Heuristic heuristics[] = { Heuristic::entropy, Heuristic::mrv,
+		Heuristic::scanline, Heuristic::frontier, Heuristic::hilbert };
+	const char *heuristic_names[] = { "entropy", "mrv", "scanline", "frontier", "hilbert" };
+	const Layout layouts[] = { Layout::linear, Layout::brick };
+	const unsigned threads[] = { 0, 1, 4 };
+
+	unsigned failures = 0;
+	for (const TestModel &test : models) {
+		const ConstraintLayer layer = random_bans(nb_patterns, 7);
+		for (unsigned h = 0; h < 5; h++) {
+			unsigned successes = 0;
+			for (int seed = 0; seed < (int)nb_seeds; seed++) {
+				const uint64_t expected = run(test, layer, seed, heuristics[h], Layout::linear, 0);
+				successes += expected != 0;
+				for (Layout layout : layouts) {
+					for (unsigned nb_threads : threads) {
+						uint64_t hash = run(test, layer, seed, heuristics[h], layout, nb_threads);
+						if (hash != expected) {
+							std::cout << "FAIL " << test.name << " " << heuristic_names[h]
+								<< " seed " << seed << " layout " << (int)layout
+								<< " threads " << nb_threads << "\n";
+							failures++;
+						}
+					}
+				}
+			}
+			std::cout << test.name << " " << heuristic_names[h] << ": " << successes
+				<< "/" << nb_seeds << " successes\n";
+		}
+	}
+	if (failures != 0) {
+		std::cout << failures << " configurations gave a different output\n";
+		return 1;
+	}
+	std::cout << "every configuration gave the same outputs\n";
+	return 0;
+}
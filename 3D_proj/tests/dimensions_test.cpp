@@ -0,0 +1,193 @@
+/**
+* Check that genericWFC and the classes built on it follow the sizes given to
+* their constructors on waves whose three sizes are different: the outputs
+* have the requested extents, and every output is made of patterns of the
+* model at the right place.
+*
+* Build and run from this directory:
+*	g++ -std=c++17 -O2 -pthread -I../wfc dimensions_test.cpp -o dimensions_test
+*	./dimensions_test
+* The program returns 0 if every check passes.
+*/
+#include <stdint.h>
+#include <iostream>
+#include <optional>
+#include <set>
+#include <vector>
+#include "contradiction_heatmap.hpp"
+#include "counter_rng.hpp"
+#include "overlapping_wfc.hpp"
+
+namespace {
+
+unsigned failures = 0;
+
+void check(bool condition, const char *message) {
+	if (!condition) {
+		std::cout << "FAIL " << message << "\n";
+		failures++;
+	}
+}
+
+/**
+* Return a toric input made of noisy layers, so that the overlapping model
+* has different patterns along the three axes.
+*/
+Array3D<uint8_t> layered_input(unsigned depth, unsigned height, unsigned width) {
+	Array3D<uint8_t> input(depth, height, width);
+	for (unsigned z = 0; z < depth; z++) {
+		for (unsigned y = 0; y < height; y++) {
+			for (unsigned x = 0; x < width; x++) {
+				uint8_t voxel = (y % 3 == 0) ? 1 : 0;
+				if (counter_random(5, (z * height + y) * width + x, 0, RandomStream::noise) % 6 == 0) {
+					voxel = 2;
+				}
+				input.get(z, y, x) = voxel;
+			}
+		}
+	}
+	return input;
+}
+
+/**
+* Return the windows of size^3 voxels of a toric volume.
+*/
+std::set<std::vector<uint8_t>> windows(const Array3D<uint8_t> &volume, unsigned size) {
+	std::set<std::vector<uint8_t>> result;
+	for (unsigned z = 0; z < volume.height; z++) {
+		for (unsigned y = 0; y < volume.width; y++) {
+			for (unsigned x = 0; x < volume.depth; x++) {
+				std::vector<uint8_t> window;
+				for (unsigned dz = 0; dz < size; dz++) {
+					for (unsigned dy = 0; dy < size; dy++) {
+						for (unsigned dx = 0; dx < size; dx++) {
+							window.push_back(volume.get((z + dz) % volume.height,
+								(y + dy) % volume.width, (x + dx) % volume.depth));
+						}
+					}
+				}
+				result.insert(window);
+			}
+		}
+	}
+	return result;
+}
+
+/**
+* A toric overlapping output of 6 x 10 x 14 voxels must have these extents,
+* and every window of it must be a window of the input.
+*/
+void overlapping_output() {
+	const Array3D<uint8_t> input = layered_input(6, 9, 8);
+	const OverlappingWFC3DOptions options = { true, true, 6, 10, 14, 2 };
+	const std::set<std::vector<uint8_t>> input_windows = windows(input, 2);
+	unsigned successes = 0;
+	for (int seed = 0; seed < 8; seed++) {
+		OverlappingWFC3D<uint8_t> wfc(input, options, seed);
+		std::optional<Array3D<uint8_t>> output = wfc.run();
+		if (!output) {
+			continue;
+		}
+		successes++;
+		check(output->height == 6 && output->width == 10 && output->depth == 14,
+			"overlapping output extents");
+		for (const std::vector<uint8_t> &window : windows(*output, 2)) {
+			check(input_windows.count(window) != 0, "overlapping output window");
+		}
+	}
+	check(successes != 0, "overlapping runs all failed");
+}
+
+/**
+* Return a model of nb_patterns patterns compatible with each other in every
+* direction, or only with themselves if isolated is true.
+*/
+std::shared_ptr<const CompiledModel> free_model(unsigned nb_patterns, bool isolated = false) {
+	Propagator::PropagatorState propagator(nb_patterns);
+	for (unsigned a = 0; a < nb_patterns; a++) {
+		for (unsigned direction = 0; direction < 6; direction++) {
+			for (unsigned b = 0; b < nb_patterns; b++) {
+				if (!isolated || a == b) {
+					propagator[a][direction].push_back(b);
+				}
+			}
+		}
+	}
+	return CompiledModel::compile(std::vector<double>(nb_patterns, 1.0), propagator,
+		std::vector<int>(nb_patterns, 0), std::vector<int>(nb_patterns, 1000));
+}
+
+/**
+* A layer built with the sizes given to genericWFC must be accepted, and its
+* cell (i,j,k) must be the cell (i,j,k) of the output and of the
+* contradictions.
+*/
+void constraint_layer() {
+	const unsigned nb_patterns = 3;
+	const std::shared_ptr<const CompiledModel> model = free_model(nb_patterns);
+
+	ConstraintLayer layer(4, 6, 8, nb_patterns);
+	layer.fix(1, 4, 6, 2);
+	layer.fix(3, 0, 7, 1);
+	layer.fix(0, 5, 0, 0);
+	genericWFC wfc(false, 0, model, 4, 6, 8);
+	std::optional<Contradiction> contradiction = wfc.add_constraints(layer);
+	check(!contradiction, "layer of the sizes of the wave refused");
+	std::optional<Array3D<unsigned>> output = wfc.run();
+	check(output.has_value(), "constrained run failed");
+	if (output) {
+		check(output->height == 4 && output->width == 6 && output->depth == 8,
+			"generic output extents");
+		check(output->get(1, 4, 6) == 2 && output->get(3, 0, 7) == 1 &&
+			output->get(0, 5, 0) == 0, "fixed cells not at their coordinates");
+	}
+
+	ConstraintLayer empty(4, 6, 8, nb_patterns);
+	empty.allow_only(3, 5, 1, {});
+	genericWFC emptied(false, 0, model, 4, 6, 8);
+	contradiction = emptied.add_constraints(empty);
+	check(contradiction && !contradiction->layer_mismatch && contradiction->i == 3 &&
+		contradiction->j == 5 && contradiction->k == 1, "contradiction coordinates");
+
+	genericWFC other(false, 0, model, 4, 6, 8);
+	contradiction = other.add_constraints(ConstraintLayer(8, 6, 4, nb_patterns));
+	check(contradiction && contradiction->layer_mismatch, "layer of other sizes applied");
+}
+
+/**
+* A heatmap built with the sizes given to genericWFC must count the
+* contradictions at their cell, and the pattern whose removal emptied it.
+*/
+void heatmap() {
+	const unsigned nb_patterns = 2;
+	ContradictionHeatmap heatmap(4, 6, 8, nb_patterns);
+	ConstraintLayer layer(4, 6, 8, nb_patterns);
+	layer.fix(3, 5, 6, 0);
+	layer.fix(3, 5, 7, 1);
+	genericWFC wfc(false, 0, free_model(nb_patterns, true), 4, 6, 8);
+	std::optional<Contradiction> contradiction = wfc.add_constraints(layer);
+	check(contradiction && contradiction->source_pattern >= 0,
+		"propagation contradiction not found");
+	if (contradiction && contradiction->source_pattern >= 0) {
+		heatmap.add(*contradiction);
+		check(heatmap.get_cells().get(contradiction->i, contradiction->j, contradiction->k) == 1,
+			"heatmap cell");
+		check(heatmap.worst_patterns() ==
+			std::vector<unsigned>{ (unsigned)contradiction->source_pattern },
+			"heatmap source pattern");
+	}
+}
+
+}
+
+int main() {
+	overlapping_output();
+	constraint_layer();
+	heatmap();
+	if (failures != 0) {
+		std::cout << failures << " checks failed\n";
+		return 1;
+	}
+	std::cout << "every check passed\n";
+	return 0;
+}
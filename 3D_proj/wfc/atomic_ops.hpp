@@ -0,0 +1,78 @@
+#pragma once
+#ifndef WFC_ATOMIC_OPS_HPP_
+#define WFC_ATOMIC_OPS_HPP_
+
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/**
+* Atomic operations on plain integers, used by the parallel propagation to
+* update the compatible counters and the wave bitsets in place (C++17 has no
+* std::atomic_ref).
+*/
+
+/**
+* Atomically decrement value and return the new value. The unsigned counters
+* wrap around like the sequential ones.
+*/
+inline uint8_t atomic_decrement(uint8_t &value) noexcept {
+#ifdef _MSC_VER
+	return (uint8_t)(_InterlockedExchangeAdd8(reinterpret_cast<volatile char *>(&value), -1) - 1);
+#else
+	return __atomic_sub_fetch(&value, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+inline uint16_t atomic_decrement(uint16_t &value) noexcept {
+#ifdef _MSC_VER
+	return (uint16_t)_InterlockedDecrement16(reinterpret_cast<volatile short *>(&value));
+#else
+	return __atomic_sub_fetch(&value, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+inline uint32_t atomic_decrement(uint32_t &value) noexcept {
+#ifdef _MSC_VER
+	static_assert(sizeof(long) == sizeof(uint32_t), "long and uint32_t must have the same size");
+	return (uint32_t)_InterlockedDecrement(reinterpret_cast<volatile long *>(&value));
+#else
+	return __atomic_sub_fetch(&value, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/**
+* Atomically set value to new_value, without ordering constraint.
+*/
+template <typename T> inline void atomic_store(T &value, T new_value) noexcept {
+#ifdef _MSC_VER
+	*reinterpret_cast<volatile T *>(&value) = new_value;
+#else
+	__atomic_store_n(&value, new_value, __ATOMIC_RELAXED);
+#endif
+}
+
+/**
+* Atomically replace word by word & mask and return the old value.
+*/
+inline uint64_t atomic_fetch_and(uint64_t &word, uint64_t mask) noexcept {
+#ifdef _MSC_VER
+	return _InterlockedAnd64(reinterpret_cast<volatile __int64 *>(&word), (__int64)mask);
+#else
+	return __atomic_fetch_and(&word, mask, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/**
+* Atomically read word.
+*/
+inline uint64_t atomic_load(const uint64_t &word) noexcept {
+#ifdef _MSC_VER
+	return *reinterpret_cast<const volatile uint64_t *>(&word);
+#else
+	return __atomic_load_n(&word, __ATOMIC_SEQ_CST);
+#endif
+}
+
+#endif // WFC_ATOMIC_OPS_HPP_
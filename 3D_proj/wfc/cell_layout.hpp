@@ -0,0 +1,106 @@
+#pragma once
+#ifndef WFC_CELL_LAYOUT_HPP_
+#define WFC_CELL_LAYOUT_HPP_
+
+/**
+* The order in which the cells of the wave are stored in memory.
+*/
+enum class Layout {
+	linear,	// x + y * width + z * width * height
+	brick	// 4x4x4 bricks stored one after the other, so that the 6 neighbors
+		// of a cell are usually close in memory. Only used when every
+		// dimension is a multiple of 4, the layout is linear otherwise.
+};
+
+/**
+* Map the coordinates (z,y,x) of a cell to its index in the wave, the
+* memoisation and the compatible array of the propagator, and back.
+*/
+class CellLayout {
+private:
+	static constexpr unsigned brick_bits = 2;
+	static constexpr unsigned brick_mask = (1 << brick_bits) - 1;
+
+	/**
+	* The strides of the brick layout: the index of (z,y,x) is
+	* (z >> 2) * brick_stride_z + (y >> 2) * brick_stride_y + (x >> 2) * 64
+	* + (z & 3) * 16 + (y & 3) * 4 + (x & 3).
+	*/
+	unsigned brick_stride_y;
+	unsigned brick_stride_z;
+
+public:
+	Layout layout;
+	unsigned width;
+	unsigned height;
+	unsigned depth;
+
+	CellLayout(unsigned width, unsigned height, unsigned depth,
+		Layout layout = Layout::linear) noexcept
+		: brick_stride_y(width << (2 * brick_bits)),
+		brick_stride_z((width * height) << brick_bits), layout(layout),
+		width(width), height(height), depth(depth) {
+		if ((width & brick_mask) || (height & brick_mask) || (depth & brick_mask)) {
+			this->layout = Layout::linear;
+		}
+	}
+
+	/**
+	* Return the index of cell (z,y,x).
+	*/
+	unsigned index(unsigned z, unsigned y, unsigned x) const noexcept {
+		if (layout == Layout::linear) {
+			return x + y * width + z * width * height;
+		}
+		return (z >> brick_bits) * brick_stride_z + (y >> brick_bits) * brick_stride_y +
+			((x >> brick_bits) << (3 * brick_bits)) +
+			((z & brick_mask) << (2 * brick_bits)) + ((y & brick_mask) << brick_bits) +
+			(x & brick_mask);
+	}
+
+	/**
+	* Return the coordinates (z,y,x) of the cell index.
+	*/
+	void coordinates(unsigned index, unsigned &z, unsigned &y, unsigned &x) const noexcept {
+		if (layout == Layout::linear) {
+			x = index % width;
+			y = index / width % height;
+			z = index / width / height;
+			return;
+		}
+		unsigned local = index & ((1 << (3 * brick_bits)) - 1);
+		z = ((index / brick_stride_z) << brick_bits) + (local >> (2 * brick_bits));
+		y = ((index % brick_stride_z / brick_stride_y) << brick_bits) +
+			((local >> brick_bits) & brick_mask);
+		x = ((index % brick_stride_y >> (3 * brick_bits)) << brick_bits) + (local & brick_mask);
+	}
+
+	/**
+	* Return the index the cell index would have in the linear layout. It is
+	* used to read and write the outputs and the constraint layers, to draw
+	* the random numbers, to break the ties between cells and to order the
+	* scanline heuristic, so that the results don't depend on the layout.
+	*/
+	unsigned linear(unsigned index) const noexcept {
+		if (layout == Layout::linear) {
+			return index;
+		}
+		unsigned z, y, x;
+		coordinates(index, z, y, x);
+		return x + y * width + z * width * height;
+	}
+
+	/**
+	* Return the index of the cell whose index in the linear layout is
+	* linear_index.
+	*/
+	unsigned from_linear(unsigned linear_index) const noexcept {
+		if (layout == Layout::linear) {
+			return linear_index;
+		}
+		return index(linear_index / width / height, linear_index / width % height,
+			linear_index % width);
+	}
+};
+
+#endif // WFC_CELL_LAYOUT_HPP_
@@ -0,0 +1,215 @@
+#pragma once
+#ifndef WFC_CONSTRAINT_LAYER_HPP_
+#define WFC_CONSTRAINT_LAYER_HPP_
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+#include "array3D.hpp"
+#include "array4D.hpp"
+
+/**
+* The cell (i,j,k) of the wave where a contradiction was found.
+* When the cell was emptied by the propagation, pattern is the last pattern
+* removed from it and direction the direction (see direction.hpp) from the
+* neighbor whose removal of source_pattern took away its last support.
+* They are -1 when the cell was emptied directly (by a constraint layer).
+* layer_mismatch is true when a constraint layer was not applied because its
+* dimensions are not the ones of the wave, the cell is then (0,0,0).
+*/
+struct Contradiction {
+	unsigned i;
+	unsigned j;
+	unsigned k;
+	int pattern = -1;
+	int direction = -1;
+	int source_pattern = -1;
+	bool layer_mismatch = false;
+};
+
+/**
+* Identify the content of a constraint layer in a WFCSnapshotCache. hash is
+* computed once per layer, and the contents are only compared when two keys
+* have the same hash. A key without content stands for no layer.
+*/
+struct ConstraintKey {
+	size_t hash = 0;
+	std::shared_ptr<const Array4D<uint8_t>> allowed;
+
+	bool operator==(const ConstraintKey &other) const noexcept {
+		if (hash != other.hash) {
+			return false;
+		}
+		if (allowed == other.allowed) {
+			return true;
+		}
+		return allowed && other.allowed &&
+			allowed->height == other.allowed->height &&
+			allowed->width == other.allowed->width &&
+			allowed->depth == other.allowed->depth &&
+			allowed->unknown == other.allowed->unknown &&
+			allowed->data == other.allowed->data;
+	}
+};
+
+/**
+* A layer of constraints applied to the whole wave before the first
+* observation. allowed.get(i, j, k, pattern) is 0 if pattern is banned from
+* cell (i,j,k). Every pattern is allowed by default.
+*/
+struct ConstraintLayer {
+	Array4D<uint8_t> allowed;
+
+	/**
+	* The key of the layer, computed by the first call to key() and reset by
+	* the functions changing the layer. A layer changed through allowed
+	* directly after a call to key() keeps its old key.
+	*/
+	mutable ConstraintKey cached_key;
+
+	/**
+	* Build a layer allowing every pattern in every cell.
+	* The dimensions are the ones given to genericWFC, in the same order:
+	* cell (i,j,k) of the layer is cell (z,y,x) of the wave.
+	*/
+	ConstraintLayer(unsigned wave_depth, unsigned wave_height, unsigned wave_width,
+		unsigned nb_patterns) noexcept
+		: allowed(wave_depth, wave_height, wave_width, nb_patterns, 1) {}
+
+	/**
+	* Build a layer from a grid of pattern ids. Cells with a negative id are
+	* left free, the other cells can only contain their pattern.
+	*/
+	static ConstraintLayer from_patterns(const Array3D<int> &patterns,
+		unsigned nb_patterns) noexcept {
+		ConstraintLayer layer(patterns.height, patterns.width, patterns.depth,
+			nb_patterns);
+		for (unsigned i = 0; i < patterns.height; i++) {
+			for (unsigned j = 0; j < patterns.width; j++) {
+				for (unsigned k = 0; k < patterns.depth; k++) {
+					if (patterns.get(i, j, k) >= 0) {
+						layer.fix(i, j, k, patterns.get(i, j, k));
+					}
+				}
+			}
+		}
+		return layer;
+	}
+
+	/**
+	* Only allow pattern in cell (i,j,k).
+	*/
+	void fix(unsigned i, unsigned j, unsigned k, unsigned pattern) noexcept {
+		cached_key.allowed.reset();
+		for (unsigned p = 0; p < allowed.unknown; p++) {
+			allowed.get(i, j, k, p) = (p == pattern);
+		}
+	}
+
+	/**
+	* Only allow the given patterns in cell (i,j,k).
+	*/
+	void allow_only(unsigned i, unsigned j, unsigned k,
+		const std::vector<unsigned> &patterns) noexcept {
+		cached_key.allowed.reset();
+		for (unsigned p = 0; p < allowed.unknown; p++) {
+			allowed.get(i, j, k, p) = 0;
+		}
+		for (unsigned pattern : patterns) {
+			allowed.get(i, j, k, pattern) = 1;
+		}
+	}
+
+	/**
+	* Ban pattern from cell (i,j,k).
+	*/
+	void ban(unsigned i, unsigned j, unsigned k, unsigned pattern) noexcept {
+		cached_key.allowed.reset();
+		allowed.get(i, j, k, pattern) = 0;
+	}
+
+	/**
+	* Only allow pattern in the cells whose coordinate along axis (0 for i,
+	* 1 for j, 2 for k) is in [low, high]. If from_end is true, the coordinate
+	* is counted from the last cell of the axis.
+	*/
+	void restrict_to_band(unsigned pattern, unsigned axis, int low, int high,
+		bool from_end = false) noexcept {
+		cached_key.allowed.reset();
+		const unsigned extent[3] = { allowed.height, allowed.width, allowed.depth };
+		for (unsigned i = 0; i < allowed.height; i++) {
+			for (unsigned j = 0; j < allowed.width; j++) {
+				for (unsigned k = 0; k < allowed.depth; k++) {
+					const unsigned coordinates[3] = { i, j, k };
+					int c = coordinates[axis];
+					if (from_end) {
+						c = extent[axis] - 1 - c;
+					}
+					if (c < low || c > high) {
+						allowed.get(i, j, k, pattern) = 0;
+					}
+				}
+			}
+		}
+	}
+
+	/**
+	* Only allow pattern in the box [i_min, i_max] x [j_min, j_max] x
+	* [k_min, k_max].
+	*/
+	void restrict_to_region(unsigned pattern, unsigned i_min, unsigned i_max,
+		unsigned j_min, unsigned j_max, unsigned k_min, unsigned k_max) noexcept {
+		cached_key.allowed.reset();
+		for (unsigned i = 0; i < allowed.height; i++) {
+			for (unsigned j = 0; j < allowed.width; j++) {
+				for (unsigned k = 0; k < allowed.depth; k++) {
+					if (i < i_min || i > i_max || j < j_min || j > j_max ||
+						k < k_min || k > k_max) {
+						allowed.get(i, j, k, pattern) = 0;
+					}
+				}
+			}
+		}
+	}
+
+	/**
+	* Return true if the layer can be applied to a wave of wave_depth x
+	* wave_height x wave_width cells and nb_patterns patterns.
+	*/
+	bool matches(unsigned wave_depth, unsigned wave_height, unsigned wave_width,
+		unsigned nb_patterns) const noexcept {
+		return allowed.height == wave_depth && allowed.width == wave_height &&
+			allowed.depth == wave_width && allowed.unknown == nb_patterns;
+	}
+
+	/**
+	* Return a pointer to the allowed patterns of the cell of linear index
+	* (i * wave_height + j) * wave_width + k (see CellLayout::linear).
+	*/
+	const uint8_t *get(unsigned index) const noexcept {
+		return allowed.data.data() + index * allowed.unknown;
+	}
+
+	/**
+	* Return the key identifying the content of the layer in a
+	* WFCSnapshotCache. The content is hashed and copied once, the next calls
+	* share it until the layer is changed.
+	*/
+	ConstraintKey key() const {
+		if (!cached_key.allowed) {
+			size_t hash = std::hash<std::string_view>()(std::string_view(
+				(const char *)allowed.data.data(), allowed.data.size()));
+			for (size_t value : { (size_t)allowed.height, (size_t)allowed.width,
+				(size_t)allowed.depth, (size_t)allowed.unknown }) {
+				hash ^= value + (size_t)0x9e3779b9 + (hash << 6) + (hash >> 2);
+			}
+			cached_key.hash = hash;
+			cached_key.allowed = std::make_shared<const Array4D<uint8_t>>(allowed);
+		}
+		return cached_key;
+	}
+};
+
+#endif // WFC_CONSTRAINT_LAYER_HPP_
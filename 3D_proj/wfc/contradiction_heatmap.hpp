@@ -0,0 +1,85 @@
+#pragma once
+#ifndef WFC_CONTRADICTION_HEATMAP_HPP_
+#define WFC_CONTRADICTION_HEATMAP_HPP_
+
+#include <algorithm>
+#include <array>
+#include <vector>
+#include "array3D.hpp"
+#include "constraint_layer.hpp"
+
+/**
+* Accumulate the contradictions of many failed runs on waves of the same
+* size: how often each cell was emptied, and how often each pattern and each
+* direction triggered the contradiction.
+*/
+class ContradictionHeatmap {
+private:
+	Array3D<unsigned> cells;
+	std::vector<unsigned> patterns;
+	std::array<unsigned, 6> directions = {};
+	unsigned nb_contradictions = 0;
+
+public:
+	/**
+	* The sizes are the ones given to genericWFC, so that cell (i,j,k) of
+	* the heatmap is cell (i,j,k) of a Contradiction.
+	*/
+	ContradictionHeatmap(unsigned wave_depth, unsigned wave_height, unsigned wave_width,
+		unsigned nb_patterns) noexcept
+		: cells(wave_depth, wave_height, wave_width, 0), patterns(nb_patterns, 0) {}
+
+	/**
+	* Add the contradiction of a failed run.
+	*/
+	void add(const Contradiction &contradiction) noexcept {
+		cells.get(contradiction.i, contradiction.j, contradiction.k)++;
+		if (contradiction.source_pattern >= 0){
+			patterns[contradiction.source_pattern]++;
+		}
+		if (contradiction.direction >= 0){
+			directions[contradiction.direction]++;
+		}
+		nb_contradictions++;
+	}
+
+	/**
+	* The number of contradictions added.
+	*/
+	unsigned size() const noexcept { return nb_contradictions; }
+
+	/**
+	* The number of contradictions in each cell (z,y,x).
+	*/
+	const Array3D<unsigned> &get_cells() const noexcept { return cells; }
+
+	/**
+	* The number of contradictions triggered by the removal of each pattern
+	* from a neighbor of the emptied cell (see Contradiction::source_pattern).
+	*/
+	const std::vector<unsigned> &get_patterns() const noexcept { return patterns; }
+
+	/**
+	* The number of contradictions triggered in each direction.
+	*/
+	const std::array<unsigned, 6> &get_directions() const noexcept { return directions; }
+
+	/**
+	* Return the patterns that triggered at least one contradiction, the most
+	* frequent first.
+	*/
+	std::vector<unsigned> worst_patterns() const noexcept {
+		std::vector<unsigned> result;
+		for (unsigned pattern = 0; pattern < patterns.size(); pattern++){
+			if (patterns[pattern] > 0){
+				result.push_back(pattern);
+			}
+		}
+		std::stable_sort(result.begin(), result.end(), [&](unsigned a, unsigned b){
+			return patterns[a] > patterns[b];
+		});
+		return result;
+	}
+};
+
+#endif // WFC_CONTRADICTION_HEATMAP_HPP_
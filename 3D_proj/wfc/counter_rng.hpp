@@ -0,0 +1,52 @@
+#pragma once
+#ifndef WFC_COUNTER_RNG_HPP_
+#define WFC_COUNTER_RNG_HPP_
+
+#include <stdint.h>
+
+/**
+* Counter-based random numbers. Every value is a pure function of
+* (seed, cell, step, stream) instead of the next value of a sequential
+* generator, so the result of the algorithm does not depend on the order in
+* which cells are visited, nor on how the work is split between threads.
+* tests/determinism_test.cpp checks this on every heuristic and layout.
+*/
+enum class RandomStream : uint64_t {
+	noise = 0,   // The noise added to the entropy of a cell to break ties.
+	observe = 1, // The value used to choose the pattern of an observed cell.
+	select = 2,  // The value used to choose a cell among equivalent cells.
+	expand = 3   // The value used to choose a pattern among the patterns merged
+	             // into one by the model analysis (see model_analysis.hpp).
+};
+
+/**
+* The splitmix64 finalizer, a bijective mix of the 64 bits of x.
+*/
+inline uint64_t splitmix64(uint64_t x) noexcept {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/**
+* Return the random 64 bits value associated to (seed, cell, step, stream).
+*/
+inline uint64_t counter_random(uint64_t seed, uint64_t cell, uint64_t step,
+	RandomStream stream) noexcept {
+	uint64_t x = splitmix64(seed);
+	x = splitmix64(x ^ cell);
+	return splitmix64(x ^ (step << 2 | (uint64_t)stream));
+}
+
+/**
+* Return a double uniformly distributed in [0, max) associated to
+* (seed, cell, step, stream).
+*/
+inline double counter_uniform(uint64_t seed, uint64_t cell, uint64_t step,
+	RandomStream stream, double max) noexcept {
+	return (counter_random(seed, cell, step, stream) >> 11) *
+		(1.0 / 9007199254740992.0) * max;
+}
+
+#endif // WFC_COUNTER_RNG_HPP_
@@ -0,0 +1,259 @@
+#pragma once
+#ifndef WFC_CUBE_SYMMETRY_HPP_
+#define WFC_CUBE_SYMMETRY_HPP_
+
+#include <array>
+#include <initializer_list>
+#include <stdint.h>
+#include "direction.hpp"
+
+/**
+* An isometry of the cube, acting on mesh coordinates (X, Y, Z): the
+* coordinate a of the image of a point p is sign[a] * p[axis[a]]. A tile mesh
+* is placed with X along the i axis of the wave (direction_z), Y along j
+* (direction_y, the vertical) and Z along k (direction_x).
+*/
+struct CubeTransform {
+	int axis[3];
+	int sign[3];
+
+	constexpr bool operator==(const CubeTransform &other) const noexcept {
+		for (unsigned a = 0; a < 3; a++) {
+			if (axis[a] != other.axis[a] || sign[a] != other.sign[a]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	* Return true if the transform reverses the orientation of space, so the
+	* faces of a transformed mesh have to be flipped.
+	*/
+	constexpr bool mirrored() const noexcept {
+		// The sign of the permutation times the signs of the axes.
+		int det = sign[0] * sign[1] * sign[2];
+		for (unsigned a = 0; a < 3; a++) {
+			if (axis[a] != (int)a && axis[axis[a]] == (int)a) {
+				// A transposition: a and axis[a] are swapped.
+				return det > 0;
+			}
+		}
+		return det < 0;
+	}
+
+	/**
+	* Return the image of (x, y, z).
+	*/
+	template <typename V>
+	constexpr std::array<V, 3> apply(V x, V y, V z) const noexcept {
+		const V p[3] = { x, y, z };
+		return { sign[0] * p[axis[0]], sign[1] * p[axis[1]], sign[2] * p[axis[2]] };
+	}
+};
+
+/**
+* Return the transform applying b, then a.
+*/
+constexpr CubeTransform cube_compose(const CubeTransform &a, const CubeTransform &b) noexcept {
+	CubeTransform result = {};
+	for (unsigned x = 0; x < 3; x++) {
+		result.axis[x] = b.axis[a.axis[x]];
+		result.sign[x] = a.sign[x] * b.sign[a.axis[x]];
+	}
+	return result;
+}
+
+constexpr CubeTransform cube_identity = { { 0, 1, 2 }, { 1, 1, 1 } };
+
+/**
+* A quarter turn around Y: (X, Y, Z) -> (Z, Y, -X).
+*/
+constexpr CubeTransform cube_turn = { { 2, 1, 0 }, { 1, 1, -1 } };
+
+/**
+* The mirror across the plane X = 0: (X, Y, Z) -> (-X, Y, Z).
+*/
+constexpr CubeTransform cube_mirror = { { 0, 1, 2 }, { -1, 1, 1 } };
+
+/**
+* The rotations taking Y to Y, -Y, X, -X, Z and -Z.
+*/
+constexpr CubeTransform cube_up_rotations[6] = {
+	{ { 0, 1, 2 }, { 1, 1, 1 } },
+	{ { 0, 1, 2 }, { 1, -1, -1 } },
+	{ { 1, 0, 2 }, { 1, -1, 1 } },
+	{ { 1, 0, 2 }, { -1, 1, 1 } },
+	{ { 0, 2, 1 }, { 1, -1, 1 } },
+	{ { 0, 2, 1 }, { 1, 1, -1 } } };
+
+constexpr unsigned cube_group_size = 48;
+constexpr unsigned cube_rotation_count = 24;
+
+/**
+* Return the element g of the group of the cube: the up rotation
+* g % 24 / 4 applied after g % 4 quarter turns around Y, themselves applied
+* after the mirror if g >= 24. The rotations come first, and the 8 elements
+* keeping Y vertical are 0 to 3 (the turns) and 24 to 27 (the turns after
+* the mirror).
+*/
+constexpr CubeTransform cube_element(unsigned g) noexcept {
+	CubeTransform result = g >= cube_rotation_count ? cube_mirror : cube_identity;
+	for (unsigned t = 0; t < g % 4; t++) {
+		result = cube_compose(cube_turn, result);
+	}
+	return cube_compose(cube_up_rotations[g % cube_rotation_count / 4], result);
+}
+
+constexpr std::array<CubeTransform, cube_group_size> make_cube_elements() noexcept {
+	std::array<CubeTransform, cube_group_size> elements = {};
+	for (unsigned g = 0; g < cube_group_size; g++) {
+		elements[g] = cube_element(g);
+	}
+	return elements;
+}
+
+constexpr std::array<CubeTransform, cube_group_size> cube_elements = make_cube_elements();
+
+/**
+* Return the index of transform in cube_elements.
+*/
+constexpr unsigned cube_index(const CubeTransform &transform) noexcept {
+	const bool mirrored = transform.mirrored();
+	const CubeTransform rotation = mirrored ? cube_compose(transform, cube_mirror) : transform;
+	// The up rotation is given by the image of Y, the turns by the rest.
+	unsigned up = 0;
+	for (unsigned a = 0; a < 3; a++) {
+		if (rotation.axis[a] == 1) {
+			up = (a == 1 ? 0 : a == 0 ? 2 : 4) + (rotation.sign[a] < 0 ? 1 : 0);
+		}
+	}
+	unsigned g = (mirrored ? cube_rotation_count : 0) + up * 4;
+	while (!(cube_elements[g] == transform)) {
+		g++;
+	}
+	return g;
+}
+
+/**
+* Return the elements of the smallest subgroup containing generators, as a
+* mask of bits of cube_elements.
+*/
+constexpr uint64_t cube_subgroup(std::initializer_list<CubeTransform> generators) noexcept {
+	uint64_t group = 1;
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (unsigned g = 0; g < cube_group_size; g++) {
+			if (!(group >> g & 1)) {
+				continue;
+			}
+			for (const CubeTransform &generator : generators) {
+				unsigned product = cube_index(cube_compose(generator, cube_elements[g]));
+				if (!(group >> product & 1)) {
+					group |= (uint64_t)1 << product;
+					changed = true;
+				}
+			}
+		}
+	}
+	return group;
+}
+
+/**
+* The transforms keeping Y vertical: the turns around Y and the mirrors
+* across vertical planes.
+*/
+constexpr uint64_t cube_vertical_group = cube_subgroup({ cube_turn, cube_mirror });
+
+constexpr uint64_t cube_rotation_group = ((uint64_t)1 << cube_rotation_count) - 1;
+
+constexpr uint64_t cube_full_group = ((uint64_t)1 << cube_group_size) - 1;
+
+/**
+* cube_directions[g][direction] is the direction taken to by cube_elements[g].
+*/
+constexpr std::array<std::array<uint8_t, 6>, cube_group_size> make_cube_directions() noexcept {
+	std::array<std::array<uint8_t, 6>, cube_group_size> directions = {};
+	for (unsigned g = 0; g < cube_group_size; g++) {
+		for (unsigned d = 0; d < 6; d++) {
+			std::array<int, 3> image =
+				cube_elements[g].apply(direction_z[d], direction_y[d], direction_x[d]);
+			for (unsigned d2 = 0; d2 < 6; d2++) {
+				if (image[0] == direction_z[d2] && image[1] == direction_y[d2] &&
+					image[2] == direction_x[d2]) {
+					directions[g][d] = (uint8_t)d2;
+				}
+			}
+		}
+	}
+	return directions;
+}
+
+constexpr std::array<std::array<uint8_t, 6>, cube_group_size> cube_directions = make_cube_directions();
+
+constexpr uint8_t no_orientation = 0xFF;
+
+/**
+* The orientations of a class of tiles and the action of the group of the
+* cube on them (see make_cube_symmetry).
+*/
+struct CubeSymmetryTable {
+	/**
+	* The elements that can be applied to the tiles of the class.
+	*/
+	uint64_t group = 0;
+
+	unsigned nb_orientations = 0;
+
+	/**
+	* element[orientation] is the element taking the base tile to orientation.
+	*/
+	std::array<uint8_t, cube_group_size> element = {};
+
+	/**
+	* action[g][orientation] is the orientation of cube_elements[g] applied to
+	* orientation, or no_orientation if g isn't in group.
+	*/
+	std::array<std::array<uint8_t, cube_group_size>, cube_group_size> action = {};
+};
+
+/**
+* Build the table of the tiles that can be transformed by the elements of
+* group and are left unchanged by the elements of stabilizer, a subgroup of
+* group. An orientation is a coset of the stabilizer: the orientations are
+* numbered in the order of their first element in cube_elements, so the
+* orientation o of a tile only turning around Y is o quarter turns.
+*/
+constexpr CubeSymmetryTable make_cube_symmetry(uint64_t group, uint64_t stabilizer) noexcept {
+	CubeSymmetryTable table;
+	table.group = group;
+	std::array<uint8_t, cube_group_size> orientation = {};
+	for (unsigned g = 0; g < cube_group_size; g++) {
+		orientation[g] = no_orientation;
+	}
+	for (unsigned g = 0; g < cube_group_size; g++) {
+		if (!(group >> g & 1) || orientation[g] != no_orientation) {
+			continue;
+		}
+		table.element[table.nb_orientations] = (uint8_t)g;
+		for (unsigned h = 0; h < cube_group_size; h++) {
+			if (stabilizer >> h & 1) {
+				orientation[cube_index(cube_compose(cube_elements[g], cube_elements[h]))] =
+					(uint8_t)table.nb_orientations;
+			}
+		}
+		table.nb_orientations++;
+	}
+	for (unsigned g = 0; g < cube_group_size; g++) {
+		for (unsigned o = 0; o < cube_group_size; o++) {
+			table.action[g][o] = no_orientation;
+			if (group >> g & 1 && o < table.nb_orientations) {
+				table.action[g][o] = orientation[cube_index(cube_compose(cube_elements[g],
+					cube_elements[table.element[o]]))];
+			}
+		}
+	}
+	return table;
+}
+
+#endif // WFC_CUBE_SYMMETRY_HPP_
@@ -4,10 +4,13 @@
 
 #include <cmath>
 #include <limits>
+#include <memory>
 #include <random>
 #include <unordered_map>
 
 #include "array3D.hpp"
+#include "compiled_model.hpp"
+#include "constraint_layer.hpp"
 #include "propagator.hpp"
 #include "wave.hpp"
 #include <optional>
@@ -19,51 +22,79 @@
 class genericWFC{
 private:
 	/**
-	* 
+	* ӣcounter_rng.hpp
 	*/
-	std::minstd_rand gen;
+	uint64_t seed;
 
 	/**
-	* wave
+	* ѽеĹ۲Ϊļʹֻȡ
 	*/
-	Wave wave;
+	unsigned step = 0;
 
 	/**
-	* ֲģʽ
+	* wave
 	*/
-	const std::vector<double> patterns_frequencies;
+	Wave wave;
 
 	/**
-	* ߶
+	* ıģֲͣģʽ߶ơ
 	*/
-	const std::vector<int> highth_limit_low;
-	const std::vector<int> highth_limit_high;
+	std::shared_ptr<const CompiledModel> model;
+
 	/**
 	* ͬ״
 	*/
 	const unsigned nb_patterns;
 
+	/**
+	* Ƿƽ
+	*/
+	bool periodic_output;
+
 	/**
 	* 
 	*/
 	Propagator propagator;
 
+	/**
+	* ʼԼѾӦòʱΪtrue
+	*/
+	bool prepared = false;
+
 	/**
 	* waveתΪ3d
 	*/
 	Array3D<unsigned> wave_to_output() const noexcept {
 		Array3D<unsigned> output_patterns(wave.depth, wave.height, wave.width);
 		for (unsigned i = 0; i < wave.size; i++){
-			for (unsigned k = 0; k < nb_patterns; k++){
-				if (wave.get(i, k)){
-					output_patterns.data[i] = k;
-				}
-			}
+			wave.for_each_pattern(i, [&](unsigned k){ output_patterns.data[wave.layout.linear(i)] = k; });
 		}
 		return output_patterns;
 	}
 
 public:
+	/**
+	* 캯ʹùıģ
+	* wave_depthwave_heightwave_widthwavezyֱ򣩡xĳߴ磬
+	* Լìܵ(i,j,k)(z,y,x)ߴ˳
+	* WaveĲ˳heightwidthdepth
+	*/
+	genericWFC(bool periodic_output, int seed, std::shared_ptr<const CompiledModel> model,
+		unsigned wave_depth, unsigned wave_height, unsigned wave_width,
+		Heuristic heuristic = Heuristic::entropy, Layout layout = Layout::linear,
+		unsigned propagation_threads = 0) noexcept
+		:seed(seed), wave(wave_height, wave_width, wave_depth, model, heuristic, layout),
+		model(model), nb_patterns(model->nb_patterns), periodic_output(periodic_output),
+		propagator(periodic_output, model, wave.layout, propagation_threads) {}
+
+	/**
+	* ӿգprepareʼµУʹµ
+	*/
+	genericWFC(const genericWFC &snapshot, int seed) noexcept
+		:genericWFC(snapshot) {
+		this->seed = seed;
+	}
+
 	/**
 	* 캯
 	*/
@@ -72,11 +103,10 @@ public:
 		unsigned wave_depth, unsigned wave_height, unsigned wave_width, 
 		std::vector<int> highth_limit_low, std::vector<int> highth_limit_high)
 	noexcept
-		:gen(seed), wave(wave_depth, wave_height, wave_width, patterns_frequencies),
-		patterns_frequencies(patterns_frequencies),
-		nb_patterns(propagator.size()),
-		propagator(wave_depth, wave_height, wave_width, periodic_output, propagator),
-		highth_limit_low(highth_limit_low), highth_limit_high(highth_limit_high) {}
+		:genericWFC(periodic_output, seed,
+			CompiledModel::compile(patterns_frequencies, propagator,
+				highth_limit_low, highth_limit_high),
+			wave_depth, wave_height, wave_width) {}
 
 	/**
 	* ع۲ֵ
@@ -91,7 +121,7 @@ public:
 	* صcell
 	*/
 	ObserveStatus observe() noexcept {
-		int argmin = wave.get_min_entropy(gen);
+		int argmin = wave.select_cell(seed, step);
 
 		if (argmin == -2){
 			return failure;
@@ -102,49 +132,109 @@ public:
 			return success;
 		}
 
-		double s = 0;
-		for (unsigned k = 0; k < nb_patterns; k++){
-			s += wave.get(argmin, k) ? patterns_frequencies[k] : 0;
-		}
+		// Ƶ֮waveд洢ֻԿܵ״
+		// ʹзʽ޹
+		unsigned chosen_value = wave.choose_pattern(argmin,
+			counter_uniform(seed, wave.layout.linear(argmin), step, RandomStream::observe,
+				wave.get_sum(argmin)));
+		step++;
 
-		std::uniform_real_distribution<> dis(0, s);
-		double random_value = dis(gen);
-		unsigned chosen_value = nb_patterns - 1;
+		// ߶prepareӦõʼwaveѡе״ǺϷ
+		unsigned z, y, x;
+		wave.layout.coordinates(argmin, z, y, x);
+		wave.for_each_pattern(argmin, [&](unsigned k) {
+			if (k != chosen_value) {
+				propagator.add_to_propagator(z, y, x, k);
+				wave.set(argmin, k, false);
+			}
+		});
 
-		for (unsigned k = 0; k < nb_patterns; k++){
-			random_value -= wave.get(argmin, k) ? patterns_frequencies[k] : 0;
-			if (random_value <= 0){
-				chosen_value = k;
-				break;
+		return to_continue;
+	}
+	/**
+	* Ϊtrueʱ¼ÿһĽãĬϹرգ
+	*/
+	bool record_process = false;
+	std::vector<Array3D<unsigned>> tempprocess;
+	/**
+	* ģ͵ĸ߶ֱӦõwave
+	* ߶ȴһ㿪ʼ㣬״ֻܳ[low, high]ΧڵĲ
+	* ÿһֻһαֹ״û״ֹĲֱ
+	*/
+	void apply_height_bands() noexcept {
+		std::vector<unsigned> banned;
+		for (unsigned y = 0; y < wave.height; y++){
+			const int level = (int)(wave.height - 1 - y);
+			banned.clear();
+			for (unsigned k = 0; k < nb_patterns; k++){
+				if (level < model->highth_limit_low[k] || level > model->highth_limit_high[k]){
+					banned.push_back(k);
+				}
+			}
+			if (banned.empty()){
+				continue;
+			}
+			for (unsigned z = 0; z < wave.depth; z++){
+				for (unsigned x = 0; x < wave.width; x++){
+					for (unsigned k : banned){
+						remove_wave_pattern(z, y, x, k);
+					}
+				}
 			}
 		}
+	}
 
-		unsigned z = argmin / wave.width / wave.height;
-		unsigned y = argmin % (wave.width * wave.height) / wave.width;
-		unsigned x = argmin % (wave.width * wave.height) % wave.width;
-		int start = highth_limit_low[chosen_value];
-		int end = highth_limit_high[chosen_value];
-		int heigh_temp = wave.width - 1 - y;
-
-		if (heigh_temp >= start && heigh_temp <= end){
-			for (unsigned k = 0; k < nb_patterns; k++) {
-
-				if (wave.get(argmin, k) != (k == chosen_value)) {
-					propagator.add_to_propagator(argmin / wave.width / wave.height,
-						argmin % (wave.width * wave.height) / wave.width,
-						argmin % (wave.width * wave.height) % wave.width, k);
-					wave.set(argmin, k, false);
+	/**
+	* ֹ״ûκμھӵķھӵcell
+	* ֻڼ0ʱƳ״ʼΪ0״ᱻƳҪƳ
+	* ģû״ʱκcell
+	*/
+	void ban_unsupported() noexcept {
+		const unsigned extent[3] = { wave.depth, wave.height, wave.width };
+		for (unsigned k = 0; k < nb_patterns; k++){
+			for (unsigned direction = 0; direction < 6; direction++){
+				if (model->initial_compatible[k][direction] != 0){
+					continue;
+				}
+				// compatible[direction]directionھӣ
+				// ֻûھӵһcellԱ״ƽʱûcell
+				const int delta[3] = { direction_z[direction], direction_y[direction],
+					direction_x[direction] };
+				unsigned min[3], max[3];
+				for (unsigned axis = 0; axis < 3; axis++){
+					min[axis] = (delta[axis] > 0 && !periodic_output) ? 1 : 0;
+					max[axis] = (delta[axis] < 0 && !periodic_output) ? extent[axis] - 1 : extent[axis];
+				}
+				for (unsigned z = min[0]; z < max[0]; z++){
+					for (unsigned y = min[1]; y < max[1]; y++){
+						for (unsigned x = min[2]; x < max[2]; x++){
+							remove_wave_pattern(z, y, x, k);
+						}
+					}
 				}
 			}
 		}
+	}
 
-		return to_continue;
+	/**
+	* ӦóʼԼ߶ƣ
+	* ֮״̬޹أΪձӵи
+	*/
+	void prepare() noexcept {
+		if (prepared){
+			return;
+		}
+		apply_height_bands();
+		ban_unsupported();
+		propagator.propagate(wave);
+		prepared = true;
 	}
-	std::vector<Array3D<unsigned>> tempprocess;
+
 	/**
 	* 㷨ɹĻһ
 	*/
 	std::optional<Array3D<unsigned>> run() noexcept {
+		prepare();
 		while (true){
 			ObserveStatus result = observe();
 			if (result == failure){
@@ -153,15 +243,85 @@ public:
 			else if (result == success) {
 				return wave_to_output();
 			}
-			tempprocess.push_back( wave_to_output());
-			propagator.propagate(wave);
+			if (record_process){
+				tempprocess.push_back(wave_to_output());
+			}
+			// ڵһìֹܴͣٵȵһι۲
+			if (!propagator.propagate(wave)){
+				return std::nullopt;
+			}
 		}
 	}
 
 	/**
-	* waveϢ
+	* waveϢìʱfalse
+	*/
+	bool propagate() noexcept { return propagator.propagate(wave); }
+
+	/**
+	* ӦԼ㣺һƳбֹ״Ȼֻһ
+	* Լ޷㣬صһìܵcell
+	* Լĳߴ״waveʱ޸wavelayer_mismatchΪtrueì
 	*/
-	void propagate() noexcept { propagator.propagate(wave); }
+	std::optional<Contradiction> add_constraints(const ConstraintLayer &layer) noexcept {
+		if (!layer.matches(wave.depth, wave.height, wave.width, nb_patterns)){
+			Contradiction mismatch{ 0, 0, 0 };
+			mismatch.layer_mismatch = true;
+			return mismatch;
+		}
+		for (unsigned i = 0; i < wave.size; i++){
+			unsigned index = wave.layout.from_linear(i);
+			unsigned z, y, x;
+			wave.layout.coordinates(index, z, y, x);
+			const uint8_t *allowed = layer.get(i);
+			wave.for_each_pattern(index, [&](unsigned k){
+				if (!allowed[k]){
+					propagator.add_to_propagator(z, y, x, k);
+				}
+			});
+			wave.restrict(index, allowed);
+		}
+		propagator.propagate(wave);
+		return get_contradiction();
+	}
+
+	/**
+	* صһìܵcell
+	* ìɴݷʱìܵ״ͷ
+	*/
+	std::optional<Contradiction> get_contradiction() const noexcept {
+		if (propagator.get_contradiction()){
+			return propagator.get_contradiction();
+		}
+		int index = wave.get_contradiction_index();
+		if (index < 0){
+			return std::nullopt;
+		}
+		unsigned z, y, x;
+		wave.layout.coordinates(index, z, y, x);
+		return Contradiction{ z, y, x };
+	}
+
+	/**
+	* ÿcellȻܵ״ΪԼ㣨add_constraintsʽͬ
+	*/
+	ConstraintLayer get_domains() const noexcept {
+		ConstraintLayer layer(wave.depth, wave.height, wave.width, nb_patterns);
+		for (unsigned i = 0; i < wave.size; i++){
+			unsigned index = wave.layout.from_linear(i);
+			for (unsigned k = 0; k < nb_patterns; k++){
+				layer.allowed.data[i * nb_patterns + k] = wave.get(index, k);
+			}
+		}
+		return layer;
+	}
+
+	/**
+	* waveʵʹõзʽߴ粻4ıʱLayout::brick˻Layout::linear
+	*/
+	Layout get_layout() const noexcept {
+		return wave.layout.layout;
+	}
 
 	/**
 	* Ƴcelli,j,kͼ
@@ -0,0 +1,67 @@
+#pragma once
+#ifndef WFC_HILBERT_HPP_
+#define WFC_HILBERT_HPP_
+
+#include <algorithm>
+#include <vector>
+
+/**
+* Convert the distance d along a Hilbert curve of n dimensions and order bits
+* to the coordinates x[0..n-1] (Skilling's transposed representation).
+*/
+inline void hilbert_to_axes(unsigned d, unsigned bits, unsigned n, unsigned *x) noexcept {
+	for (unsigned i = 0; i < n; i++) {
+		x[i] = 0;
+	}
+	for (unsigned b = 0; b < bits; b++) {
+		for (unsigned i = 0; i < n; i++) {
+			x[i] |= ((d >> (b * n + n - 1 - i)) & 1) << b;
+		}
+	}
+
+	// Gray decode.
+	unsigned t = x[n - 1] >> 1;
+	for (unsigned i = n - 1; i > 0; i--) {
+		x[i] ^= x[i - 1];
+	}
+	x[0] ^= t;
+
+	// Undo the rotations and reflections of the sub-curves.
+	for (unsigned q = 2; q != (1u << bits); q <<= 1) {
+		unsigned p = q - 1;
+		for (unsigned i = n; i-- > 0;) {
+			if (x[i] & q) {
+				x[0] ^= p;
+			}
+			else {
+				t = (x[0] ^ x[i]) & p;
+				x[0] ^= t;
+				x[i] ^= t;
+			}
+		}
+	}
+}
+
+/**
+* Return the cells (x + y * width + z * width * height) of a wave in the order
+* of a Hilbert curve covering the smallest enclosing power of two cube.
+*/
+inline std::vector<unsigned> hilbert_order(unsigned height, unsigned width,
+	unsigned depth) noexcept {
+	unsigned bits = 1;
+	while ((1u << bits) < std::max({ height, width, depth })) {
+		bits++;
+	}
+	std::vector<unsigned> order;
+	order.reserve(height * width * depth);
+	for (unsigned d = 0; d < (1u << (3 * bits)); d++) {
+		unsigned x[3];
+		hilbert_to_axes(d, bits, 3, x);
+		if (x[0] < width && x[1] < height && x[2] < depth) {
+			order.push_back(x[0] + x[1] * width + x[2] * width * height);
+		}
+	}
+	return order;
+}
+
+#endif // WFC_HILBERT_HPP_
@@ -0,0 +1,254 @@
+#pragma once
+#ifndef WFC_ID_GRID_HPP_
+#define WFC_ID_GRID_HPP_
+
+#include <algorithm>
+#include <limits.h>
+#include <optional>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+#include "array3D.hpp"
+
+/**
+* The header of an id grid file (see write_id_grid). It is a plain struct of
+* fixed size types, read and written as is, so a memory mapped file can be
+* used through a pointer to its first byte. The table and the ids start at
+* offsets aligned on 64 bytes; uncompressed ids are stored in the order of
+* Array3D::data, so a mapped file is directly a packed array of ids.
+*/
+struct IdGridHeader {
+	char magic[4];	// "WFCG"
+	uint32_t version;
+	uint32_t height;	// The sizes of the Array3D: i, j and k.
+	uint32_t width;
+	uint32_t depth;
+	uint8_t id_bytes;	// 1, 2 or 4 bytes per id.
+	uint8_t compression;	// IdGridCompression.
+	uint16_t reserved;
+	uint32_t table_size;	// The number of entries of the oriented tile table.
+	uint32_t reserved2;
+	uint64_t table_offset;	// table_size pairs (tile, orientation) of uint32.
+	uint64_t ids_offset;
+	uint64_t ids_size;	// In bytes.
+};
+
+/**
+* The encodings of the ids of an id grid file.
+*/
+enum IdGridCompression : uint8_t {
+	id_grid_raw = 0,	// The ids, id_bytes each.
+	id_grid_rle = 1	// Runs of a uint32 length followed by an id of id_bytes.
+};
+
+/**
+* Return the number of bytes needed to store every id of ids.
+*/
+inline uint8_t id_grid_bytes(const Array3D<unsigned> &ids) noexcept {
+	unsigned max_id = 0;
+	for (unsigned id : ids.data) {
+		max_id = max_id < id ? id : max_id;
+	}
+	return max_id < (1u << 8) ? 1 : max_id < (1u << 16) ? 2 : 4;
+}
+
+/**
+* Move file to offset, which can be above 2 GB: fseek takes a long, which
+* only has 32 bits on Windows.
+* Return false if the offset can't be reached.
+*/
+inline bool id_grid_seek(FILE *file, uint64_t offset) noexcept {
+#ifdef _WIN32
+	if (offset > (uint64_t)INT64_MAX) {
+		return false;
+	}
+	return _fseeki64(file, (int64_t)offset, SEEK_SET) == 0;
+#else
+	if ((uint64_t)(off_t)offset != offset || (off_t)offset < 0) {
+		return false;
+	}
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+/**
+* Write the id grid ids to path, with 1, 2 or 4 bytes per id depending on its
+* largest id, and optionally run-length encoded. table is usually
+* TilingModel::id_to_oriented_tile, so that the ids can be read without the
+* model. The ids are encoded in memory and written after the header with a
+* single fwrite.
+* Return false if the file can't be written.
+*/
+inline bool write_id_grid(const std::string &path, const Array3D<unsigned> &ids,
+	bool compress = false,
+	const std::vector<std::pair<unsigned, unsigned>> *table = nullptr) noexcept {
+	if (table && table->size() > UINT32_MAX) {
+		return false;
+	}
+	auto align = [](uint64_t offset) { return (offset + 63) / 64 * 64; };
+	IdGridHeader header = {};
+	memcpy(header.magic, "WFCG", 4);
+	header.version = 1;
+	header.height = ids.height;
+	header.width = ids.width;
+	header.depth = ids.depth;
+	header.id_bytes = id_grid_bytes(ids);
+	header.compression = compress ? id_grid_rle : id_grid_raw;
+	header.table_size = table ? (uint32_t)table->size() : 0;
+	header.table_offset = align(sizeof(IdGridHeader));
+	header.ids_offset = align(header.table_offset +
+		(uint64_t)header.table_size * 2 * sizeof(uint32_t));
+
+	std::vector<uint8_t> ids_data;
+	const unsigned bytes = header.id_bytes;
+	// The ids are little endian, the byte order of every target of the project.
+	auto push_id = [&](unsigned id) {
+		ids_data.insert(ids_data.end(), (const uint8_t *)&id, (const uint8_t *)&id + bytes);
+	};
+	if (compress) {
+		for (size_t i = 0; i < ids.data.size();) {
+			size_t end = i + 1;
+			while (end < ids.data.size() && ids.data[end] == ids.data[i] &&
+				end - i < UINT32_MAX) {
+				end++;
+			}
+			uint32_t length = (uint32_t)(end - i);
+			ids_data.insert(ids_data.end(), (const uint8_t *)&length,
+				(const uint8_t *)&length + sizeof(length));
+			push_id(ids.data[i]);
+			i = end;
+		}
+	}
+	else if (bytes != sizeof(unsigned)) {
+		ids_data.resize(ids.data.size() * bytes);
+		for (size_t i = 0; i < ids.data.size(); i++) {
+			memcpy(&ids_data[i * bytes], &ids.data[i], bytes);
+		}
+	}
+	// Uncompressed 4 bytes ids are written in place.
+	const bool in_place = !compress && bytes == sizeof(unsigned);
+	const uint8_t *ids_bytes = in_place ? (const uint8_t *)ids.data.data() : ids_data.data();
+	header.ids_size = in_place ? ids.data.size() * sizeof(unsigned) : ids_data.size();
+
+	// The header, the table and the padding before the ids.
+	std::vector<uint8_t> prefix(header.ids_offset, 0);
+	memcpy(prefix.data(), &header, sizeof(header));
+	for (uint32_t t = 0; t < header.table_size; t++) {
+		const uint32_t entry[2] = { (*table)[t].first, (*table)[t].second };
+		memcpy(&prefix[header.table_offset + t * sizeof(entry)], entry, sizeof(entry));
+	}
+
+	FILE *file = fopen(path.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+	bool ok = fwrite(prefix.data(), 1, prefix.size(), file) == prefix.size() &&
+		fwrite(ids_bytes, 1, header.ids_size, file) == header.ids_size;
+	return fclose(file) == 0 && ok;
+}
+
+/**
+* Read an id grid from file (see the other read_id_grid).
+*/
+inline std::optional<Array3D<unsigned>> read_id_grid(FILE *file,
+	std::vector<std::pair<unsigned, unsigned>> *table) noexcept {
+	IdGridHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1) {
+		return std::nullopt;
+	}
+	const unsigned bytes = header.id_bytes;
+	if (memcmp(header.magic, "WFCG", 4) != 0 || header.version != 1 ||
+		(bytes != 1 && bytes != 2 && bytes != 4)) {
+		return std::nullopt;
+	}
+	// The sizes are checked in 64 bits before anything is allocated: Array3D
+	// indexes its cells with unsigned, and a raw grid has bytes per cell while
+	// a run of a rle grid covers at least one cell.
+	const uint64_t layer_cells = (uint64_t)header.height * header.width;
+	const uint64_t cells = layer_cells * header.depth;
+	if (layer_cells > UINT_MAX || cells > UINT_MAX ||
+		(header.compression == id_grid_raw && header.ids_size != cells * bytes) ||
+		(header.compression == id_grid_rle &&
+			header.ids_size > cells * (sizeof(uint32_t) + bytes)) ||
+		header.ids_size > SIZE_MAX) {
+		return std::nullopt;
+	}
+
+	if (table) {
+		std::vector<uint32_t> entries((size_t)header.table_size * 2);
+		if (!id_grid_seek(file, header.table_offset) ||
+			fread(entries.data(), sizeof(uint32_t), entries.size(), file) != entries.size()) {
+			return std::nullopt;
+		}
+		table->clear();
+		for (uint32_t t = 0; t < header.table_size; t++) {
+			table->push_back({ entries[2 * t], entries[2 * t + 1] });
+		}
+	}
+
+	Array3D<unsigned> ids(header.height, header.width, header.depth, 0);
+	if (!id_grid_seek(file, header.ids_offset)) {
+		return std::nullopt;
+	}
+	if (header.compression == id_grid_raw) {
+		// 4 bytes ids are read in place, narrower ones are widened.
+		if (bytes == sizeof(unsigned)) {
+			if (fread(ids.data.data(), bytes, ids.data.size(), file) != ids.data.size()) {
+				return std::nullopt;
+			}
+			return ids;
+		}
+	}
+	else if (header.compression != id_grid_rle) {
+		return std::nullopt;
+	}
+	std::vector<uint8_t> data((size_t)header.ids_size);
+	if (fread(data.data(), 1, data.size(), file) != data.size()) {
+		return std::nullopt;
+	}
+	if (header.compression == id_grid_raw) {
+		for (size_t i = 0; i < ids.data.size(); i++) {
+			memcpy(&ids.data[i], &data[i * bytes], bytes);
+		}
+		return ids;
+	}
+	size_t i = 0;
+	for (size_t offset = 0; offset + sizeof(uint32_t) + bytes <= data.size();
+		offset += sizeof(uint32_t) + bytes) {
+		uint32_t length;
+		unsigned id = 0;
+		memcpy(&length, &data[offset], sizeof(length));
+		memcpy(&id, &data[offset + sizeof(length)], bytes);
+		if (length > ids.data.size() - i) {
+			return std::nullopt;
+		}
+		std::fill(ids.data.begin() + i, ids.data.begin() + i + length, id);
+		i += length;
+	}
+	if (i != ids.data.size()) {
+		return std::nullopt;
+	}
+	return ids;
+}
+
+/**
+* Read an id grid written by write_id_grid. If table isn't null, it receives
+* the oriented tile table of the file. Return nullopt if the file can't be
+* read or isn't a valid id grid.
+*/
+inline std::optional<Array3D<unsigned>> read_id_grid(const std::string &path,
+	std::vector<std::pair<unsigned, unsigned>> *table = nullptr) noexcept {
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file) {
+		return std::nullopt;
+	}
+	std::optional<Array3D<unsigned>> ids = read_id_grid(file, table);
+	fclose(file);
+	return ids;
+}
+
+#endif // WFC_ID_GRID_HPP_
@@ -0,0 +1,365 @@
+#pragma once
+#ifndef WFC_MESH_ASSEMBLY_HPP_
+#define WFC_MESH_ASSEMBLY_HPP_
+
+#include <algorithm>
+#include <array>
+#include <math.h>
+#include <stdint.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "array3D.hpp"
+#include "cube_symmetry.hpp"
+#include "model.hpp"
+
+/**
+* The sizes of a mesh before and after assemble_mesh.
+*/
+struct MeshAssemblyStats {
+	size_t vertices_in = 0;	// The vertices of the concatenated tile meshes.
+	size_t vertices_out = 0;	// The vertices left once welded.
+	size_t normals_in = 0;
+	size_t normals_out = 0;
+	size_t faces_in = 0;
+	size_t faces_out = 0;	// The faces left once the internal faces are culled.
+
+	/**
+	* The size in memory of the concatenated mesh and of the assembled mesh.
+	*/
+	size_t bytes_in() const noexcept {
+		return vertices_in * sizeof(POINT3) + normals_in * sizeof(normals) +
+			faces_in * sizeof(Face);
+	}
+	size_t bytes_out() const noexcept {
+		return vertices_out * sizeof(POINT3) + normals_out * sizeof(normals) +
+			faces_out * sizeof(Face);
+	}
+};
+
+/**
+* A 3D vector rounded to a multiple of epsilon: the vectors with the same key
+* are welded.
+*/
+struct WeldKey {
+	int64_t x, y, z;
+
+	WeldKey(double x, double y, double z, double inverse_epsilon) noexcept
+		: x(llround(x * inverse_epsilon)), y(llround(y * inverse_epsilon)),
+		z(llround(z * inverse_epsilon)) {}
+
+	bool operator==(const WeldKey &key) const noexcept {
+		return x == key.x && y == key.y && z == key.z;
+	}
+
+	size_t hash() const noexcept {
+		uint64_t h = (uint64_t)x * 0x9e3779b97f4a7c15ull;
+		h ^= (uint64_t)y * 0xc2b2ae3d27d4eb4full + (h << 6) + (h >> 2);
+		h ^= (uint64_t)z * 0x165667b19e3779f9ull + (h << 6) + (h >> 2);
+		return (size_t)h;
+	}
+
+	struct Hash {
+		size_t operator()(const WeldKey &key) const noexcept { return key.hash(); }
+	};
+};
+
+/**
+* A tile mesh with its orientation: the element of cube_elements applied to it
+* when it is assembled (see TransformedPoint).
+*/
+struct OrientedMesh {
+	const ObjModel *mesh;
+	unsigned transform;
+};
+
+/**
+* A spatial hash of 3D vectors: two vectors with the same WeldKey get the same
+* id. Ids are given in order of first insertion.
+*/
+class VectorWelder {
+private:
+	double inverse_epsilon;
+	std::unordered_map<WeldKey, unsigned, WeldKey::Hash> ids;
+
+public:
+	VectorWelder(double epsilon) noexcept : inverse_epsilon(1.0 / epsilon) {}
+
+	/**
+	* Return the id of (x, y, z), and set is_new if the vector is new.
+	*/
+	unsigned weld(double x, double y, double z, bool &is_new) {
+		auto result = ids.insert({ WeldKey(x, y, z, inverse_epsilon), (unsigned)ids.size() });
+		is_new = result.second;
+		return result.first->second;
+	}
+
+	size_t size() const noexcept { return ids.size(); }
+};
+
+/**
+* Split [0, size) in nb_threads contiguous ranges and call
+* f(begin, end, thread) on each of them, one per thread.
+*/
+template <typename F>
+inline void for_each_range(unsigned nb_threads, size_t size, const F &f) {
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < nb_threads; t++) {
+		threads.emplace_back([&, t]() { f(size * t / nb_threads, size * (t + 1) / nb_threads, t); });
+	}
+	f(0, size / nb_threads, 0);
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+}
+
+/**
+* Return the exclusive prefix sum of counts, with the total as last element.
+*/
+inline std::vector<size_t> exclusive_prefix_sum(const std::vector<size_t> &counts) noexcept {
+	std::vector<size_t> offsets(counts.size() + 1, 0);
+	for (size_t i = 0; i < counts.size(); i++) {
+		offsets[i + 1] = offsets[i] + counts[i];
+	}
+	return offsets;
+}
+
+/**
+* Keep the elements of items whose flag is set, in order, on nb_threads
+* threads: every range counts its kept elements, and the prefix sum of the
+* counts gives where it writes them.
+*/
+template <typename T>
+inline void compact(std::vector<T> &items, const std::vector<uint8_t> &keep,
+	unsigned nb_threads) {
+	std::vector<size_t> kept(nb_threads, 0);
+	for_each_range(nb_threads, items.size(), [&](size_t begin, size_t end, unsigned t) {
+		kept[t] = std::count(keep.begin() + begin, keep.begin() + end, 1);
+	});
+	std::vector<size_t> offsets = exclusive_prefix_sum(kept);
+	std::vector<T> result(offsets.back());
+	for_each_range(nb_threads, items.size(), [&](size_t begin, size_t end, unsigned t) {
+		size_t out = offsets[t];
+		for (size_t i = begin; i < end; i++) {
+			if (keep[i]) {
+				result[out++] = items[i];
+			}
+		}
+	});
+	items.swap(result);
+}
+
+/**
+* Build the mesh of a tiling: meshes[ids.get(i, j, k)] is transformed and
+* translated by (i, j, k), as in the concatenation of the tile meshes, but
+* - the vertices closer than epsilon, mostly the ones on the shared sides of
+*   neighbor cells, are welded with a spatial hash,
+* - the normals and texture coordinates are shared between every cell,
+* - two faces of neighbor cells on the same welded vertices with opposite
+*   windings, i.e. a side sealed between two solid tiles, are both removed.
+*   Faces back to back inside a tile (a two sided wall) are kept, and so are
+*   sides meshed with different triangles by the two tiles.
+*
+* The work is split on nb_threads threads (0 for one per core). The vertex
+* and face counts of every cell come from its mesh, and their exclusive
+* prefix sum gives where every cell writes in buffers allocated once. The
+* welding and the culling are sharded by the hash of the keys, every shard
+* keeping the order of the cells, so the result doesn't depend on nb_threads.
+*/
+inline ObjModel assemble_mesh(const Array3D<unsigned> &ids,
+	const std::vector<OrientedMesh> &meshes, MeshAssemblyStats *stats = nullptr,
+	double epsilon = 1e-5, unsigned nb_threads = 0) {
+	MeshAssemblyStats local_stats;
+	if (!stats) {
+		stats = &local_stats;
+	}
+	*stats = MeshAssemblyStats();
+	if (nb_threads == 0) {
+		nb_threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	const double inverse_epsilon = 1.0 / epsilon;
+	ObjModel tiling;
+
+	// The normals and texture coordinates of every mesh, shared once.
+	VectorWelder normal_welder(epsilon);
+	VectorWelder texture_welder(epsilon);
+	std::vector<std::vector<unsigned>> normal_ids(meshes.size());
+	std::vector<std::vector<unsigned>> texture_ids(meshes.size());
+	bool is_new;
+	for (unsigned id = 0; id < meshes.size(); id++) {
+		for (const normals &normal : meshes[id].mesh->VN) {
+			normals n = TransformedNormal(normal, meshes[id].transform);
+			normal_ids[id].push_back(normal_welder.weld(n.NX, n.NY, n.NZ, is_new));
+			if (is_new) {
+				tiling.VN.push_back(n);
+			}
+		}
+		for (const Texture &t : meshes[id].mesh->VT) {
+			texture_ids[id].push_back(texture_welder.weld(t.TU, t.TV, 0, is_new));
+			if (is_new) {
+				tiling.VT.push_back(t);
+			}
+		}
+	}
+
+	// Where every cell writes its vertices and faces.
+	const size_t nb_cells = ids.data.size();
+	std::vector<size_t> cell_vertices(nb_cells);
+	std::vector<size_t> cell_faces(nb_cells);
+	for (size_t c = 0; c < nb_cells; c++) {
+		cell_vertices[c] = meshes[ids.data[c]].mesh->V.size();
+		cell_faces[c] = meshes[ids.data[c]].mesh->F.size();
+		stats->normals_in += meshes[ids.data[c]].mesh->VN.size();
+	}
+	std::vector<size_t> vertex_offsets = exclusive_prefix_sum(cell_vertices);
+	std::vector<size_t> face_offsets = exclusive_prefix_sum(cell_faces);
+	stats->vertices_in = vertex_offsets.back();
+	stats->faces_in = face_offsets.back();
+
+	// The concatenation of the translated meshes, with the face vertices
+	// indexing vertices.
+	std::vector<POINT3> vertices(stats->vertices_in);
+	tiling.F.resize(stats->faces_in);
+	std::vector<unsigned> face_cells(stats->faces_in);
+	for_each_range(nb_threads, nb_cells, [&](size_t begin, size_t end, unsigned) {
+		for (size_t c = begin; c < end; c++) {
+			const unsigned id = ids.data[c];
+			const ObjModel &mesh = *meshes[id].mesh;
+			const bool mirrored = cube_elements[meshes[id].transform].mirrored();
+			const double i = c / ((size_t)ids.width * ids.depth);
+			const double j = c / ids.depth % ids.width;
+			const double k = c % ids.depth;
+			POINT3 *v = vertices.data() + vertex_offsets[c];
+			for (const POINT3 &vertex : mesh.V) {
+				POINT3 p = TransformedPoint(vertex, meshes[id].transform);
+				*v++ = { p.X + i, p.Y + j, p.Z + k };
+			}
+			Face *face = tiling.F.data() + face_offsets[c];
+			for (const Face &f : mesh.F) {
+				*face = f;
+				for (unsigned m = 0; m < 3; m++) {
+					face->V[m] = (int)(vertex_offsets[c] + f.V[m]);
+					if (!mesh.VN.empty()) {
+						face->N[m] = normal_ids[id][f.N[m]];
+					}
+					if (!mesh.VT.empty()) {
+						face->T[m] = texture_ids[id][f.T[m]];
+					}
+				}
+				// A mirror reverses the winding, which is restored.
+				if (mirrored) {
+					std::swap(face->V[1], face->V[2]);
+					std::swap(face->T[1], face->T[2]);
+					std::swap(face->N[1], face->N[2]);
+				}
+				face++;
+			}
+			std::fill(face_cells.begin() + face_offsets[c],
+				face_cells.begin() + face_offsets[c + 1], (unsigned)c);
+		}
+	});
+
+	// Every vertex is welded to the first vertex with the same key. A thread
+	// only handles the keys of its shard, in order.
+	std::vector<size_t> hashes(vertices.size());
+	for_each_range(nb_threads, vertices.size(), [&](size_t begin, size_t end, unsigned) {
+		for (size_t v = begin; v < end; v++) {
+			hashes[v] = WeldKey(vertices[v].X, vertices[v].Y, vertices[v].Z, inverse_epsilon).hash();
+		}
+	});
+	std::vector<unsigned> first_vertex(vertices.size());
+	for_each_range(nb_threads, nb_threads, [&](size_t shard, size_t, unsigned) {
+		std::unordered_map<WeldKey, unsigned, WeldKey::Hash> first;
+		first.reserve(vertices.size() / nb_threads);
+		for (size_t v = 0; v < vertices.size(); v++) {
+			if (hashes[v] % nb_threads == shard) {
+				first_vertex[v] = first.insert({ WeldKey(vertices[v].X, vertices[v].Y,
+					vertices[v].Z, inverse_epsilon), (unsigned)v }).first->second;
+			}
+		}
+	});
+	std::vector<uint8_t> is_first(vertices.size());
+	for_each_range(nb_threads, vertices.size(), [&](size_t begin, size_t end, unsigned) {
+		for (size_t v = begin; v < end; v++) {
+			is_first[v] = first_vertex[v] == v;
+		}
+	});
+	// The welded vertices are numbered in order of first appearance.
+	std::vector<size_t> first_counts(nb_threads, 0);
+	for_each_range(nb_threads, vertices.size(), [&](size_t begin, size_t end, unsigned t) {
+		first_counts[t] = std::count(is_first.begin() + begin, is_first.begin() + end, 1);
+	});
+	std::vector<size_t> first_offsets = exclusive_prefix_sum(first_counts);
+	std::vector<unsigned> welded(vertices.size());
+	for_each_range(nb_threads, vertices.size(), [&](size_t begin, size_t end, unsigned t) {
+		unsigned next = (unsigned)first_offsets[t];
+		for (size_t v = begin; v < end; v++) {
+			if (is_first[v]) {
+				welded[v] = next++;
+			}
+		}
+	});
+	for_each_range(nb_threads, tiling.F.size(), [&](size_t begin, size_t end, unsigned) {
+		for (size_t f = begin; f < end; f++) {
+			for (unsigned m = 0; m < 3; m++) {
+				tiling.F[f].V[m] = welded[first_vertex[tiling.F[f].V[m]]];
+			}
+		}
+	});
+	compact(vertices, is_first, nb_threads);
+	tiling.V.swap(vertices);
+
+	// A face is keyed by its vertices starting from the smallest one, and
+	// its winding is whether the two others are increasing.
+	auto face_key = [](const Face &face, bool &winding) {
+		unsigned first = std::min_element(face.V, face.V + 3) - face.V;
+		unsigned b = face.V[(first + 1) % 3];
+		unsigned c = face.V[(first + 2) % 3];
+		winding = b < c;
+		return std::array<unsigned, 3>{ (unsigned)face.V[first], std::min(b, c), std::max(b, c) };
+	};
+	struct ArrayHash {
+		size_t operator()(const std::array<unsigned, 3> &a) const noexcept {
+			return ((size_t)a[0] * 0x9e3779b97f4a7c15ull) ^ ((size_t)a[1] << 21) ^ a[2];
+		}
+	};
+	// A face is culled with the first open face of another cell with the same
+	// key and the other winding. The faces of a key are all in one shard, and
+	// the open faces of a key are a list linked by next_open.
+	std::vector<uint8_t> keep(tiling.F.size(), 1);
+	std::vector<size_t> next_open(tiling.F.size());
+	const size_t none = ~(size_t)0;
+	for_each_range(nb_threads, nb_threads, [&](size_t shard, size_t, unsigned) {
+		std::unordered_map<std::array<unsigned, 3>, size_t, ArrayHash> open_faces;
+		open_faces.reserve(tiling.F.size() / nb_threads);
+		for (size_t f = 0; f < tiling.F.size(); f++) {
+			bool winding;
+			std::array<unsigned, 3> key = face_key(tiling.F[f], winding);
+			if (ArrayHash()(key) % nb_threads != shard) {
+				continue;
+			}
+			auto it = open_faces.insert({ key, none }).first;
+			for (size_t *open = &it->second; *open != none; open = &next_open[*open]) {
+				bool other_winding;
+				face_key(tiling.F[*open], other_winding);
+				if (other_winding != winding && face_cells[*open] != face_cells[f]) {
+					keep[f] = keep[*open] = 0;
+					*open = next_open[*open];
+					break;
+				}
+			}
+			if (keep[f]) {
+				next_open[f] = it->second;
+				it->second = f;
+			}
+		}
+	});
+	compact(tiling.F, keep, nb_threads);
+
+	stats->vertices_out = tiling.V.size();
+	stats->normals_out = tiling.VN.size();
+	stats->faces_out = tiling.F.size();
+	return tiling;
+}
+
+#endif // WFC_MESH_ASSEMBLY_HPP_
@@ -7,6 +7,7 @@
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include "cube_symmetry.hpp"
 
 using namespace std;
 
@@ -143,13 +144,20 @@ void WriteModel(const string aim_path, ObjModel &temp) {
 }
 
 
-ObjModel RotatedModel(ObjModel &temp) {
-	for (unsigned i = 0; i < temp.V.size(); i++) {
-		auto m = temp.V[i].X;
-		temp.V[i].X = temp.V[i].Z;
-		temp.V[i].Z = -1 * m;
-	}
-	return temp;
+/**
+* ԵӦı任cube_elements[transform]cube_symmetry.hppשķģʱӦ
+*/
+inline POINT3 TransformedPoint(POINT3 p, unsigned transform) {
+	std::array<double, 3> q = cube_elements[transform].apply(p.X, p.Y, p.Z);
+	return { q[0], q[1], q[2] };
+}
+
+/**
+* ԷӦı任TransformedPointͬ
+*/
+inline normals TransformedNormal(normals n, unsigned transform) {
+	std::array<double, 3> q = cube_elements[transform].apply(n.NX, n.NY, n.NZ);
+	return { q[0], q[1], q[2] };
 }
 
 
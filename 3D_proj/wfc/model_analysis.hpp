@@ -0,0 +1,224 @@
+#pragma once
+#ifndef WFC_MODEL_ANALYSIS_HPP_
+#define WFC_MODEL_ANALYSIS_HPP_
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string.h>
+#include <vector>
+#include "compiled_model.hpp"
+#include "constraint_layer.hpp"
+#include "genericWFC.hpp"
+
+/**
+* The result of the static analysis of a compiled model for a given wave size
+* and boundary mode (see analyze_model).
+*/
+struct ModelAnalysis {
+	/**
+	* The arc-consistent domain of every cell: the patterns left once the
+	* height bands and the neighbor rules have been propagated, before any
+	* observation.
+	*/
+	ConstraintLayer initial_domains;
+
+	/**
+	* Set if the model can't fill a wave of this size at all.
+	*/
+	std::optional<Contradiction> contradiction;
+
+	/**
+	* pattern_class[pattern] is the pattern of the reduced model standing for
+	* pattern, or -1 if pattern can't appear in any cell (a dead pattern).
+	*/
+	std::vector<int> pattern_class;
+
+	/**
+	* The patterns of the original model merged into each pattern of the
+	* reduced model.
+	*/
+	std::vector<std::vector<unsigned>> class_patterns;
+
+	/**
+	* The reduced model: the dead patterns are removed, and the patterns with
+	* the same neighbors, weight, height band and initial domain are merged
+	* into one pattern whose weight is the sum of theirs.
+	*/
+	std::shared_ptr<const CompiledModel> reduced;
+
+	/**
+	* The number of patterns that can't appear in any cell.
+	*/
+	unsigned nb_dead_patterns() const noexcept {
+		return std::count(pattern_class.begin(), pattern_class.end(), -1);
+	}
+
+	/**
+	* Return a human readable summary of the analysis.
+	*/
+	std::string report() const {
+		std::ostringstream out;
+		unsigned nb_patterns = pattern_class.size();
+		size_t possible = std::count(initial_domains.allowed.data.begin(),
+			initial_domains.allowed.data.end(), 1);
+		out << "patterns: " << nb_patterns << ", reduced: " << class_patterns.size() << "\n";
+		out << "initial domains: " << possible << " of "
+			<< initial_domains.allowed.data.size() << " (cell, pattern) pairs possible\n";
+		if (contradiction) {
+			out << "unsatisfiable: cell (" << contradiction->i << ", " << contradiction->j
+				<< ", " << contradiction->k << ") has no possible pattern\n";
+			return out.str();
+		}
+		out << "dead patterns (" << nb_dead_patterns() << "):";
+		for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+			if (pattern_class[pattern] < 0) {
+				out << " " << pattern;
+			}
+		}
+		out << "\nmerged patterns:";
+		for (const std::vector<unsigned> &patterns : class_patterns) {
+			if (patterns.size() > 1) {
+				out << " {";
+				for (unsigned k = 0; k < patterns.size(); k++) {
+					out << (k ? " " : "") << patterns[k];
+				}
+				out << "}";
+			}
+		}
+		out << "\n";
+		return out.str();
+	}
+};
+
+/**
+* Analyze model for a wave of the given size and boundary mode, before any
+* run. The initial domains are given by the propagation of a fresh
+* genericWFC. A pattern absent from every domain is dead. Two live patterns
+* are merged when they have the same weight, the same height band, the same
+* initial domain, and the same live neighbors (and are the live neighbors of
+* the same patterns) in every direction: the solver can't tell them apart.
+* The reduced model is only valid for waves of this size and boundary mode.
+*/
+inline ModelAnalysis analyze_model(std::shared_ptr<const CompiledModel> model,
+	unsigned wave_depth, unsigned wave_height, unsigned wave_width,
+	bool periodic_output) {
+	const unsigned nb_patterns = model->nb_patterns;
+	genericWFC wfc(periodic_output, 0, model, wave_depth, wave_height, wave_width);
+	wfc.prepare();
+	ModelAnalysis analysis{ wfc.get_domains(), wfc.get_contradiction(), {}, {}, model };
+	const std::vector<uint8_t> &domains = analysis.initial_domains.allowed.data;
+	const size_t nb_cells = domains.size() / nb_patterns;
+
+	if (analysis.contradiction) {
+		for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+			analysis.pattern_class.push_back(pattern);
+			analysis.class_patterns.push_back({ pattern });
+		}
+		return analysis;
+	}
+
+	std::vector<bool> alive(nb_patterns, false);
+	for (size_t i = 0; i < domains.size(); i++) {
+		if (domains[i]) {
+			alive[i % nb_patterns] = true;
+		}
+	}
+
+	// incoming[pattern][direction] contains the live patterns having pattern
+	// as a neighbor in direction.
+	std::vector<std::array<std::vector<unsigned>, 6>> incoming(nb_patterns);
+	for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+		if (!alive[pattern]) {
+			continue;
+		}
+		for (unsigned direction = 0; direction < 6; direction++) {
+			for (const unsigned *it = model->neighbors_begin(pattern, direction),
+				*it_end = model->neighbors_end(pattern, direction); it < it_end; ++it) {
+				incoming[*it][direction].push_back(pattern);
+			}
+		}
+	}
+
+	auto same_domain = [&](unsigned pattern1, unsigned pattern2) {
+		for (size_t i = 0; i < nb_cells; i++) {
+			if (domains[i * nb_patterns + pattern1] != domains[i * nb_patterns + pattern2]) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	// The classes of every signature, in the order of their first pattern.
+	std::map<std::vector<uint64_t>, std::vector<unsigned>> signatures;
+	analysis.pattern_class.assign(nb_patterns, -1);
+	for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+		if (!alive[pattern]) {
+			continue;
+		}
+		std::vector<uint64_t> signature(4);
+		memcpy(&signature[0], &model->patterns_frequencies[pattern], sizeof(double));
+		signature[1] = (uint64_t)(int64_t)model->highth_limit_low[pattern];
+		signature[2] = (uint64_t)(int64_t)model->highth_limit_high[pattern];
+		for (unsigned direction = 0; direction < 6; direction++) {
+			signature.push_back(~(uint64_t)0);
+			size_t begin = signature.size();
+			for (const unsigned *it = model->neighbors_begin(pattern, direction),
+				*it_end = model->neighbors_end(pattern, direction); it < it_end; ++it) {
+				if (alive[*it]) {
+					signature.push_back(*it);
+				}
+			}
+			std::sort(signature.begin() + begin, signature.end());
+			signature.push_back(~(uint64_t)0);
+			signature.insert(signature.end(), incoming[pattern][direction].begin(),
+				incoming[pattern][direction].end());
+		}
+
+		std::vector<unsigned> &classes = signatures[signature];
+		for (unsigned c : classes) {
+			if (same_domain(analysis.class_patterns[c][0], pattern)) {
+				analysis.pattern_class[pattern] = c;
+				analysis.class_patterns[c].push_back(pattern);
+				break;
+			}
+		}
+		if (analysis.pattern_class[pattern] < 0) {
+			analysis.pattern_class[pattern] = analysis.class_patterns.size();
+			classes.push_back(analysis.class_patterns.size());
+			analysis.class_patterns.push_back({ pattern });
+		}
+	}
+
+	const unsigned nb_classes = analysis.class_patterns.size();
+	std::vector<double> frequencies(nb_classes, 0);
+	std::vector<int> low(nb_classes);
+	std::vector<int> high(nb_classes);
+	CompiledModel::PropagatorState propagator(nb_classes);
+	for (unsigned c = 0; c < nb_classes; c++) {
+		unsigned representative = analysis.class_patterns[c][0];
+		for (unsigned pattern : analysis.class_patterns[c]) {
+			frequencies[c] += model->patterns_frequencies[pattern];
+		}
+		low[c] = model->highth_limit_low[representative];
+		high[c] = model->highth_limit_high[representative];
+		for (unsigned direction = 0; direction < 6; direction++) {
+			std::vector<unsigned> &neighbors = propagator[c][direction];
+			for (const unsigned *it = model->neighbors_begin(representative, direction),
+				*it_end = model->neighbors_end(representative, direction); it < it_end; ++it) {
+				if (alive[*it]) {
+					neighbors.push_back(analysis.pattern_class[*it]);
+				}
+			}
+			std::sort(neighbors.begin(), neighbors.end());
+			neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+		}
+	}
+	analysis.reduced = CompiledModel::compile(frequencies, propagator, low, high);
+	return analysis;
+}
+
+#endif // WFC_MODEL_ANALYSIS_HPP_
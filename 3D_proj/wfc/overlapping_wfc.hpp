@@ -0,0 +1,397 @@
+#pragma once
+#ifndef WFC_OVERLAPPING_WFC_HPP_
+#define WFC_OVERLAPPING_WFC_HPP_
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "array3D.hpp"
+#include "compiled_model.hpp"
+#include "constraint_layer.hpp"
+#include "direction.hpp"
+#include "genericWFC.hpp"
+
+/**
+* Options needed to use the 3D overlapping wfc. The coordinates follow the
+* output of genericWFC: i is z, j is y (the vertical axis) and k is x.
+*/
+struct OverlappingWFC3DOptions {
+	bool periodic_input;	// True if the input is toric.
+	bool periodic_output;	// True if the output is toric.
+	unsigned out_depth;	// The size of the output along z, in voxels.
+	unsigned out_height;	// The size of the output along y, in voxels.
+	unsigned out_width;	// The size of the output along x, in voxels.
+	unsigned pattern_size;	// The size of the side of the cubic patterns.
+	Heuristic heuristic = Heuristic::entropy;	// The choice of the next cell.
+	Layout layout = Layout::linear;	// The order of the cells in memory.
+
+	/**
+	* Get the wave size along an output size given these options.
+	*/
+	unsigned get_wave_size(unsigned out_size) const noexcept {
+		return periodic_output ? out_size : out_size - pattern_size + 1;
+	}
+	unsigned get_wave_depth() const noexcept { return get_wave_size(out_depth); }
+	unsigned get_wave_height() const noexcept { return get_wave_size(out_height); }
+	unsigned get_wave_width() const noexcept { return get_wave_size(out_width); }
+};
+
+/**
+* The immutable part of a 3D overlapping model, shared by every
+* OverlappingWFC3D built on the same input and options.
+*/
+template <typename T> struct OverlappingModel3D {
+	std::vector<Array3D<T>> patterns;
+	std::shared_ptr<const CompiledModel> compiled;
+};
+
+/**
+* Read a raw voxel volume: three 32 bits unsigned integers, the sizes along
+* z, y and x, then one byte per voxel, x varying fastest.
+* Return nullopt if the file can't be read.
+*/
+inline std::optional<Array3D<uint8_t>> read_voxels(const std::string &path) noexcept {
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file) {
+		return std::nullopt;
+	}
+	uint32_t sizes[3];
+	std::optional<Array3D<uint8_t>> volume;
+	if (fread(sizes, sizeof(uint32_t), 3, file) == 3) {
+		volume.emplace(sizes[0], sizes[1], sizes[2]);
+		if (fread(volume->data.data(), 1, volume->data.size(), file) != volume->data.size()) {
+			volume.reset();
+		}
+	}
+	fclose(file);
+	return volume;
+}
+
+/**
+* Write a voxel volume in the format of read_voxels.
+*/
+inline bool write_voxels(const std::string &path, const Array3D<uint8_t> &volume) noexcept {
+	FILE *file = fopen(path.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+	const uint32_t sizes[3] = { volume.height, volume.width, volume.depth };
+	bool ok = fwrite(sizes, sizeof(uint32_t), 3, file) == 3 &&
+		fwrite(volume.data.data(), 1, volume.data.size(), file) == volume.data.size();
+	fclose(file);
+	return ok;
+}
+
+/**
+* Class generating a new voxel volume with the overlapping WFC algorithm, the
+* 3D counterpart of OverlappingWFC. The patterns are the N x N x N blocks of
+* the input, and two patterns can be placed next to each other when they
+* agree on their N x N x (N - 1) overlap.
+*/
+template <typename T> class OverlappingWFC3D {
+private:
+	/**
+	* Options needed by the algorithm.
+	*/
+	OverlappingWFC3DOptions options;
+
+	/**
+	* The patterns extracted from the input, and the compiled model.
+	*/
+	std::shared_ptr<const OverlappingModel3D<T>> model;
+
+	/**
+	* The underlying generic WFC algorithm.
+	*/
+	genericWFC wfc;
+
+	/**
+	* The bases of the polynomial hashes along i, j and k.
+	*/
+	static constexpr uint64_t hash_bases[3] = { 0x9e3779b97f4a7c15ull,
+		0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull };
+
+	/**
+	* Roll a hash over windows of size along one axis of the extents[0] x
+	* extents[1] x extents[2] array values: the result has size - 1 less cells
+	* along axis, and the window starting at c along axis hashes to
+	* sum(values[c + t] * base^(size - 1 - t)). Every window costs O(1).
+	*/
+	static std::vector<uint64_t> roll(const std::vector<uint64_t> &values,
+		std::array<unsigned, 3> &extents, unsigned axis, unsigned size) noexcept {
+		const uint64_t base = hash_bases[axis];
+		uint64_t base_power = 1;	// base^(size - 1)
+		for (unsigned t = 1; t < size; t++) {
+			base_power *= base;
+		}
+		std::array<unsigned, 3> rolled = extents;
+		rolled[axis] = extents[axis] - size + 1;
+		const size_t stride[3] = { (size_t)extents[1] * extents[2], extents[2], 1 };
+		const size_t rolled_stride[3] = { (size_t)rolled[1] * rolled[2], rolled[2], 1 };
+		// The two other axes, a line being a run of cells along axis.
+		const unsigned u = axis == 0 ? 1 : 0;
+		const unsigned v = axis == 2 ? 1 : 2;
+		std::vector<uint64_t> result((size_t)rolled[0] * rolled[1] * rolled[2]);
+		for (unsigned a = 0; a < extents[u]; a++) {
+			for (unsigned b = 0; b < extents[v]; b++) {
+				const uint64_t *line = values.data() + a * stride[u] + b * stride[v];
+				uint64_t *out = result.data() + a * rolled_stride[u] + b * rolled_stride[v];
+				uint64_t hash = 0;
+				for (unsigned t = 0; t < size; t++) {
+					hash = hash * base + line[t * stride[axis]];
+				}
+				out[0] = hash;
+				for (unsigned c = 1; c < rolled[axis]; c++) {
+					hash = (hash - line[(c - 1) * stride[axis]] * base_power) * base +
+						line[(c + size - 1) * stride[axis]];
+					out[c * rolled_stride[axis]] = hash;
+				}
+			}
+		}
+		extents = rolled;
+		return result;
+	}
+
+	/**
+	* Return the list of patterns, as well as their number of occurrences.
+	* Every window of the input is hashed by rolling a polynomial hash along
+	* the three axes, so the hashes of all windows cost O(input size) and a
+	* window is only compared voxel by voxel with the patterns of its hash.
+	*/
+	static std::pair<std::vector<Array3D<T>>, std::vector<double>>
+	get_patterns(const Array3D<T> &input, const OverlappingWFC3DOptions &options) noexcept {
+		const unsigned size = options.pattern_size;
+		// A toric input is extended by size - 1 voxels, so that the windows
+		// crossing its borders are ordinary windows.
+		const unsigned extra = options.periodic_input ? size - 1 : 0;
+		std::array<unsigned, 3> extents = { input.height + extra, input.width + extra,
+			input.depth + extra };
+		Array3D<T> volume(extents[0], extents[1], extents[2]);
+		std::vector<uint64_t> hashes(volume.data.size());
+		std::hash<T> hasher;
+		for (unsigned i = 0; i < extents[0]; i++) {
+			for (unsigned j = 0; j < extents[1]; j++) {
+				for (unsigned k = 0; k < extents[2]; k++) {
+					const T &voxel = input.get(i % input.height, j % input.width,
+						k % input.depth);
+					volume.get(i, j, k) = voxel;
+					// The hash is mixed, so that small values don't collide in the sums.
+					hashes[((size_t)i * extents[1] + j) * extents[2] + k] =
+						((uint64_t)hasher(voxel) + 1) * 0xff51afd7ed558ccdull;
+				}
+			}
+		}
+		for (unsigned axis = 3; axis-- > 0;) {
+			hashes = roll(hashes, extents, axis, size);
+		}
+
+		auto same = [&](const Array3D<T> &pattern, unsigned i, unsigned j, unsigned k) {
+			for (unsigned di = 0; di < size; di++) {
+				for (unsigned dj = 0; dj < size; dj++) {
+					for (unsigned dk = 0; dk < size; dk++) {
+						if (!(pattern.get(di, dj, dk) == volume.get(i + di, j + dj, k + dk))) {
+							return false;
+						}
+					}
+				}
+			}
+			return true;
+		};
+
+		std::vector<Array3D<T>> patterns;
+		std::vector<double> patterns_frequency;
+		// The patterns of every hash, usually only one.
+		std::unordered_map<uint64_t, std::vector<unsigned>> patterns_by_hash;
+		patterns_by_hash.reserve(1024);
+		for (unsigned i = 0; i < extents[0]; i++) {
+			for (unsigned j = 0; j < extents[1]; j++) {
+				for (unsigned k = 0; k < extents[2]; k++) {
+					std::vector<unsigned> &candidates =
+						patterns_by_hash[hashes[((size_t)i * extents[1] + j) * extents[2] + k]];
+					bool found = false;
+					for (unsigned id : candidates) {
+						if (same(patterns[id], i, j, k)) {
+							patterns_frequency[id] += 1;
+							found = true;
+							break;
+						}
+					}
+					if (!found) {
+						Array3D<T> pattern(size, size, size);
+						for (unsigned di = 0; di < size; di++) {
+							for (unsigned dj = 0; dj < size; dj++) {
+								for (unsigned dk = 0; dk < size; dk++) {
+									pattern.get(di, dj, dk) = volume.get(i + di, j + dj, k + dk);
+								}
+							}
+						}
+						candidates.push_back(patterns.size());
+						patterns.push_back(pattern);
+						patterns_frequency.push_back(1);
+					}
+				}
+			}
+		}
+		return { patterns, patterns_frequency };
+	}
+
+	/**
+	* Return the slab of pattern along axis made of the layers [first,
+	* first + size - 1) of the axis.
+	*/
+	static Array3D<T> get_slab(const Array3D<T> &pattern, unsigned axis,
+		unsigned first) noexcept {
+		const unsigned size = pattern.height;
+		std::array<unsigned, 3> extents = { size, size, size };
+		extents[axis] = size - 1;
+		Array3D<T> slab(extents[0], extents[1], extents[2]);
+		for (unsigned i = 0; i < extents[0]; i++) {
+			for (unsigned j = 0; j < extents[1]; j++) {
+				for (unsigned k = 0; k < extents[2]; k++) {
+					std::array<unsigned, 3> c = { i, j, k };
+					c[axis] += first;
+					slab.get(i, j, k) = pattern.get(c[0], c[1], c[2]);
+				}
+			}
+		}
+		return slab;
+	}
+
+	/**
+	* Compute the propagator. pattern2 can be placed after pattern1 along an
+	* axis when the last size - 1 layers of pattern1 are the first size - 1
+	* layers of pattern2. Every slab gets an id, and the patterns are put in
+	* buckets by the id of their first slab, so the compatible patterns are a
+	* lookup instead of a comparison with every other pattern.
+	*/
+	static CompiledModel::PropagatorState
+	generate_compatible(const std::vector<Array3D<T>> &patterns) noexcept {
+		CompiledModel::PropagatorState compatible(patterns.size());
+		for (unsigned axis = 0; axis < 3; axis++) {
+			std::unordered_map<Array3D<T>, unsigned> slab_ids;
+			auto slab_id = [&](const Array3D<T> &slab) {
+				return slab_ids.insert({ slab, (unsigned)slab_ids.size() }).first->second;
+			};
+			std::vector<unsigned> first(patterns.size());
+			std::vector<unsigned> last(patterns.size());
+			for (unsigned p = 0; p < patterns.size(); p++) {
+				first[p] = slab_id(get_slab(patterns[p], axis, 0));
+				last[p] = slab_id(get_slab(patterns[p], axis, 1));
+			}
+			// The patterns by the id of their first and last slabs.
+			std::vector<std::vector<unsigned>> by_first(slab_ids.size());
+			std::vector<std::vector<unsigned>> by_last(slab_ids.size());
+			for (unsigned p = 0; p < patterns.size(); p++) {
+				by_first[first[p]].push_back(p);
+				by_last[last[p]].push_back(p);
+			}
+			for (unsigned direction = 0; direction < 6; direction++) {
+				const int delta[3] = { direction_z[direction], direction_y[direction],
+					direction_x[direction] };
+				if (delta[axis] == 0) {
+					continue;
+				}
+				for (unsigned p = 0; p < patterns.size(); p++) {
+					compatible[p][direction] = delta[axis] > 0 ? by_first[last[p]]
+						: by_last[first[p]];
+				}
+			}
+		}
+		return compatible;
+	}
+
+	/**
+	* Transform a 3D array containing the patterns id to a 3D array containing
+	* the voxels. Every voxel is taken from the pattern of the nearest cell,
+	* which is the cell of the voxel except on the last size - 1 layers of a
+	* non toric output.
+	*/
+	Array3D<T> to_volume(const Array3D<unsigned> &output_patterns) const noexcept {
+		const std::vector<Array3D<T>> &patterns = model->patterns;
+		Array3D<T> output(options.out_depth, options.out_height, options.out_width);
+		const unsigned wave[3] = { options.get_wave_depth(), options.get_wave_height(),
+			options.get_wave_width() };
+		for (unsigned z = 0; z < options.out_depth; z++) {
+			for (unsigned y = 0; y < options.out_height; y++) {
+				for (unsigned x = 0; x < options.out_width; x++) {
+					unsigned i = std::min(z, wave[0] - 1);
+					unsigned j = std::min(y, wave[1] - 1);
+					unsigned k = std::min(x, wave[2] - 1);
+					output.get(z, y, x) = patterns[output_patterns.get(i, j, k)]
+						.get(z - i, y - j, x - k);
+				}
+			}
+		}
+		return output;
+	}
+
+public:
+	/**
+	* Extract the patterns of the input and compile the model. The patterns
+	* have no height band. The result can be shared by many OverlappingWFC3D.
+	*/
+	static std::shared_ptr<const OverlappingModel3D<T>>
+	compile(const Array3D<T> &input, const OverlappingWFC3DOptions &options) noexcept {
+		auto model = std::make_shared<OverlappingModel3D<T>>();
+		std::vector<double> patterns_frequency;
+		std::tie(model->patterns, patterns_frequency) = get_patterns(input, options);
+		const unsigned nb_patterns = model->patterns.size();
+		model->compiled = CompiledModel::compile(patterns_frequency,
+			generate_compatible(model->patterns), std::vector<int>(nb_patterns, 0),
+			std::vector<int>(nb_patterns, std::numeric_limits<int>::max()));
+		return model;
+	}
+
+	/**
+	* Constructor using a shared model compiled from the same input and options.
+	*/
+	OverlappingWFC3D(const OverlappingWFC3DOptions &options,
+		std::shared_ptr<const OverlappingModel3D<T>> model, int seed) noexcept
+		: options(options), model(model),
+		wfc(options.periodic_output, seed, model->compiled, options.get_wave_depth(),
+			options.get_wave_height(), options.get_wave_width(), options.heuristic,
+			options.layout) {}
+
+	/**
+	* The constructor used by the user.
+	*/
+	OverlappingWFC3D(const Array3D<T> &input, const OverlappingWFC3DOptions &options,
+		int seed) noexcept
+		: OverlappingWFC3D(options, compile(input, options), seed) {}
+
+	/**
+	* Apply a whole layer of constraints (see genericWFC::add_constraints).
+	*/
+	std::optional<Contradiction> add_constraints(const ConstraintLayer &constraints) noexcept {
+		return wfc.add_constraints(constraints);
+	}
+
+	/**
+	* Return the contradiction of a failed run (see genericWFC::get_contradiction).
+	*/
+	std::optional<Contradiction> get_contradiction() const noexcept {
+		return wfc.get_contradiction();
+	}
+
+	/**
+	* Run the WFC algorithm, and return the result if the algorithm succeeded.
+	*/
+	std::optional<Array3D<T>> run() noexcept {
+		std::optional<Array3D<unsigned>> result = wfc.run();
+		if (result.has_value()) {
+			return to_volume(*result);
+		}
+		return std::nullopt;
+	}
+};
+
+#endif // WFC_OVERLAPPING_WFC_HPP_
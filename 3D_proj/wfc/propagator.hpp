@@ -3,131 +3,345 @@
 #define WFC_PROPAGATOR_HPP_
 
 #include "wave.hpp"
+#include "../../common/wfc_engine.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <tuple>
 #include <vector>
 #include <array>
-#include "array4D.hpp"
+#include "atomic_ops.hpp"
+#include "cell_layout.hpp"
+#include "compiled_model.hpp"
+#include "constraint_layer.hpp"
 #include "direction.hpp"
 
 class Propagator{
 public:
-	using PropagatorState = std::vector<std::array<std::vector<unsigned>, 6 >>;
+	using PropagatorState = CompiledModel::PropagatorState;
+
+	/**
+	* άĴݺģwfc_engine.hppΪzyx
+	*/
+	using BoundedEngine = WFCEngine<3, BoundedTopology>;
+	using PeriodicEngine = WFCEngine<3, PeriodicTopology>;
+
+	/**
+	* ݵԪأcellzyxбƳ״
+	*/
+	using Item = BoundedEngine::Item;
 
 private:
+	/**
+	* ݵԪسʱnb_threadsΪ0תΪд
+	*/
+	static constexpr size_t parallel_threshold = 1024;
+
+	/**
+	* дÿ߳ԼԪسʱһŵй߳ȡ
+	*/
+	static constexpr size_t share_threshold = 64;
+
+	/**
+	* ̵߳ĹУ̴߳Ӻȡ̴߳ǰȡ
+	*/
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Item> items;
+	};
+
+	/**
+	* ıģ
+	*/
+	std::shared_ptr<const CompiledModel> model;
+
 	/**
 	* ͼδС
 	*/
 	const unsigned pattern_size;
 
-	PropagatorState propagator_state;
-
 	/**
-	* waveĳߴ
+	* waveĳߴcellзʽwaveͬ
 	*/
-	const unsigned wave_width;
-	const unsigned wave_height;
-	const unsigned wave_depth;
+	const CellLayout layout;
 
 	/**
 	* trueƽ
 	*/
 	const bool periodic_output;
 
-	std::vector<std::tuple<unsigned, unsigned, unsigned, unsigned>> propagating;
+	/**
+	* дʹõ߳0ʾֻڵǰ̴߳
+	* ԭӲ̵߳ĿʹдڵԼ5Ĭϲʹãֻڶϰ
+	*/
+	const unsigned nb_threads;
+
+	std::vector<Item> propagating;
 
-	Array4D<std::array<int, 6>> compatible;
+	/**
+	* compatiblecell indexĵpatternΪcell״Ȼݵھ
+	* celllayoutwaveеͬģ͵֧CompatibleCounters
+	* cellļڴݵһεʱŷ
+	*/
+	CompatibleCounters<6> compatible;
+
+	/**
+	* еһûп״cellԼ״ͷ
+	* һìܣֹͣʣµԪر
+	*/
+	std::optional<Contradiction> contradiction;
+
+	/**
+	* waveĳߴ磬꣨zyx˳
+	*/
+	BoundedEngine::Coordinates sizes() const noexcept {
+		return { layout.depth, layout.height, layout.width };
+	}
+
+	/**
+	* cellwaveеlayout
+	*/
+	unsigned index_of(const BoundedEngine::Coordinates &cell) const noexcept {
+		return layout.index(cell[0], cell[1], cell[2]);
+	}
 
 	/**
-	* ʼcompatible
+	* ȡ߳idһԪأȴԼĹкȡٴ̵߳Ĺǰȡ
+	* sharedΪйеԪ
 	*/
-	void init_compatible() noexcept {
-		std::array<int, 6> value;
-		for (unsigned z = 0; z < wave_depth; z++){
-			for (unsigned y = 0; y < wave_height; y++){
-				for (unsigned x = 0; x < wave_width; x++){
-					for (unsigned pattern = 0; pattern < pattern_size; pattern++){
-						for (int direction = 0; direction < 6; direction++){
-							value[direction] =
-								propagator_state[pattern][get_opposite_direction(direction)].size();
+	bool take_work(std::vector<WorkQueue> &queues, unsigned id, Item &item,
+		std::atomic<size_t> &shared) noexcept {
+		for (unsigned k = 0; k < queues.size(); k++){
+			WorkQueue &queue = queues[(id + k) % queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.items.empty()){
+				shared--;
+				if (k == 0){
+					item = queue.items.back();
+					queue.items.pop_back();
+				}
+				else{
+					item = queue.items.front();
+					queue.items.pop_front();
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	* nb_threads̲߳дpropagatingеԪ
+	* compatibleļwaveλԭӲ޸ģһ״ֻᱻһ߳Ƴ
+	* ݵĲ˳޹أյwaveȷģ޸ĵcellصļ¼뵥̴߳ͬpropagate
+	* һcellûпܵ״ֹ߳ͣһì̼ܵ߳¼ì
+	* BoundΪģ͵״ޣwith_pattern_boundCounterΪ
+	* waveͼҳ̵߳һ޸ʱŷ䣬û̵߳ȴµĹԪضת
+	*/
+	template <typename Engine, typename Bound, typename Counter>
+	bool propagate_parallel(Wave &wave, PagedArray<std::array<Counter, 6>> &counts) noexcept {
+		std::vector<WorkQueue> queues(nb_threads);
+		for (size_t i = 0; i < propagating.size(); i++){
+			queues[i % nb_threads].items.push_back(propagating[i]);
+		}
+		std::atomic<size_t> pending(propagating.size());
+		std::atomic<size_t> shared(propagating.size());
+		std::atomic<bool> contradiction(false);
+		std::vector<std::vector<unsigned>> touched(nb_threads);
+		propagating.clear();
+
+		// ԪӡԪشìʱѵȴ̣߳waitingΪȴ߳
+		std::mutex idle_mutex;
+		std::condition_variable idle;
+		std::atomic<unsigned> waiting(0);
+		auto wake_all = [&](){
+			if (waiting.load() == 0){
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> lock(idle_mutex);
+			}
+			idle.notify_all();
+		};
+
+		const BoundedEngine::Coordinates wave_sizes = sizes();
+		auto worker = [&](unsigned id){
+			std::vector<Item> local;
+			while (!contradiction.load(std::memory_order_relaxed)){
+				Item item;
+				if (!local.empty()){
+					item = local.back();
+					local.pop_back();
+				}
+				else if (!take_work(queues, id, item, shared)){
+					std::unique_lock<std::mutex> lock(idle_mutex);
+					waiting++;
+					idle.wait(lock, [&](){
+						return shared.load() != 0 || pending.load() == 0 || contradiction.load();
+					});
+					waiting--;
+					if (pending.load() == 0){
+						return;
+					}
+					continue;
+				}
+
+				Engine::for_each_direction([&](auto direction_constant) {
+					constexpr unsigned direction = decltype(direction_constant)::value;
+					BoundedEngine::Coordinates cell2;
+					if (!Engine::template get_neighbor<direction>(wave_sizes, item.cell, cell2)){
+						return true;
+					}
+					unsigned i2 = index_of(cell2);
+					std::array<Counter, 6> *compatible2 = counts.write_cell_concurrent(i2);
+					for (const unsigned *it = model->neighbors_begin(item.pattern, direction),
+						*it_end = model->neighbors_end(item.pattern, direction); it < it_end; ++it){
+						if (atomic_decrement(compatible2[*it][direction]) != 0){
+							continue;
 						}
-						compatible.get(z, y, x, pattern) = value;
+						bool emptied = false;
+						if (wave.template remove_concurrent<Bound::nb_words>(i2, *it, emptied)){
+							// add_to_propagatorͬ󲻻ٴε0
+							for (Counter &count : compatible2[*it]){
+								atomic_store(count, (Counter)0);
+							}
+							touched[id].push_back(i2);
+							pending++;
+							local.push_back({ cell2, *it });
+							bool expected = false;
+							if (emptied && contradiction.compare_exchange_strong(expected, true)){
+								this->contradiction = Contradiction{ cell2[0], cell2[1], cell2[2],
+									(int)*it, (int)direction, (int)item.pattern };
+								wake_all();
+							}
+						}
+					}
+					return true;
+				});
+
+				if (local.size() > share_threshold){
+					{
+						std::lock_guard<std::mutex> lock(queues[id].mutex);
+						shared += local.size() / 2;
+						queues[id].items.insert(queues[id].items.end(), local.begin(),
+							local.begin() + local.size() / 2);
 					}
+					local.erase(local.begin(), local.begin() + local.size() / 2);
+					wake_all();
+				}
+				if (--pending == 0){
+					wake_all();
 				}
 			}
+		};
+
+		std::vector<std::thread> threads;
+		for (unsigned id = 1; id < nb_threads; id++){
+			threads.emplace_back(worker, id);
+		}
+		worker(0);
+		for (std::thread &thread : threads){
+			thread.join();
+		}
+
+		for (const std::vector<unsigned> &thread_cells : touched){
+			for (unsigned index : thread_cells){
+				wave.mark_modified(index);
+			}
+		}
+		return !contradiction;
+	}
+
+	/**
+	* ðBoundģ͵״ޣͼͱĴݺĴpropagatingеԪ
+	* ÿԪصĴάĺģֻʱתΪд
+	*/
+	template <typename Bound, typename Counter>
+	bool propagate_bounded(Wave &wave, PagedArray<std::array<Counter, 6>> &counts) noexcept {
+		const BoundedEngine::Coordinates wave_sizes = sizes();
+		auto index = [this](const BoundedEngine::Coordinates &cell){
+			return index_of(cell);
+		};
+		while (propagating.size() != 0){
+			if (nb_threads > 0 && propagating.size() >= parallel_threshold){
+				return periodic_output ? propagate_parallel<PeriodicEngine, Bound>(wave, counts)
+					: propagate_parallel<BoundedEngine, Bound>(wave, counts);
+			}
+
+			const Item item = propagating.back();
+			propagating.pop_back();
+			std::optional<PropagationConflict<3>> conflict = periodic_output
+				? PeriodicEngine::propagate_item<Bound>(*model, wave_sizes, index, counts,
+					item, propagating, wave)
+				: BoundedEngine::propagate_item<Bound>(*model, wave_sizes, index, counts,
+					item, propagating, wave);
+			if (conflict){
+				contradiction = Contradiction{ conflict->cell[0], conflict->cell[1], conflict->cell[2],
+					(int)conflict->pattern, (int)conflict->direction, (int)conflict->source_pattern };
+				propagating.clear();
+				return false;
+			}
 		}
+		return true;
 	}
 
 public:
 	/**
-	* 첢ʼ
+	* 첢ʼÿϼݵ״ģм
 	*/
-	Propagator(unsigned wave_height, unsigned wave_width, unsigned wave_depth,
-		bool periodic_output, PropagatorState propagator_state) noexcept
-		: pattern_size(propagator_state.size()),
-		propagator_state(propagator_state), wave_width(wave_width),
-		wave_height(wave_height), wave_depth(wave_depth),
-		periodic_output(periodic_output), compatible(wave_height, wave_width, wave_depth, pattern_size) {
-		init_compatible();
+	Propagator(bool periodic_output, std::shared_ptr<const CompiledModel> model,
+		const CellLayout &layout, unsigned nb_threads = 0) noexcept
+		: model(model), pattern_size(model->nb_patterns), layout(layout),
+		periodic_output(periodic_output), nb_threads(nb_threads),
+		compatible(layout.width * layout.height * layout.depth, pattern_size, model->max_support,
+			model->initial_compatible.data()) {
 	}
 
 	/**
 	* Ԫ
 	*/
 	void add_to_propagator(unsigned z, unsigned y, unsigned x, unsigned pattern) noexcept {
-		std::array<int, 6> temp = {};
-		compatible.get(z, y, x, pattern) = temp;
-		propagating.emplace_back(z, y, x, pattern);
+		compatible.clear(layout.index(z, y, x), pattern);
+		propagating.push_back({ { z, y, x }, pattern });
 	}
 
 	/**
 	* Ϣ
+	* ڵһûп״cellֹͣfalseìget_contradiction
 	*/
-	void propagate(Wave &wave) noexcept {
-	
-		while (propagating.size() != 0){
-			unsigned z1, y1, x1, pattern;
-			std::tie(z1, y1, x1, pattern) = propagating.back();
-			propagating.pop_back();
-
-			//򴫵
-			for (unsigned direction = 0; direction < 6; direction++){
-				int dx = direction_x[direction];
-				int dy = direction_y[direction];
-				int dz = direction_z[direction];
-				int z2, y2, x2;
-				if (periodic_output){
-					x2 = ((int)x1 + dx + (int)wave.width) % wave.width;
-					y2 = ((int)y1 + dy + (int)wave.height) % wave.height;
-					z2 = ((int)z1 + dz + (int)wave.depth) % wave.depth;
-				}else{
-					x2 = x1 + dx;
-					y2 = y1 + dy;
-					z2 = z1 + dz;
-					if (x2 < 0 || x2 >= (int)wave.width){
-						continue;
-					}
-					if (y2 < 0 || y2 >= (int)wave.height){
-						continue;
-					}
-					if (z2 < 0 || z2 >= (int)wave.depth){
-						continue;
-					}
-				}
-				unsigned i2 = x2 + y2 * wave_width + z2 * wave_width * wave_depth;
-				const std::vector<unsigned> &patterns =
-					propagator_state[pattern][direction];
+	bool propagate(Wave &wave) noexcept {
+		if (contradiction){
+			propagating.clear();
+			return false;
+		}
+		// waveڴǰѾìܣԼһcell
+		if (wave.impossible()){
+			unsigned z, y, x;
+			layout.coordinates(wave.get_contradiction_index(), z, y, x);
+			contradiction = Contradiction{ z, y, x };
+			propagating.clear();
+			return false;
+		}
 
-				for (auto it = patterns.begin(), it_end = patterns.end(); it < it_end; ++it){
-					std::array<int, 6> &value = compatible.get(z2, y2, x2, *it);
-					value[direction]--;
+		bool result = with_pattern_bound(pattern_size, [&](auto bound){
+			return compatible.visit([&](auto &counts){
+				return propagate_bounded<decltype(bound)>(wave, counts);
+			});
+		});
+		// ̺߳Ͳдݶ˳±޸ĵcellصļ¼
+		wave.refresh_modified();
+		return result;
+	}
 
-					if (value[direction] == 0){
-						add_to_propagator(z2, y2, x2, *it);
-						wave.set(i2, *it, false);
-					}
-				}
-			}
-		}
+	/**
+	* شзֵìܣû򷵻nullopt
+	*/
+	const std::optional<Contradiction> &get_contradiction() const noexcept {
+		return contradiction;
 	}
 };
 
@@ -0,0 +1,97 @@
+#pragma once
+#ifndef WFC_SNAPSHOT_CACHE_HPP_
+#define WFC_SNAPSHOT_CACHE_HPP_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "compiled_model.hpp"
+#include "genericWFC.hpp"
+
+/**
+* Identify the state of a genericWFC after its initial constraints: the model,
+* the size of the wave, the solver options, a description of the other
+* constraints applied before the first observation, and the key of the
+* constraint layer applied, if any.
+*/
+struct WFCSnapshotKey {
+	std::shared_ptr<const CompiledModel> model;
+	unsigned wave_depth;
+	unsigned wave_height;
+	unsigned wave_width;
+	bool periodic_output;
+	Heuristic heuristic;
+	Layout layout;
+	unsigned propagation_threads;
+	std::string constraints;
+	ConstraintKey layer;
+
+	bool operator==(const WFCSnapshotKey &other) const noexcept {
+		return model == other.model && wave_depth == other.wave_depth &&
+			wave_height == other.wave_height && wave_width == other.wave_width &&
+			periodic_output == other.periodic_output && heuristic == other.heuristic &&
+			layout == other.layout && propagation_threads == other.propagation_threads &&
+			constraints == other.constraints && layer == other.layer;
+	}
+};
+
+namespace std {
+	template <> class hash<WFCSnapshotKey> {
+	public:
+		size_t operator()(const WFCSnapshotKey &key) const noexcept {
+			size_t seed = hash<const CompiledModel *>()(key.model.get());
+			for (size_t value : { (size_t)key.wave_depth, (size_t)key.wave_height,
+				(size_t)key.wave_width, (size_t)key.periodic_output, (size_t)key.heuristic,
+				(size_t)key.layout, (size_t)key.propagation_threads, hash<std::string>()(key.constraints),
+				key.layer.hash }) {
+				seed ^= value + (size_t)0x9e3779b9 + (seed << 6) + (seed >> 2);
+			}
+			return seed;
+		}
+	};
+}
+
+/**
+* Cache of the genericWFC states obtained after the initial constraints have
+* been applied and propagated. Every run with the same key starts from a copy
+* of the snapshot instead of redoing the same prologue.
+*/
+class WFCSnapshotCache {
+private:
+	std::unordered_map<WFCSnapshotKey, std::shared_ptr<const genericWFC>> snapshots;
+
+public:
+	/**
+	* Return the snapshot of key. If it is not in the cache, it is computed by
+	* applying prologue to a fresh genericWFC, then calling prepare.
+	*/
+	std::shared_ptr<const genericWFC> get(const WFCSnapshotKey &key,
+		const std::function<void(genericWFC &)> &prologue) noexcept {
+		auto it = snapshots.find(key);
+		if (it != snapshots.end()) {
+			return it->second;
+		}
+		genericWFC wfc(key.periodic_output, 0, key.model,
+			key.wave_depth, key.wave_height, key.wave_width, key.heuristic,
+			key.layout, key.propagation_threads);
+		prologue(wfc);
+		wfc.prepare();
+		std::shared_ptr<const genericWFC> snapshot =
+			std::make_shared<const genericWFC>(std::move(wfc));
+		snapshots.emplace(key, snapshot);
+		return snapshot;
+	}
+
+	/**
+	* The number of snapshots in the cache.
+	*/
+	size_t size() const noexcept { return snapshots.size(); }
+
+	/**
+	* Remove every snapshot.
+	*/
+	void clear() noexcept { snapshots.clear(); }
+};
+
+#endif // WFC_SNAPSHOT_CACHE_HPP_
@@ -7,127 +7,105 @@
 #include "array3D.hpp"
 #include "genericWFC.hpp"
 #include "model.hpp"
+#include "constraint_layer.hpp"
+#include "counter_rng.hpp"
+#include "cube_symmetry.hpp"
+#include "mesh_assembly.hpp"
+#include "model_analysis.hpp"
+#include "snapshot_cache.hpp"
+#include <memory>
 #include <string>
 
 /**
-* ש̬
+* ש̬שĶԳԣsymmetry_table
+* XTLIֻYתǰһ̬תⷽ
+* Bб任ıյĻʵĵĴשⷽĴשʱXʹ
+* WYת;񲻸ıذ壬6ֱ6
+* CXYZıXYZ > 0Ľǣ8
+* E(X, Y, Z) -> (-X, Y, Z)(X, Y, Z) -> (-X, -Z, -Y)ıZߵб£12
+* FûжԳԣ24ת
+* MûжԳԣ24ת侵񣬹48
 */
-enum class Symmetry {X, T, L, I};
+enum class Symmetry {X, T, L, I, B, W, C, E, F, M};
 
 /**
-* ״ת
+* ש̬ķͶʱ
 */
-unsigned nb_of_possible_orientations(const Symmetry &symmetry) {
+inline const CubeSymmetryTable &symmetry_table(const Symmetry &symmetry) noexcept {
+	static constexpr CubeSymmetryTable x = make_cube_symmetry(cube_vertical_group, cube_vertical_group);
+	static constexpr CubeSymmetryTable t = make_cube_symmetry(cube_vertical_group,
+		cube_subgroup({ cube_mirror }));
+	static constexpr CubeSymmetryTable l = make_cube_symmetry(cube_vertical_group,
+		cube_subgroup({ { { 2, 1, 0 }, { -1, 1, -1 } } }));
+	static constexpr CubeSymmetryTable i = make_cube_symmetry(cube_vertical_group,
+		cube_subgroup({ cube_compose(cube_turn, cube_turn), cube_mirror }));
+	static constexpr CubeSymmetryTable b = make_cube_symmetry(cube_full_group, cube_full_group);
+	static constexpr CubeSymmetryTable w = make_cube_symmetry(cube_full_group, cube_vertical_group);
+	static constexpr CubeSymmetryTable c = make_cube_symmetry(cube_full_group,
+		cube_subgroup({ { { 2, 0, 1 }, { 1, 1, 1 } }, { { 1, 0, 2 }, { 1, 1, 1 } } }));
+	static constexpr CubeSymmetryTable e = make_cube_symmetry(cube_full_group,
+		cube_subgroup({ cube_mirror, { { 0, 2, 1 }, { -1, -1, -1 } } }));
+	static constexpr CubeSymmetryTable f = make_cube_symmetry(cube_rotation_group, 1);
+	static constexpr CubeSymmetryTable m = make_cube_symmetry(cube_full_group, 1);
 	switch (symmetry){
-	case Symmetry::X:
-		return 1;
-	case Symmetry::I:
-		return 2;
 	case Symmetry::T:
+		return t;
 	case Symmetry::L:
-		return 4;
+		return l;
+	case Symmetry::I:
+		return i;
+	case Symmetry::B:
+		return b;
+	case Symmetry::W:
+		return w;
+	case Symmetry::C:
+		return c;
+	case Symmetry::E:
+		return e;
+	case Symmetry::F:
+		return f;
+	case Symmetry::M:
+		return m;
+	case Symmetry::X:
 	default:
-		return 0;
+		return x;
 	}
 }
 
+/**
+* ״ת
+*/
+unsigned nb_of_possible_orientations(const Symmetry &symmetry) {
+	return symmetry_table(symmetry).nb_orientations;
+}
+
 /**
 * tileṹ
 */
 
 struct Tile{
-	std::vector<ObjModel> data;
+	std::vector<ObjModel> data;	// ģͣÿһģͣget_oriented
 	Symmetry symmetry;
 	double weight;
 	int low;
 	int high;
 
 	/**
-	* תid
+	* ֻһģʱɶԳԾÿһģ
 	*/
-	static std::vector<unsigned> 
-	generate_rotation_map(const Symmetry &symmetry) noexcept {
-		switch (symmetry){
-		case Symmetry::X:
-			return{ 0 };
-		case Symmetry::I:
-			return{ 1,0 };
-		case Symmetry::T:
-		case Symmetry::L:
-			return{ 1, 2, 3, 0 };
-		default:
-			return{ 0 };
-		}
+	unsigned nb_orientations() const noexcept {
+		return data.size() > 1 ? (unsigned)data.size() : nb_of_possible_orientations(symmetry);
 	}
 
-
 	/**
-	* Գid
+	* һģͺӦı任cube_elements±꣩
+	* ֻģͣ任ģʱӦã任ĸ
 	*/
-	static std::vector<unsigned>
-	generate_reflection_map(const Symmetry &symmetry) noexcept {
-		switch (symmetry){
-		case Symmetry::X:
-			return { 0 };
-		case Symmetry::I:
-			return { 0, 1 };
-		case Symmetry::T:
-			return { 0, 3, 2, 1 };
-		case Symmetry::L:
-			return { 1, 0, 3, 2 };
-		default:
-			return { 0 };
-		}
-	}
-
-	static std::vector<std::vector<unsigned>>
-	generate_action_map(const Symmetry &symmetry) noexcept {
-		std::vector<unsigned> rotation_map = generate_rotation_map(symmetry);
-		std::vector<unsigned> reflection_map = generate_reflection_map(symmetry);
-		size_t size = rotation_map.size();
-		std::vector<std::vector<unsigned>> action_map(8, std::vector<unsigned>(size));
-		for (size_t i = 0; i < size; ++i){
-			action_map[0][i] = i;
-		}
-
-		for (size_t a = 1; a < 4; ++a){
-			for (size_t i = 0; i < size; ++i){
-				action_map[a][i] = rotation_map[action_map[a - 1][i]];
-			}
-		}
-
-		for (size_t i = 0; i < size; ++i){
-			action_map[4][i] = reflection_map[action_map[0][i]];
-		}
-
-		for (size_t a = 5; a < 8; ++a){
-			for (size_t i = 0; i < size; ++i){
-				action_map[a][i] = rotation_map[action_map[a - 1][i]];
-			}
-		}
-		return action_map;
-	}
-
-	static std::vector<ObjModel> generate_oriented(ObjModel data, Symmetry symmetry) noexcept {
-		std::vector<ObjModel> oriented;
-		oriented.push_back(data);
-
-		switch (symmetry)
-		{
-		case Symmetry::I:
-			oriented.push_back(data = RotatedModel(data));
-			break;
-		case Symmetry::T:
-		case Symmetry::L:
-			oriented.push_back(data = RotatedModel(data));
-			oriented.push_back(data = RotatedModel(data));
-			oriented.push_back(data = RotatedModel(data));
-			break;
-		default:
-			break;
+	OrientedMesh get_oriented(unsigned orientation) const noexcept {
+		if (data.size() > 1){
+			return { &data[orientation], 0 };
 		}
-
-		return oriented;
+		return { &data[0], symmetry_table(symmetry).element[orientation] };
 	}
 
 	/**
@@ -140,12 +118,32 @@ struct Tile{
 	* һ 
 	*/
 	Tile(ObjModel data, Symmetry symmetry, double weight, int low, int high) noexcept
-		: data(generate_oriented(data, symmetry)), symmetry(symmetry),
+		: data{ data }, symmetry(symmetry),
 		weight(weight), low(low), high(high) {}
 };
 
+/**
+* Ĵשģͣ޸ģɱTilingWFC
+*/
+struct TilingModel {
+	std::vector<Tile> tiles;
+	std::vector<std::pair<unsigned, unsigned>> id_to_oriented_tile;
+	std::vector<std::vector<unsigned>> oriented_tile_ids;
+	std::shared_ptr<const CompiledModel> compiled;
+
+	/**
+	* ģͣTilingWFC::reduceÿ״ԭʼ״δʱΪ
+	* oriented_tile_idsǻ״
+	*/
+	std::vector<std::vector<unsigned>> class_patterns;
+};
+
 struct TilingWFCOptions {
 	bool periodic_output;
+	Heuristic heuristic = Heuristic::entropy;	// ѡһ۲cellķ
+	Layout layout = Layout::linear;	// cellڴезʽӰʱѡʹߴ粻4ıʱbrick˻linearget_layout
+	unsigned propagation_threads = 0;	// дݵ߳Ĭ0ʾУϲдݱȵ߳
+	unsigned mesh_threads = 0;	// ģ͵߳0ʾÿһ߳
 };
 
 /**
@@ -154,22 +152,27 @@ struct TilingWFCOptions {
 template <typename T> class TilingWFC {
 private:
 	/**
-	* tiles
+	* Ĵשģ
 	*/
-	std::vector<Tile> tiles;
-
-	std::vector<std::pair<unsigned, unsigned>> id_to_oriented_tile;
-
-	std::vector<std::vector<unsigned>> oriented_tile_ids;
+	std::shared_ptr<const TilingModel> model;
 
 	TilingWFCOptions options;
 
+	/**
+	* ӣںϲ״ѡ״
+	*/
+	int seed;
 
 	/**
 	* wfcһ㷨
 	*/
 	genericWFC wfc;
 
+	/**
+	* һģʱͳƣassemble_mesh
+	*/
+	MeshAssemblyStats mesh_stats;
+
 	static std::pair<std::vector<std::pair<unsigned, unsigned>>,
 					std::vector<std::vector<unsigned>>>
 	generate_oriented_tile_ids(const std::vector<Tile> &tiles) noexcept {
@@ -179,7 +182,7 @@ private:
 		unsigned id = 0;
 		for (unsigned i = 0; i < tiles.size(); i++){
 			oriented_tile_ids.push_back({});
-			for (unsigned j = 0; j < tiles[i].data.size(); j++){
+			for (unsigned j = 0; j < tiles[i].nb_orientations(); j++){
 				id_to_oriented_tile.push_back({ i,j });
 				oriented_tile_ids[i].push_back(id);
 				id++;
@@ -197,200 +200,55 @@ private:
 	static std::vector<std::array<std::vector<unsigned>, 6>> generate_propagator(
 		const std::vector<std::tuple<unsigned, unsigned, unsigned, unsigned, unsigned>>
 		&neighbors,
-		std::vector<Tile> tiles,
-		std::vector<std::pair<unsigned, unsigned>> id_to_oriented_tile,
-		std::vector<std::vector<unsigned>> oriented_tile_ids) {
+		const std::vector<Tile> &tiles,
+		const std::vector<std::pair<unsigned, unsigned>> &id_to_oriented_tile,
+		const std::vector<std::vector<unsigned>> &oriented_tile_ids) {
 		size_t nb_oriented_tiles = id_to_oriented_tile.size();
-		std::vector<std::array<std::vector<bool>, 6>> dense_propagator(
-			nb_oriented_tiles, { 
-			std::vector<bool>(nb_oriented_tiles, false),
-			std::vector<bool>(nb_oriented_tiles, false),
-			std::vector<bool>(nb_oriented_tiles, false),
-			std::vector<bool>(nb_oriented_tiles, false),
-			std::vector<bool>(nb_oriented_tiles, false),
-			std::vector<bool>(nb_oriented_tiles, false) 
-			});
-
-
-		//dense_propagator[1][0][2] = true;
-		//dense_propagator[1][0][3] = true;
-		//dense_propagator[1][0][0] = true;
-		//dense_propagator[1][0][6] = true;
-		//dense_propagator[1][1][3] = true;
-		//dense_propagator[1][1][4] = true;
-		//dense_propagator[1][1][0] = true;
-		//dense_propagator[1][1][5] = true;
-
-		//dense_propagator[1][5][2] = true;
-		//dense_propagator[1][5][3] = true;
-		//dense_propagator[1][5][0] = true;
-		//dense_propagator[1][5][5] = true;
-		//dense_propagator[1][4][3] = true;
-		//dense_propagator[1][4][4] = true;
-		//dense_propagator[1][4][0] = true;
-		//dense_propagator[1][4][6] = true;
-
-
-		//dense_propagator[2][0][1] = true;
-		//dense_propagator[2][0][4] = true;
-		//dense_propagator[2][0][0] = true;
-		//dense_propagator[2][0][5] = true;
-		//dense_propagator[2][1][3] = true;
-		//dense_propagator[2][1][4] = true;
-		//dense_propagator[2][1][0] = true;
-		//dense_propagator[2][1][5] = true;
-
-
-		//dense_propagator[2][5][1] = true;
-		//dense_propagator[2][5][4] = true;
-		//dense_propagator[2][5][0] = true;
-		//dense_propagator[2][5][6] = true;
-		//dense_propagator[2][4][3] = true;
-		//dense_propagator[2][4][4] = true;
-		//dense_propagator[2][4][0] = true;
-		//dense_propagator[2][4][6] = true;
-
-
-		//dense_propagator[3][0][1] = true;
-		//dense_propagator[3][0][4] = true;
-		//dense_propagator[3][0][0] = true;
-		//dense_propagator[3][0][5] = true;
-		//dense_propagator[3][1][1] = true;
-		//dense_propagator[3][1][2] = true;
-		//dense_propagator[3][1][0] = true;
-		//dense_propagator[3][1][6] = true;
-
-
-		//dense_propagator[3][5][1] = true;
-		//dense_propagator[3][5][4] = true;
-		//dense_propagator[3][5][0] = true;
-		//dense_propagator[3][5][6] = true;
-		//dense_propagator[3][4][1] = true;
-		//dense_propagator[3][4][2] = true;
-		//dense_propagator[3][4][0] = true;
-		//dense_propagator[3][4][5] = true;
-
-
-		//dense_propagator[4][0][2] = true;
-		//dense_propagator[4][0][3] = true;
-		//dense_propagator[4][0][0] = true;
-		//dense_propagator[4][0][6] = true;
-		//dense_propagator[4][1][1] = true;
-		//dense_propagator[4][1][2] = true;
-		//dense_propagator[4][1][0] = true;
-		//dense_propagator[4][1][6] = true;
-
-
-		//dense_propagator[4][5][2] = true;
-		//dense_propagator[4][5][3] = true;
-		//dense_propagator[4][5][0] = true;
-		//dense_propagator[4][5][5] = true;
-		//dense_propagator[4][4][1] = true;
-		//dense_propagator[4][4][2] = true;
-		//dense_propagator[4][4][0] = true;
-		//dense_propagator[4][4][5] = true;
-
-		//for (int i = 0; i < 6; i++) {
-		//	for (size_t j = 0; j < nb_oriented_tiles; j++) {
-		//		dense_propagator[0][i][j] = true;
-		//	}
-		//}
-
-
-		//dense_propagator[5][0][1] = true;
-		//dense_propagator[5][0][4] = true;
-		//dense_propagator[5][0][0] = true;
-		//dense_propagator[5][0][5] = true;
-		//dense_propagator[5][1][3] = true;
-		//dense_propagator[5][1][4] = true;
-		//dense_propagator[5][1][0] = true;
-		//dense_propagator[5][1][5] = true;
-
-
-		//dense_propagator[5][5][2] = true;
-		//dense_propagator[5][5][3] = true;
-		//dense_propagator[5][5][0] = true;
-		//dense_propagator[5][5][5] = true;
-		//dense_propagator[5][4][1] = true;
-		//dense_propagator[5][4][2] = true;
-		//dense_propagator[5][4][0] = true;
-		//dense_propagator[5][4][5] = true;
-
-
-		//dense_propagator[6][0][2] = true;
-		//dense_propagator[6][0][3] = true;
-		//dense_propagator[6][0][0] = true;
-		//dense_propagator[6][0][6] = true;
-		//dense_propagator[6][1][1] = true;
-		//dense_propagator[6][1][2] = true;
-		//dense_propagator[6][1][0] = true;
-		//dense_propagator[6][1][6] = true;
-
-
-		//dense_propagator[6][5][1] = true;
-		//dense_propagator[6][5][4] = true;
-		//dense_propagator[6][5][0] = true;
-		//dense_propagator[6][5][6] = true;
-		//dense_propagator[6][4][3] = true;
-		//dense_propagator[6][4][4] = true;
-		//dense_propagator[6][4][0] = true;
-		//dense_propagator[6][4][6] = true;
-
-
+		std::vector<std::array<std::vector<unsigned>, 6>> propagator(
+			nb_oriented_tiles);
 
+		// שӦõÿ任¶任שķڵķ
+		// ڱʱɣÿֻΪÿ
 		for (auto neighbor : neighbors) {
 			unsigned tile1 = std::get<0>(neighbor);
 			unsigned orientation1 = std::get<1>(neighbor);
 			unsigned tile2 = std::get<2>(neighbor);
 			unsigned orientation2 = std::get<3>(neighbor);
 			unsigned horizontal = std::get<4>(neighbor);
-			std::vector<std::vector<unsigned>> action_map1 =
-				Tile::generate_action_map(tiles[tile1].symmetry);
-			std::vector<std::vector<unsigned>> action_map2 =
-				Tile::generate_action_map(tiles[tile2].symmetry);
-
-			auto add = [&](unsigned action, unsigned direction) {
-				unsigned temp_orientation1 = action_map1[action][orientation1];
-				unsigned temp_orientation2 = action_map2[action][orientation2];
-				unsigned oriented_tile_id1 =
-					oriented_tile_ids[tile1][temp_orientation1];
-				unsigned oriented_tile_id2 =
-					oriented_tile_ids[tile2][temp_orientation2];
-				dense_propagator[oriented_tile_id1][direction][oriented_tile_id2] =
-					true;
-				direction = get_opposite_direction(direction);
-				dense_propagator[oriented_tile_id2][direction][oriented_tile_id1] =
-					true;
+			const CubeSymmetryTable &table1 = symmetry_table(tiles[tile1].symmetry);
+			const CubeSymmetryTable &table2 = symmetry_table(tiles[tile2].symmetry);
+			const uint64_t group = table1.group & table2.group;
+
+			auto add = [&](unsigned direction) {
+				for (unsigned g = 0; g < cube_group_size; g++) {
+					if (!(group >> g & 1)) {
+						continue;
+					}
+					unsigned oriented_tile_id1 =
+						oriented_tile_ids[tile1][table1.action[g][orientation1]];
+					unsigned oriented_tile_id2 =
+						oriented_tile_ids[tile2][table2.action[g][orientation2]];
+					unsigned temp_direction = cube_directions[g][direction];
+					propagator[oriented_tile_id1][temp_direction].push_back(oriented_tile_id2);
+					temp_direction = get_opposite_direction(temp_direction);
+					propagator[oriented_tile_id2][temp_direction].push_back(oriented_tile_id1);
+				}
 			};
+			// ˮƽĹtile2tile1ķ0ֱĹtile2tile1Ϸ·
 			if (horizontal == 1){
-				add(0, 0);
-				add(1, 4);
-				add(2, 5);
-				add(3, 1);
-				add(4, 5);
-				add(5, 1);
-				add(6, 0);
-				add(7, 4);
+				add(0);
 			}else{
-				for (auto itr = 0; itr < 8; itr++){
-					add(itr, 2);
-					add(itr, 3);
-				}
+				add(2);
+				add(3);
 			}
 		}
 
-		std::vector<std::array<std::vector<unsigned>, 6>> propagator(
-			nb_oriented_tiles);
-		for (size_t i = 0; i < nb_oriented_tiles; ++i) {
-			for (size_t j = 0; j < nb_oriented_tiles; ++j) {
-				for (size_t d = 0; d < 6; ++d) {
-					if (dense_propagator[i][d][j]) {
-						propagator[i][d].push_back(j);
-					}
-				}
+		for (std::array<std::vector<unsigned>, 6> &neighbors_of : propagator) {
+			for (std::vector<unsigned> &ids : neighbors_of) {
+				std::sort(ids.begin(), ids.end());
+				ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
 			}
 		}
-		cout << "test";
 		return propagator;
 	}
 
@@ -401,8 +259,8 @@ private:
 		get_tiles_weight(const std::vector<Tile> &tiles) {
 		std::vector<double> frequencies;
 		for (size_t i = 0; i < tiles.size(); i++){
-			for (size_t j = 0; j < tiles[i].data.size(); ++j){
-				frequencies.push_back(tiles[i].weight / tiles[i].data.size());
+			for (size_t j = 0; j < tiles[i].nb_orientations(); ++j){
+				frequencies.push_back(tiles[i].weight / tiles[i].nb_orientations());
 			}
 		}
 		return frequencies;
@@ -412,7 +270,7 @@ private:
 		get_tiles_low(const std::vector<Tile> &tiles) {
 		std::vector<int> height_low;
 		for (size_t i = 0; i < tiles.size(); i++) {
-			for (size_t j = 0; j < tiles[i].data.size(); ++j) {
+			for (size_t j = 0; j < tiles[i].nb_orientations(); ++j) {
 				height_low.push_back(tiles[i].low);
 			}
 		}
@@ -424,45 +282,160 @@ private:
 		get_tiles_high(const std::vector<Tile> &tiles) {
 		std::vector<int> height_high;
 		for (size_t i = 0; i < tiles.size(); i++) {
-			for (size_t j = 0; j < tiles[i].data.size(); ++j) {
+			for (size_t j = 0; j < tiles[i].nb_orientations(); ++j) {
 				height_high.push_back(tiles[i].high);
 			}
 		}
 		return height_high;
 	}
 
-	ObjModel id_to_tiling(Array3D<unsigned> ids) {
-		ObjModel tiling;
-		int cnt = 0;
-		for (unsigned i = 0; i < ids.height; i++){
-			for (unsigned j = 0; j < ids.width; j++){
-				for (unsigned k = 0; k < ids.depth; k++){
-					std::pair<unsigned, unsigned> oriented_tile =
-						id_to_oriented_tile[ids.get(i, j, k)];
-					ObjModel temp = tiles[oriented_tile.first].data[oriented_tile.second];
-					for (unsigned m = 0; m < temp.V.size(); m++) {
-						tiling.V.push_back({ temp.V[m].X + i, temp.V[m].Y + j, temp.V[m].Z + k });
-					}
-					for (unsigned m = 0; m < temp.VN.size(); m++) {
-						tiling.VN.push_back({ temp.VN[m].NX, temp.VN[m].NY, temp.VN[m].NZ });
-					}
-					for (unsigned m = 0; m < temp.F.size(); m++) {
-						tiling.F.push_back({ 
-							{ temp.F[m].V[0] + cnt, temp.F[m].V[1] + cnt, temp.F[m].V[2] + cnt }, 
-							{ temp.F[m].T[0] + cnt, temp.F[m].T[1] + cnt, temp.F[m].T[2] + cnt },
-							{ temp.F[m].N[0] + cnt, temp.F[m].N[1] + cnt, temp.F[m].N[2] + cnt }
-							});
+	/**
+	* wave״idתΪԭʼ״idid_to_oriented_tile±꣩
+	* ״ȼ۵ԭʼ״(seed, cell)ѡһ
+	*/
+	void expand_ids(Array3D<unsigned> &ids) const noexcept {
+		if (model->class_patterns.empty()){
+			return;
+		}
+		for (size_t i = 0; i < ids.data.size(); i++){
+			const std::vector<unsigned> &patterns = model->class_patterns[ids.data[i]];
+			ids.data[i] = patterns[counter_random(seed, i, 0, RandomStream::expand) %
+				patterns.size()];
+		}
+	}
+
+	/**
+	* ԭʼ״idexpand_idsģ
+	* cellغϵĶ㱻ϲʵĴש֮汻ȥassemble_mesh
+	*/
+	ObjModel id_to_tiling(const Array3D<unsigned> &ids) {
+		std::vector<OrientedMesh> meshes;
+		for (const std::pair<unsigned, unsigned> &oriented_tile : model->id_to_oriented_tile){
+			meshes.push_back(model->tiles[oriented_tile.first].get_oriented(oriented_tile.second));
+		}
+		return assemble_mesh(ids, meshes, &mesh_stats, 1e-5, options.mesh_threads);
+	}
+
+
+	public:
+	/**
+	* שģͣɱTilingWFC
+	*/
+	static std::shared_ptr<const TilingModel> compile(
+		const std::vector<Tile> &tiles,
+		const std::vector < std::tuple<unsigned, unsigned, unsigned, unsigned, unsigned>> &neighbors) {
+		auto model = std::make_shared<TilingModel>();
+		model->tiles = tiles;
+		std::tie(model->id_to_oriented_tile, model->oriented_tile_ids) =
+			generate_oriented_tile_ids(tiles);
+		model->compiled = CompiledModel::compile(get_tiles_weight(tiles),
+			generate_propagator(neighbors, tiles, model->id_to_oriented_tile,
+				model->oriented_tile_ids),
+			get_tiles_low(tiles), get_tiles_high(tiles));
+		return model;
+	}
+
+	/**
+	* ģͷmodel_analysis.hppĽשģͣȥֵܳ״
+	* ϲȼ۵״ģֻڷʱwaveߴͱ߽緽ʽ
+	*/
+	static std::shared_ptr<const TilingModel> reduce(
+		const std::shared_ptr<const TilingModel> &model, const ModelAnalysis &analysis) {
+		auto reduced = std::make_shared<TilingModel>(*model);
+		reduced->compiled = analysis.reduced;
+		reduced->class_patterns.clear();
+		for (const std::vector<unsigned> &patterns : analysis.class_patterns){
+			reduced->class_patterns.push_back({});
+			for (unsigned pattern : patterns){
+				if (model->class_patterns.empty()){
+					reduced->class_patterns.back().push_back(pattern);
+				}
+				else{
+					reduced->class_patterns.back().insert(reduced->class_patterns.back().end(),
+						model->class_patterns[pattern].begin(), model->class_patterns[pattern].end());
+				}
+			}
+		}
+		for (std::vector<unsigned> &ids : reduced->oriented_tile_ids){
+			std::vector<unsigned> classes;
+			for (unsigned id : ids){
+				if (analysis.pattern_class[id] >= 0){
+					classes.push_back(analysis.pattern_class[id]);
+				}
+			}
+			std::sort(classes.begin(), classes.end());
+			classes.erase(std::unique(classes.begin(), classes.end()), classes.end());
+			ids = classes;
+		}
+		return reduced;
+	}
+
+	/**
+	* 캯ʹùĴשģ
+	*/
+	TilingWFC(std::shared_ptr<const TilingModel> model,
+		const unsigned height, const unsigned width, const unsigned depth,
+		const TilingWFCOptions &options, int seed)
+		:model(model), options(options), seed(seed),
+		wfc(options.periodic_output, seed, model->compiled, depth, height, width,
+			options.heuristic, options.layout, options.propagation_threads) {}
+
+	/**
+	* 캯ӻĳʼԼտʼ
+	*/
+	TilingWFC(std::shared_ptr<const TilingModel> model,
+		const unsigned height, const unsigned width, const unsigned depth,
+		const TilingWFCOptions &options, int seed, WFCSnapshotCache &cache,
+		const ConstraintLayer *constraints = nullptr)
+		:model(model), options(options), seed(seed),
+		wfc(*cache.get({ model->compiled, depth, height, width, options.periodic_output,
+			options.heuristic, options.layout, options.propagation_threads,
+			"", constraints ? constraints->key() : ConstraintKey() },
+			[&](genericWFC &solver) {
+				if (constraints){
+					solver.add_constraints(*constraints);
+				}
+			}), seed) {}
+
+	/**
+	* ɴשidԼ㣬ʾԼֻôשз
+	*/
+	ConstraintLayer constraints_from_tiles(const Array3D<int> &tile_ids) const noexcept {
+		ConstraintLayer layer(tile_ids.height, tile_ids.width, tile_ids.depth,
+			model->compiled->nb_patterns);
+		for (unsigned i = 0; i < tile_ids.height; i++){
+			for (unsigned j = 0; j < tile_ids.width; j++){
+				for (unsigned k = 0; k < tile_ids.depth; k++){
+					if (tile_ids.get(i, j, k) >= 0){
+						layer.allow_only(i, j, k, model->oriented_tile_ids[tile_ids.get(i, j, k)]);
 					}
-					//WriteModel("c:/users/xugaoyuan/desktop/wfc_3d/myproj/results/asdas.obj", *tiling);
-					cnt += temp.V.size();
 				}
 			}
 		}
-		return tiling;
+		return layer;
 	}
 
+	/**
+	* ӦԼ㣬صһìܵcell
+	*/
+	std::optional<Contradiction> add_constraints(const ConstraintLayer &constraints) noexcept {
+		return wfc.add_constraints(constraints);
+	}
+
+	/**
+	* ʧеìܣgenericWFC::get_contradiction
+	*/
+	std::optional<Contradiction> get_contradiction() const noexcept {
+		return wfc.get_contradiction();
+	}
+
+	/**
+	* ʵʹõзʽgenericWFC::get_layout
+	*/
+	Layout get_layout() const noexcept {
+		return wfc.get_layout();
+	}
 
-	public:
 	/**
 	* 캯
 	*/
@@ -471,27 +444,41 @@ private:
 		const std::vector < std::tuple<unsigned, unsigned, unsigned, unsigned, unsigned>> &neighbors,
 		const unsigned height, const unsigned width, const unsigned depth,
 		const TilingWFCOptions &options, int seed)
-		:tiles(tiles),
-		id_to_oriented_tile(generate_oriented_tile_ids(tiles).first),
-		oriented_tile_ids(generate_oriented_tile_ids(tiles).second),
-		options(options),
-		wfc(options.periodic_output, seed, get_tiles_weight(tiles),
-			generate_propagator(neighbors, tiles, id_to_oriented_tile, oriented_tile_ids),
-			height, width, depth, get_tiles_low(tiles), get_tiles_high(tiles)) {}
+		:TilingWFC(compile(tiles, neighbors), height, width, depth, options, seed) {}
 
 	void getprocess() {
 		for (auto i = 0; i < wfc.tempprocess.size(); i++) {
 			auto temp = wfc.tempprocess[i];
+			expand_ids(temp);
 			ObjModel j = id_to_tiling(temp);
 			WriteModel("C:/Users/xugaoyuan/Desktop/wfc_3d/myproj/results/" + to_string(i) + ".obj", j);
 		}
 	}
 
+	/**
+	* 㷨ɹĻÿcellԭʼ״idid_to_oriented_tile±꣩
+	* write_id_grid
+	*/
+	std::optional<Array3D<unsigned>> run_ids() {
+		std::optional<Array3D<unsigned>> ids = wfc.run();
+		if (ids.has_value()){
+			expand_ids(*ids);
+		}
+		return ids;
+	}
+
+	/**
+	* һrunģʱϲ㡢ȥڲͳ
+	*/
+	const MeshAssemblyStats &get_mesh_stats() const noexcept {
+		return mesh_stats;
+	}
+
 	/**
 	* 㷨
 	*/
 	std::optional<ObjModel> run() {
-		auto a = wfc.run();
+		auto a = run_ids();
 		
 		if (a == std::nullopt){
 			return std::nullopt;
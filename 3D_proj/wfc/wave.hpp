@@ -1,24 +1,61 @@
 #ifndef WFC_WAVE_HPP_
 #define WFC_WAVE_HPP_
 
+#include <algorithm>
 #include <iostream>
 #include <limits>
 #include <math.h>
+#include <queue>
 #include <random>
 #include <stdint.h>
+#include <memory>
 #include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "../../common/wfc_engine.hpp"
 #include "array3D.hpp"
+#include "atomic_ops.hpp"
+#include "cell_layout.hpp"
+#include "compiled_model.hpp"
+#include "counter_rng.hpp"
+#include "hilbert.hpp"
 
 /**
 * ṹֵ
 * ÿζ´˽ṹ
+* dataͬҳ洢ֻб޸ĹҳŻ䣨PagedArray
 */
 struct EntropyMemoisation{
-	std::vector<double> plogp_sum;	// The sum of p'(pattern) * log(p'(pattern))
-	std::vector<double> sum;	// The sum of p'(pattern)
-	std::vector<double> log_sum;	//The log of sum
-	std::vector<unsigned> nb_patterns;	// The number of pattern present
-	std::vector<double> entropy;	// The entropy of the cell
+	PagedArray<double> plogp_sum;	// The sum of p'(pattern) * log(p'(pattern))
+	PagedArray<double> sum;	// The sum of p'(pattern)
+	PagedArray<double> log_sum;	//The log of sum
+	PagedArray<unsigned> nb_patterns;	// The number of pattern present
+	PagedArray<double> entropy;	// The entropy of the cell
+};
+
+/**
+* xλ1λãxΪ0
+*/
+inline unsigned count_trailing_zeros(uint64_t x) noexcept {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return index;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+/**
+* ѡһ۲cellʽ
+*/
+enum class Heuristic {
+	entropy,	// ϢСcellС
+	mrv,	// ʣ״ٵcellһģʽ²Ϣ
+	scanline,	// xyz˳˳򣩵ĵһδȷcell
+	frontier,	// ȷcellڵcellϢСһʹȷһƬ
+	hilbert	// ϣߵĵһδȷcell
 };
 
 /**
@@ -27,19 +64,9 @@ struct EntropyMemoisation{
 class Wave{
 private:
 	/**
-	* ״
-	*/
-	const std::vector<double> patterns_frequencies;
-
-	/**
-	* p * log(p)
-	*/
-	const std::vector<double> plogp_patterns_frequencies;
-
-	/**
-	* min (p * log(p)) / 2
+	* ıģͣʡp * log(p)ȣ
 	*/
-	const double half_min_plogp;
+	std::shared_ptr<const CompiledModel> model;
 
 	/**
 	* Ҫı
@@ -51,35 +78,221 @@ private:
 	*/
 	bool is_impossible;
 
+	/**
+	* һ״ƳcellûΪ-1
+	*/
+	int contradiction_index;
+
 	/**
 	* ͬ״
 	*/
 	const unsigned nb_patterns;
 
-	Array3D<uint8_t> data;
+	/**
+	* ÿcellʹõ64λֵģ͵״޾pattern_bound_words
+	*/
+	const unsigned nb_words;
+
+	/**
+	* ÿcell״λϴ洢
+	* data.cell(index)[pattern / 64]ĵpattern % 64λΪ0״ܷcell
+	* cellʼʱͬһʼҳҳڵһα޸ʱŷ䣬ԳʼʱwaveĴС޹
+	*/
+	PagedArray<uint64_t> data;
+
+	/**
+	* select_cellʹõʽ
+	*/
+	const Heuristic heuristic;
 
 	/**
-	* p * log(p)
+	* mrvʹõͰУbuckets[n]ʣn״celln >= 2
+	* bucket_position[index]ΪcellͰеλãmin_bucketµͰΪ
+	* cellǰ˳򱻸£refresh_modifiedͰе˳зʽ߳޹
 	*/
-	static std::vector<double>
-		get_plogp(const std::vector<double> &distribution) noexcept {
-		std::vector<double> plogp;
-		for (unsigned i = 0; i < distribution.size(); i++){
-			plogp.push_back(distribution[i] * log(distribution[i]));
+	std::vector<std::vector<unsigned>> buckets;
+	std::vector<unsigned> bucket_position;
+	unsigned min_bucket;
+
+	/**
+	* scanlinehilbertʹãorder˳۲cellΪʱ˳
+	* cursor֮ǰcellȷ
+	*/
+	std::shared_ptr<const std::vector<unsigned>> order;
+	unsigned cursor = 0;
+
+	/**
+	* frontierʹãȷcellڵδȷcellСѣϢأcell
+	* cellϢÿθıʱµʱڶѶʱ
+	*/
+	std::priority_queue<std::pair<double, unsigned>,
+		std::vector<std::pair<double, unsigned>>,
+		std::greater<std::pair<double, unsigned>>> frontier;
+	std::vector<uint8_t> in_frontier;
+
+	/**
+	* бƳ״صļ¼δµcellظrefresh_modified
+	*/
+	std::vector<unsigned> modified;
+
+	/**
+	* ʽҪϢʱtrue
+	*/
+	bool memoise_entropy() const noexcept {
+		return heuristic == Heuristic::entropy || heuristic == Heuristic::frontier;
+	}
+
+	/**
+	* cellfrontierϢ
+	*/
+	void push_frontier(unsigned index) noexcept {
+		if (memoisation.nb_patterns[index] >= 2){
+			in_frontier[index] = true;
+			frontier.push({ memoisation.entropy[index], layout.linear(index) });
 		}
-		return plogp;
 	}
 
 	/**
-	* minv/ 2
+	* ȷcellδȷھӼfrontier
 	*/
-	static double get_half_min(const std::vector<double> &v) noexcept {
-		double half_min = std::numeric_limits<double>::infinity();
-		for (unsigned i = 0; i < v.size(); i++){
-			half_min = std::min(half_min, v[i] / 2.0);
+	void expand_frontier(unsigned index) noexcept {
+		unsigned z, y, x;
+		layout.coordinates(index, z, y, x);
+		if (x > 0){
+			push_frontier(layout.index(z, y, x - 1));
+		}
+		if (x + 1 < width){
+			push_frontier(layout.index(z, y, x + 1));
+		}
+		if (y > 0){
+			push_frontier(layout.index(z, y - 1, x));
+		}
+		if (y + 1 < height){
+			push_frontier(layout.index(z, y + 1, x));
+		}
+		if (z > 0){
+			push_frontier(layout.index(z - 1, y, x));
+		}
+		if (z + 1 < depth){
+			push_frontier(layout.index(z + 1, y, x));
 		}
-		return half_min;
 	}
+
+	/**
+	* cell״ƶµͰ
+	*/
+	void update_nb_patterns(unsigned index, unsigned nb) noexcept {
+		if (heuristic == Heuristic::mrv){
+			unsigned old_nb = memoisation.nb_patterns[index];
+			if (old_nb >= 2){
+				std::vector<unsigned> &bucket = buckets[old_nb];
+				unsigned last = bucket.back();
+				bucket[bucket_position[index]] = last;
+				bucket_position[last] = bucket_position[index];
+				bucket.pop_back();
+			}
+			if (nb >= 2){
+				bucket_position[index] = buckets[nb].size();
+				buckets[nb].push_back(index);
+				min_bucket = std::min(min_bucket, nb);
+			}
+		}
+		memoisation.nb_patterns.write(index) = nb;
+		if (heuristic == Heuristic::frontier){
+			if (nb == 1){
+				expand_frontier(index);
+			}
+			else if (in_frontier[index]){
+				push_frontier(index);
+			}
+		}
+		if (nb == 0){
+			set_impossible(index);
+		}
+	}
+
+	/**
+	* waveìܣ¼һìܵcell
+	*/
+	void set_impossible(unsigned index) noexcept {
+		if (!is_impossible){
+			contradiction_index = index;
+		}
+		is_impossible = true;
+	}
+
+	/**
+	* ״ڵcellеλ
+	* WordsΪʱ֪ÿcellδ֪Ϊ0
+	*/
+	template <unsigned Words>
+	static unsigned word_offset(unsigned pattern) noexcept {
+		return Words == 1 ? 0 : pattern / 64;
+	}
+
+	/**
+	* سʼcell״
+	*/
+	static std::vector<uint64_t> initial_cell(unsigned nb_patterns, unsigned nb_words) {
+		std::vector<uint64_t> cell(nb_words, 0);
+		for (unsigned pattern = 0; pattern < nb_patterns; pattern++){
+			cell[pattern / 64] |= (uint64_t)1 << (pattern % 64);
+		}
+		return cell;
+	}
+
+	/**
+	* ״cellƳصļ¼
+	*/
+	void forget(unsigned index, unsigned pattern) noexcept {
+		memoisation.sum.write(index) -= model->patterns_frequencies[pattern];
+		if (memoise_entropy()){
+			memoisation.plogp_sum.write(index) -= model->plogp_patterns_frequencies[pattern];
+			memoisation.log_sum.write(index) = log(memoisation.sum[index]);
+			memoisation.entropy.write(index) = 
+				memoisation.log_sum[index] - memoisation.plogp_sum[index] / memoisation.sum[index];
+		}
+		update_nb_patterns(index, memoisation.nb_patterns[index] - 1);
+	}
+
+	/**
+	* ÿcellWordsʱfor_each_patternword_offset
+	*/
+	template <unsigned Words, typename F>
+	void visit_patterns(unsigned index, F &f) const {
+		const unsigned words = Words != 0 ? Words : nb_words;
+		const uint64_t *cell = data.cell<Words>(index);
+		for (unsigned w = 0; w < words; w++){
+			uint64_t word = cell[w];
+			while (word){
+				f(w * 64 + count_trailing_zeros(word));
+				word &= word - 1;
+			}
+		}
+	}
+
+	/**
+	* ÿcellWordsʱchoose_patternword_offset
+	*/
+	template <unsigned Words>
+	unsigned choose_in(unsigned index, double random_value) const noexcept {
+		const unsigned words = Words != 0 ? Words : nb_words;
+		const uint64_t *cell = data.cell<Words>(index);
+		unsigned chosen_value = nb_patterns - 1;
+		for (unsigned w = 0; w < words; w++){
+			uint64_t word = cell[w];
+			while (word){
+				chosen_value = w * 64 + count_trailing_zeros(word);
+				word &= word - 1;
+				random_value -= model->patterns_frequencies[chosen_value];
+				if (random_value <= 0){
+					return chosen_value;
+				}
+			}
+		}
+		return chosen_value;
+	}
+
 public:
 	/**
 	* waveߴ
@@ -89,109 +302,374 @@ public:
 	const unsigned depth;
 	const unsigned size;
 
+	/**
+	* cellڴезʽcellڴе
+	*/
+	const CellLayout layout;
+
 	/**
 	* ʼ
 	*/
 	Wave(unsigned height, unsigned width, unsigned depth,
-		const std::vector<double> &patterns_frequencies) noexcept
-		: patterns_frequencies(patterns_frequencies),
-		plogp_patterns_frequencies(get_plogp(patterns_frequencies)),
-		half_min_plogp(get_half_min(plogp_patterns_frequencies)),
-		is_impossible(false), nb_patterns(patterns_frequencies.size()),
-		data(width * height * depth, width * height * depth, nb_patterns, 1),
-		width(width), height(height), depth(depth), size(width * height * depth) {
-		double base_entropy = 0;
-		double base_s = 0;
-		double half_min_plogp = std::numeric_limits<double>::infinity();
-		for (unsigned i = 0; i < nb_patterns; i++){
-			half_min_plogp =
-				std::min(half_min_plogp, plogp_patterns_frequencies[i] / 2.0);
-			base_entropy += plogp_patterns_frequencies[i];
-			base_s += patterns_frequencies[i];
-		}
-		double log_base_s = log(base_s);
-		double entropy_base = log_base_s - base_entropy / base_s;
-		memoisation.plogp_sum = std::vector<double>(width * height * depth, base_entropy);
-		memoisation.sum = std::vector<double>(width * height * depth, base_s);
-		memoisation.log_sum = std::vector<double>(width * height * depth, log_base_s);
-		memoisation.nb_patterns = std::vector<unsigned>(width * height * depth, nb_patterns);
-		memoisation.entropy = std::vector<double>(width * height * depth, entropy_base);
+		std::shared_ptr<const CompiledModel> model,
+		Heuristic heuristic = Heuristic::entropy, Layout layout = Layout::linear) noexcept
+		: model(model), is_impossible(false), contradiction_index(-1),
+		nb_patterns(model->nb_patterns),
+		nb_words(pattern_bound_words(model->nb_patterns)),
+		data(width * height * depth, initial_cell(model->nb_patterns, nb_words)),
+		heuristic(heuristic), min_bucket(model->nb_patterns + 1), width(width), height(height), depth(depth), size(width * height * depth),
+		layout(width, height, depth, layout) {
+		memoisation.plogp_sum = PagedArray<double>(size, { model->base_plogp_sum });
+		memoisation.sum = PagedArray<double>(size, { model->base_sum });
+		memoisation.log_sum = PagedArray<double>(size, { model->base_log_sum });
+		memoisation.nb_patterns = PagedArray<unsigned>(size, { nb_patterns });
+		memoisation.entropy = PagedArray<double>(size, { model->base_entropy });
+		if (heuristic == Heuristic::mrv){
+			buckets.resize(nb_patterns + 1);
+			bucket_position.resize(size);
+			if (nb_patterns >= 2){
+				for (unsigned i = 0; i < size; i++){
+					bucket_position[this->layout.from_linear(i)] = i;
+					buckets[nb_patterns].push_back(this->layout.from_linear(i));
+				}
+				min_bucket = nb_patterns;
+			}
+		}
+		if (heuristic == Heuristic::hilbert){
+			// ϣߵ˳תΪе
+			std::vector<unsigned> cells = hilbert_order(height, width, depth);
+			for (unsigned &cell : cells){
+				cell = this->layout.from_linear(cell);
+			}
+			order = std::make_shared<const std::vector<unsigned>>(std::move(cells));
+		}
+		if (heuristic == Heuristic::frontier){
+			in_frontier.resize(size, false);
+		}
 	}
 
 	/**
 	* true״ܷcell
 	*/
 	bool get(unsigned index, unsigned pattern) const noexcept {
-		return data.get(index, index, pattern);
+		return (data.cell(index)[pattern / 64] >> (pattern % 64)) & 1;
 	}
-    
+
+	/**
+	* ˳cellпܵ״ֻʷǿյ
+	* fпƳcellе״
+	*/
+	template <typename F> void for_each_pattern(unsigned index, F f) const {
+		with_pattern_bound(nb_patterns, [&](auto bound){
+			visit_patterns<decltype(bound)::nb_words>(index, f);
+		});
+	}
+
+	/**
+	* cellԿܵ״Ƶ֮ͣѴ洢
+	*/
+	double get_sum(unsigned index) const noexcept {
+		return memoisation.sum[index];
+	}
+
+	/**
+	* ݷֲѡcellеһ״random_value[0, get_sum(index)]оȷֲ
+	* ֻԿܵ״random_valueܲᵽ0ʱѡһ״
+	*/
+	unsigned choose_pattern(unsigned index, double random_value) const noexcept {
+		return with_pattern_bound(nb_patterns, [&](auto bound){
+			return choose_in<decltype(bound)::nb_words>(index, random_value);
+		});
+	}
+
 	/**
 	* true״ܷŽcellij k
 	*/
-	bool get(unsigned i, unsigned j, unsigned k, unsigned pattern) {
-		return get(i * width * depth + j * depth + k, pattern);
+	bool get(unsigned i, unsigned j, unsigned k, unsigned pattern) const noexcept {
+		return get(layout.index(i, j, k), pattern);
+	}
+
+	/**
+	* дʹãԭӵƳcellе״صļ¼֮refresh
+	* ״ǱεƳģtrueʱemptiedʾcellǷûпܵ״
+	* Wordsremoveͬcellҳڵһα޸ʱ䣬߳̿ͬʱ䣨PagedArray::write_cell_concurrent
+	*/
+	template <unsigned Words>
+	bool remove_concurrent(unsigned index, unsigned pattern, bool &emptied) noexcept {
+		const unsigned words = Words != 0 ? Words : nb_words;
+		const uint64_t mask = (uint64_t)1 << (pattern % 64);
+		uint64_t *cell = data.write_cell_concurrent<Words>(index);
+		uint64_t old_word = atomic_fetch_and(cell[word_offset<Words>(pattern)], ~mask);
+		if (!(old_word & mask)){
+			return false;
+		}
+		emptied = true;
+		for (unsigned w = 0; w < words && emptied; w++){
+			emptied = (w == pattern / 64 ? old_word & ~mask : atomic_load(cell[w])) == 0;
+		}
+		return true;
+	}
+
+	/**
+	* λ¼cellصļ¼ڴ֮ãrefresh_modified
+	* ֻȡcellʣµ״Ƴ˳޹
+	*/
+	void refresh(unsigned index) noexcept {
+		double sum = 0;
+		double plogp_sum = 0;
+		unsigned nb = 0;
+		for_each_pattern(index, [&](unsigned k){
+			sum += model->patterns_frequencies[k];
+			plogp_sum += model->plogp_patterns_frequencies[k];
+			nb++;
+		});
+		memoisation.sum.write(index) = sum;
+		if (memoise_entropy()){
+			memoisation.plogp_sum.write(index) = plogp_sum;
+			memoisation.log_sum.write(index) = log(sum);
+			memoisation.entropy.write(index) = memoisation.log_sum[index] - plogp_sum / sum;
+		}
+		update_nb_patterns(index, nb);
 	}
 
 	/**
 	* cellе״
 	*/
 	void set(unsigned index, unsigned pattern, bool value) noexcept {
-		bool old_value = data.get(index, index, pattern);
+		bool old_value = get(index, pattern);
 		if (old_value == value)
 		{
 			return;
 		}
-		data.get(index, index, pattern) = value;
-		memoisation.plogp_sum[index] -= plogp_patterns_frequencies[pattern];
-		memoisation.sum[index] -= patterns_frequencies[pattern];
-		memoisation.log_sum[index] = log(memoisation.sum[index]);
-		memoisation.nb_patterns[index]--;
-		memoisation.entropy[index] = 
-			memoisation.log_sum[index] - memoisation.plogp_sum[index] / memoisation.sum[index];
-		if (memoisation.nb_patterns[index] == 0){
-			is_impossible = true;
+		if (value){
+			data.write_cell(index)[pattern / 64] |= (uint64_t)1 << (pattern % 64);
 		}
+		else{
+			data.write_cell(index)[pattern / 64] &= ~((uint64_t)1 << (pattern % 64));
+		}
+		forget(index, pattern);
+	}
+
+	/**
+	* ʹãƳcellе״cellʱì
+	* صļ¼ڴݽrefresh_modified£ʹ봫ݵ˳߳޹
+	* WordsΪʱ֪ÿcellδ֪Ϊ0ɰģ͵״ޱĴݺʹ
+	*/
+	template <unsigned Words> void remove(unsigned index, unsigned pattern) noexcept {
+		const unsigned words = Words != 0 ? Words : nb_words;
+		uint64_t *cell = data.write_cell<Words>(index);
+		uint64_t &word = cell[word_offset<Words>(pattern)];
+		const uint64_t mask = (uint64_t)1 << (pattern % 64);
+		if (!(word & mask)){
+			return;
+		}
+		word &= ~mask;
+		mark_modified(index);
+		bool emptied = true;
+		for (unsigned w = 0; w < words && emptied; w++){
+			emptied = cell[w] == 0;
+		}
+		if (emptied){
+			set_impossible(index);
+		}
+	}
+
+	/**
+	* ¼cellڴб޸ģصļ¼֮refresh_modified
+	*/
+	void mark_modified(unsigned index) noexcept {
+		modified.push_back(index);
+	}
+
+	/**
+	* ˳λ¼㴫б޸ĵcellصļ¼refresh
+	* ¼ֻȡcellʣµ״Ե̺߳Ͳдݵõwaveͬ
+	* ˳ʹmrvͰ˳зʽ޹
+	*/
+	void refresh_modified() noexcept {
+		if (layout.layout == Layout::linear){
+			std::sort(modified.begin(), modified.end());
+		}
+		else{
+			std::sort(modified.begin(), modified.end(), [&](unsigned a, unsigned b){
+				return layout.linear(a) < layout.linear(b);
+			});
+		}
+		modified.erase(std::unique(modified.begin(), modified.end()), modified.end());
+		for (unsigned index : modified){
+			refresh(index);
+		}
+		modified.clear();
+	}
+
+	/**
+	* Ƴcellв״ֻһ
+	*/
+	void restrict(unsigned index, const uint8_t *allowed) noexcept {
+		unsigned removed = 0;
+		for_each_pattern(index, [&](unsigned k){
+			if (!allowed[k]){
+				data.write_cell(index)[k / 64] &= ~((uint64_t)1 << (k % 64));
+				memoisation.sum.write(index) -= model->patterns_frequencies[k];
+				if (memoise_entropy()){
+					memoisation.plogp_sum.write(index) -= model->plogp_patterns_frequencies[k];
+				}
+				removed++;
+			}
+		});
+		if (removed == 0){
+			return;
+		}
+		if (memoise_entropy()){
+			memoisation.log_sum.write(index) = log(memoisation.sum[index]);
+			memoisation.entropy.write(index) =
+				memoisation.log_sum[index] - memoisation.plogp_sum[index] / memoisation.sum[index];
+		}
+		update_nb_patterns(index, memoisation.nb_patterns[index] - removed);
+	}
+
+	/**
+	* صһìܵcellû򷵻-1
+	*/
+	int get_contradiction_index() const noexcept {
+		return contradiction_index;
+	}
+
+	/**
+	* truecellûпܵ״
+	*/
+	bool impossible() const noexcept {
+		return is_impossible;
 	}
 
 	/**
 	* ͼcelli j zֵ
 	*/
 	void set(unsigned i, unsigned j, unsigned k, unsigned pattern, bool value) noexcept {
-		set(i * width + j, pattern, value);
+		set(layout.index(i, j, k), pattern, value);
 	}
 
 	/**
 	* زΪ0Сص
 	* мcontradictionwaveУ򷵻-2
 	* еcell壬-1
+	* ÿcellֻȡ(seed, cell, step)ʱѡСcell
+	* Խ˳зʽ޹أΪ0ʱ
 	*/
-	int get_min_entropy(std::minstd_rand &gen) const noexcept {
+	int get_min_entropy(uint64_t seed, unsigned step) const noexcept {
 		if (is_impossible){
 			return -2;
 		}
-		std::uniform_real_distribution<> dis(0, abs(half_min_plogp));
+		const double max_noise = abs(model->half_min_plogp);
 
 		double min = std::numeric_limits<double>::infinity();
 		int argmin = -1;
 
-		for (unsigned i = 0; i < size; i++){
-			double nb_patterns = memoisation.nb_patterns[i];
-			if (nb_patterns == 1){
+		// entropyҳҳcell2ݣunsignedҳСdoubleҳһҳеnb_patternsҲ
+		const unsigned page_cells = memoisation.entropy.get_page_cells();
+		for (unsigned begin = 0; begin < size; begin += page_cells){
+			// ûб޸ĹҳеcellضΪbase_entropyСminʱҳ
+			if (!memoisation.entropy.is_written(begin / page_cells) && model->base_entropy > min){
 				continue;
 			}
+			const double *entropies = memoisation.entropy.cell<1>(begin);
+			const unsigned *nb_patterns = memoisation.nb_patterns.cell<1>(begin);
+			const unsigned end = std::min(size, begin + page_cells);
+			for (unsigned i = begin; i < end; i++){
+				if (nb_patterns[i - begin] == 1){
+					continue;
+				}
 
-			double entropy = memoisation.entropy[i];
+				double entropy = entropies[i - begin];
 
-			if (entropy <= min){
-				double noise = dis(gen);
-				if (entropy + noise < min){
-					min = entropy + noise;
-					argmin = i;
+				if (entropy <= min){
+					double noise = counter_uniform(seed, layout.linear(i), step,
+						RandomStream::noise, max_noise);
+					if (entropy + noise < min || (entropy + noise == min
+						&& layout.linear(i) < layout.linear(argmin))){
+						min = entropy + noise;
+						argmin = i;
+					}
 				}
 			}
 		}
 		return argmin;
 	}
+
+	/**
+	* ͰO(1)зʣ״ٵδȷcellеһ2Dwaveͬ
+	* Ͱе˳ֻȡڸµ˳򣨼bucketsԽзʽ߳޹
+	* ֵget_min_entropyͬ
+	*/
+	int get_min_remaining(uint64_t seed, unsigned step) noexcept {
+		if (is_impossible){
+			return -2;
+		}
+		while (min_bucket <= nb_patterns && buckets[min_bucket].empty()){
+			min_bucket++;
+		}
+		if (min_bucket > nb_patterns){
+			return -1;
+		}
+		const std::vector<unsigned> &bucket = buckets[min_bucket];
+		return bucket[counter_random(seed, 0, step, RandomStream::select) % bucket.size()];
+	}
+
+	/**
+	* ˳еһδȷcellȷcell
+	* ֵget_min_entropyͬ
+	*/
+	int get_next_in_order() noexcept {
+		if (is_impossible){
+			return -2;
+		}
+		while (cursor < size){
+			unsigned index = order ? (*order)[cursor] : layout.from_linear(cursor);
+			if (memoisation.nb_patterns[index] != 1){
+				return index;
+			}
+			cursor++;
+		}
+		return -1;
+	}
+
+	/**
+	* frontierϢСcell
+	* frontierΪʱһι۲죬ȷھӶȷʹget_min_entropyʼµ
+	*/
+	int get_min_frontier(uint64_t seed, unsigned step) noexcept {
+		if (is_impossible){
+			return -2;
+		}
+		while (!frontier.empty()){
+			std::pair<double, unsigned> top = frontier.top();
+			unsigned index = layout.from_linear(top.second);
+			if (memoisation.nb_patterns[index] >= 2 && memoisation.entropy[index] == top.first){
+				return index;
+			}
+			frontier.pop();
+		}
+		return get_min_entropy(seed, step);
+	}
+
+	/**
+	* ʽһ۲cell
+	* мcontradictionwaveУ򷵻-2
+	* еcell壬-1
+	*/
+	int select_cell(uint64_t seed, unsigned step) noexcept {
+		switch (heuristic){
+		case Heuristic::mrv:
+			return get_min_remaining(seed, step);
+		case Heuristic::scanline:
+		case Heuristic::hilbert:
+			return get_next_in_order();
+		case Heuristic::frontier:
+			return get_min_frontier(seed, step);
+		default:
+			return get_min_entropy(seed, step);
+		}
+	}
 };
 
 #endif // WFC_WAVE_HPP_
@@ -57,6 +57,10 @@ static const XMVECTORF32 s_LightDir = { -0.577f, 0.577f, -0.577f, 0.f };
 float                       g_fModelPuffiness = 0.0f;
 bool                        g_bSpinning = true;
 void in_wfc();
+void benchmark_heuristics();
+void benchmark_layouts();
+void benchmark_overlapping();
+void benchmark_symmetry();
 
 //--------------------------------------------------------------------------------------
 // UI IDs
@@ -429,6 +433,18 @@ void CALLBACK OnKeyboard( UINT nChar, bool bKeyDown, bool bAltDown, void* pUserC
             case VK_F1:
 				in_wfc();
                 break;
+            case VK_F4:
+				benchmark_heuristics();
+                break;
+            case VK_F5:
+				benchmark_layouts();
+                break;
+            case VK_F6:
+				benchmark_overlapping();
+                break;
+            case VK_F7:
+				benchmark_symmetry();
+                break;
         }
     }
 }
@@ -567,28 +583,32 @@ void InitApp()
 #include "array4d.hpp"
 #include <optional>
 #include "tilesmap.hpp"
+#include "contradiction_heatmap.hpp"
 #include <unordered_set>
 #include "rapidxml_utils.hpp"
 #include "model.hpp"
+#include "overlapping_wfc.hpp"
+#include "id_grid.hpp"
 
 using namespace std;
 using namespace rapidxml;
 
+/**
+* ש̬֣data.xmlеsymmetryԣ
+*/
+const vector<pair<string, Symmetry>> symmetry_names = {
+	{ "X", Symmetry::X }, { "T", Symmetry::T }, { "L", Symmetry::L }, { "I", Symmetry::I },
+	{ "B", Symmetry::B }, { "W", Symmetry::W }, { "C", Symmetry::C }, { "E", Symmetry::E },
+	{ "F", Symmetry::F }, { "M", Symmetry::M } };
+
 /**
 * Ϣһת
 */
 Symmetry to_symmetry(const string &symmetry_name) {
-	if (symmetry_name == "T") {
-		return Symmetry::T;
-	}
-	if (symmetry_name == "L") {
-		return Symmetry::L;
-	}
-	if (symmetry_name == "X") {
-		return Symmetry::X;
-	}
-	if (symmetry_name == "I") {
-		return Symmetry::I;
+	for (const pair<string, Symmetry> &symmetry : symmetry_names) {
+		if (symmetry.first == symmetry_name) {
+			return symmetry.second;
+		}
 	}
 
 	throw symmetry_name + "is an invalid Symmetry";
@@ -707,21 +727,38 @@ read_neighbors(xml_node<> *root_node) {
 
 
 
-void read_simpletiled_instance(xml_node<> *node, const string &current_dir) noexcept {
-	
-	/**
-	* ȡҪ
-	*/
-	string name = rapidxml::get_attribute(node, "name");
-	string subset = rapidxml::get_attribute(node, "subset", "tiles");
-	bool periodic_output = (rapidxml::get_attribute(node, "periodic", "False") == "True");
-	unsigned width = stoi(rapidxml::get_attribute(node, "width", "5"));
-	unsigned height = stoi(rapidxml::get_attribute(node, "height", "5"));
-	unsigned depth = stoi(rapidxml::get_attribute(node, "depth", "5"));
+/**
+* ʽ֣samples.xmlеheuristicԣ
+*/
+const vector<pair<string, Heuristic>> heuristic_names = {
+	{ "entropy", Heuristic::entropy }, { "mrv", Heuristic::mrv },
+	{ "scanline", Heuristic::scanline }, { "frontier", Heuristic::frontier },
+	{ "hilbert", Heuristic::hilbert } };
 
-	/**
-	* ȡԼ
-	*/
+/**
+* benchmark_heuristicsĬϱȽϵʽfrontierhilbertȻsamples.xmlѡ
+* ڲԵĴשǵìܱscanline࣬Ҳ죬ԲĬб
+*/
+const vector<pair<string, Heuristic>> benchmarked_heuristics = {
+	{ "entropy", Heuristic::entropy }, { "mrv", Heuristic::mrv },
+	{ "scanline", Heuristic::scanline } };
+
+/**
+* ϢתΪѡcellʽ
+*/
+Heuristic to_heuristic(const string &heuristic_name) {
+	for (const pair<string, Heuristic> &heuristic : heuristic_names) {
+		if (heuristic.first == heuristic_name) {
+			return heuristic.second;
+		}
+	}
+	return Heuristic::entropy;
+}
+
+/**
+* ȡשԼģ
+*/
+std::shared_ptr<const TilingModel> load_tiling_model(const string &subset) {
 	ifstream config_file("../../Media/test/data.xml");
 	vector<char> buffer((istreambuf_iterator<char>(config_file)), istreambuf_iterator<char>());
 	buffer.push_back('\0');
@@ -762,12 +799,62 @@ void read_simpletiled_instance(xml_node<> *node, const string &current_dir) noex
 			tiles_id[neighbor2], orientation2, horizontal));
 	}
 
+	return TilingWFC<ObjModel>::compile(tiles, neighbors_ids);
+}
+
+void read_simpletiled_instance(xml_node<> *node, const string &current_dir) noexcept {
+	
+	/**
+	* ȡҪ
+	*/
+	string name = rapidxml::get_attribute(node, "name");
+	string subset = rapidxml::get_attribute(node, "subset", "tiles");
+	bool periodic_output = (rapidxml::get_attribute(node, "periodic", "False") == "True");
+	unsigned width = stoi(rapidxml::get_attribute(node, "width", "5"));
+	unsigned height = stoi(rapidxml::get_attribute(node, "height", "5"));
+	unsigned depth = stoi(rapidxml::get_attribute(node, "depth", "5"));
+	Heuristic heuristic = to_heuristic(rapidxml::get_attribute(node, "heuristic", "entropy"));
+	Layout layout = (rapidxml::get_attribute(node, "layout", "linear") == "brick") ?
+		Layout::brick : Layout::linear;
+	unsigned propagation_threads = stoi(rapidxml::get_attribute(node, "threads", "0"));
+	bool reduce = (rapidxml::get_attribute(node, "reduce", "False") == "True");
+	// formatΪidsʱֻשid񣨼id_grid.hpprleΪTrueʱѹ
+	bool export_ids = (rapidxml::get_attribute(node, "format", "obj") == "ids");
+	bool compress_ids = (rapidxml::get_attribute(node, "rle", "False") == "True");
+
+	std::shared_ptr<const TilingModel> model = load_tiling_model(subset);
+	// ȷģͣȥֵܳĴשϲȼ۵Ĵשÿе״
+	if (reduce){
+		ModelAnalysis analysis = analyze_model(model->compiled, depth, height, width, periodic_output);
+		cout << analysis.report();
+		model = TilingWFC<ObjModel>::reduce(model, analysis);
+	}
+	WFCSnapshotCache cache;
 	for (unsigned test = 0; test < 10; test++){
 		int seed = random_device()();
-		TilingWFC<ObjModel> wfc(tiles, neighbors_ids, height, width, depth, { periodic_output }, seed);
+		TilingWFC<ObjModel> wfc(model, height, width, depth,
+			{ periodic_output, heuristic, layout, propagation_threads }, seed, cache);
+		if (test == 0 && wfc.get_layout() != layout){
+			cout << name << ": brick layout needs sizes multiple of 4, using linear" << endl;
+		}
+		if (export_ids){
+			std::optional<Array3D<unsigned>> ids = wfc.run_ids();
+			if (ids.has_value()){
+				write_id_grid("../results/" + name + ".wfcg", *ids, compress_ids,
+					&model->id_to_oriented_tile);
+				cout << name << "finished!" << endl;
+				break;
+			}
+			cout << "failed!" << endl;
+			continue;
+		}
 		std::optional<ObjModel> success = wfc.run();
 		if (success.has_value()){
 			WriteModel("../results/" + name + ".obj", *success);
+			const MeshAssemblyStats &stats = wfc.get_mesh_stats();
+			cout << "mesh: " << stats.vertices_in << " -> " << stats.vertices_out << " vertices, "
+				<< stats.faces_in << " -> " << stats.faces_out << " faces, "
+				<< stats.bytes_in() - stats.bytes_out() << " bytes saved" << endl;
 			cout << name << "finished!" << endl;
 			break;
 		}
@@ -801,4 +888,127 @@ void in_wfc() {
 	int elapsed_s = std::chrono::duration_cast<std::chrono::seconds> (end - start).count();
 	int elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds> (end - start).count();
 	std::cout << "All done in" << elapsed_s << "s, " << elapsed_ms % 1000 << "ms.\n";
+}
+
+/**
+* ȽѡcellʽͬӸɴΣʧܵıʱ䣬
+* ԼìܵĴש
+*/
+void benchmark_heuristics() {
+	const unsigned size = 8;
+	const unsigned runs = 50;
+	std::shared_ptr<const TilingModel> model = load_tiling_model("tiles");
+	for (const pair<string, Heuristic> &heuristic : benchmarked_heuristics) {
+		WFCSnapshotCache cache;
+		ContradictionHeatmap heatmap(size, size, size, model->id_to_oriented_tile.size());
+		std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
+		for (unsigned seed = 0; seed < runs; seed++) {
+			TilingWFC<ObjModel> wfc(model, size, size, size, { false, heuristic.second }, seed, cache);
+			if (!wfc.run().has_value()) {
+				heatmap.add(*wfc.get_contradiction());
+			}
+		}
+		int elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>
+			(std::chrono::system_clock::now() - start).count();
+		cout << heuristic.first << ": " << heatmap.size() << "/"
+			<< runs << " contradictions, " << elapsed_ms << "ms";
+		std::vector<unsigned> worst = heatmap.worst_patterns();
+		if (!worst.empty()) {
+			cout << ", worst tile " << model->id_to_oriented_tile[worst[0]].first
+				<< " orientation " << model->id_to_oriented_tile[worst[0]].second
+				<< " (" << heatmap.get_patterns()[worst[0]] << ")";
+		}
+		cout << endl;
+	}
+}
+
+/**
+* Ƚcellڴезʽ64x64x64waveͬӸɴΣ
+* ÿеƽʱ
+*/
+void benchmark_layouts() {
+	const unsigned size = 64;
+	const unsigned runs = 3;
+	std::shared_ptr<const TilingModel> model = load_tiling_model("tiles");
+	for (Heuristic heuristic : { Heuristic::scanline, Heuristic::mrv, Heuristic::hilbert }) {
+		for (Layout layout : { Layout::linear, Layout::brick }) {
+			Layout used = layout;
+			std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
+			for (unsigned seed = 0; seed < runs; seed++) {
+				TilingWFC<ObjModel> wfc(model, size, size, size, { false, heuristic, layout }, seed);
+				used = wfc.get_layout();
+				wfc.run();
+			}
+			int elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>
+				(std::chrono::system_clock::now() - start).count();
+			for (const pair<string, Heuristic> &name : heuristic_names) {
+				if (name.second == heuristic) {
+					cout << name.first;
+				}
+			}
+			cout << (used == Layout::brick ? " brick: " : " linear: ")
+				<< elapsed_ms / runs << "ms per run" << endl;
+		}
+	}
+}
+
+/**
+* ѧϰصģͣȡ3x3x3״ݹϵ״ʱ䣬
+* Ȼһ24x24x24
+*/
+void benchmark_overlapping() {
+	std::optional<Array3D<uint8_t>> input = read_voxels("voxels/input.raw");
+	if (!input.has_value()) {
+		cout << "voxels/input.raw not found" << endl;
+		return;
+	}
+	OverlappingWFC3DOptions options{ true, false, 24, 24, 24, 3, Heuristic::scanline };
+	std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
+	std::shared_ptr<const OverlappingModel3D<uint8_t>> model =
+		OverlappingWFC3D<uint8_t>::compile(*input, options);
+	int elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>
+		(std::chrono::system_clock::now() - start).count();
+	cout << model->patterns.size() << " patterns, "
+		<< model->compiled->propagator_data.size() << " compatible pairs in " << elapsed_ms << "ms" << endl;
+
+	start = std::chrono::system_clock::now();
+	OverlappingWFC3D<uint8_t> wfc(options, model, 0);
+	std::optional<Array3D<uint8_t>> output = wfc.run();
+	elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>
+		(std::chrono::system_clock::now() - start).count();
+	cout << (output.has_value() ? "generated in " : "failed in ") << elapsed_ms << "ms" << endl;
+	if (output.has_value()) {
+		write_voxels("voxels/output.raw", *output);
+	}
+}
+
+/**
+* Ƚϸִש̬ģ͵ʱ䣺ÿ̬16שÿש֮һˮƽһֱ
+* ڹϵÿڹϵƽʱ䡣ڱʱɣ
+* ԽڹϵԽ࣬ÿڹϵʱӦֲ
+*/
+void benchmark_symmetry() {
+	const unsigned nb_tiles = 16;
+	const unsigned runs = 10;
+	for (const pair<string, Symmetry> &symmetry : symmetry_names) {
+		vector<Tile> tiles(nb_tiles, Tile(ObjModel(), symmetry.second, 1.0, 0, 999));
+		vector<tuple<unsigned, unsigned, unsigned, unsigned, unsigned>> neighbors;
+		for (unsigned a = 0; a < nb_tiles; a++) {
+			for (unsigned b = 0; b < nb_tiles; b++) {
+				neighbors.push_back(make_tuple(a, 0, b, 0, 1));
+				neighbors.push_back(make_tuple(a, 0, b, 0, 0));
+			}
+		}
+		std::shared_ptr<const TilingModel> model;
+		std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
+		for (unsigned run = 0; run < runs; run++) {
+			model = TilingWFC<ObjModel>::compile(tiles, neighbors);
+		}
+		double elapsed_ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>
+			(std::chrono::system_clock::now() - start).count() / runs;
+		size_t pairs = model->compiled->propagator_data.size();
+		cout << symmetry.first << ": " << model->id_to_oriented_tile.size() << " oriented tiles, "
+			<< pairs << " neighbor pairs, " << elapsed_ns / 1e6 << "ms, "
+			<< elapsed_ns / pairs << "ns per pair" << endl;
+	}
 }
\ No newline at end of file
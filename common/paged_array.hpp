@@ -0,0 +1,237 @@
+#pragma once
+#ifndef WFC_PAGED_ARRAY_HPP_
+#define WFC_PAGED_ARRAY_HPP_
+
+#include <algorithm>
+#include <memory>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/**
+* The values of the cells of a wave, cell_size values per cell, stored in
+* pages of a power of two number of cells.
+*
+* Every page starts as a view of the canonical page: a single page holding the
+* initial values of a cell repeated, shared by all the pages and by every copy
+* of the array. A page is only allocated, as a copy of the canonical page, the
+* first time one of its cells is written. So an array is built in a time
+* proportional to its number of pages instead of its number of values, and
+* the cells a run never writes take no memory.
+*
+* A copy of an array copies the pages written so far and keeps sharing the
+* canonical page.
+*
+* Several threads can write cells at the same time through
+* write_cell_concurrent, which allocates the pages without a lock. No other
+* member function may be called while they do.
+*/
+template <typename T> class PagedArray {
+public:
+	/**
+	* The size in bytes aimed at for a page.
+	*/
+	static constexpr size_t page_bytes = 32 * 1024;
+
+	PagedArray() = default;
+
+	/**
+	* Build an array of nb_cells cells, every cell starting with the values of
+	* initial_cell.
+	*/
+	PagedArray(size_t nb_cells, const std::vector<T> &initial_cell)
+		: cell_size(initial_cell.size()), page_shift(get_page_shift(nb_cells, initial_cell.size())) {
+		auto page = std::make_shared<std::vector<T>>();
+		page->reserve(page_size());
+		for (size_t cell = 0; cell < get_page_cells(); cell++) {
+			page->insert(page->end(), initial_cell.begin(), initial_cell.end());
+		}
+		canonical = std::move(page);
+		const size_t nb_pages = (nb_cells + get_page_cells() - 1) >> page_shift;
+		pages.assign(nb_pages, canonical->data());
+		owned.resize(nb_pages);
+	}
+
+	PagedArray(const PagedArray &other)
+		: cell_size(other.cell_size), page_shift(other.page_shift), canonical(other.canonical),
+		pages(other.pages), owned(other.owned.size()) {
+		for (size_t page = 0; page < owned.size(); page++) {
+			if (other.owned[page]) {
+				owned[page].reset(new T[page_size()]);
+				std::copy(other.pages[page], other.pages[page] + page_size(), owned[page].get());
+				pages[page] = owned[page].get();
+			}
+		}
+	}
+
+	PagedArray(PagedArray &&other) noexcept = default;
+
+	PagedArray &operator=(PagedArray other) noexcept {
+		std::swap(cell_size, other.cell_size);
+		std::swap(page_shift, other.page_shift);
+		std::swap(canonical, other.canonical);
+		std::swap(pages, other.pages);
+		std::swap(owned, other.owned);
+		return *this;
+	}
+
+	/**
+	* Return the values of cell index. CellSize is the number of values of a
+	* cell if it is known at compile time, 0 otherwise.
+	*/
+	template <size_t CellSize = 0>
+	const T *cell(size_t index) const noexcept {
+		return pages[index >> page_shift] + offset<CellSize>(index);
+	}
+
+	/**
+	* Return the values of cell index to modify them, allocating its page if
+	* it is still the canonical page.
+	*/
+	template <size_t CellSize = 0>
+	T *write_cell(size_t index) {
+		T *page = owned[index >> page_shift].get();
+		if (!page) {
+			page = materialize(index >> page_shift);
+		}
+		return page + offset<CellSize>(index);
+	}
+
+	/**
+	* Return the value of cell index, for an array of one value per cell.
+	*/
+	const T &operator[](size_t index) const noexcept {
+		return *cell<1>(index);
+	}
+
+	/**
+	* Return the value of cell index to modify it, for an array of one value
+	* per cell.
+	*/
+	T &write(size_t index) {
+		return *write_cell<1>(index);
+	}
+
+	/**
+	* Return the number of cells of a page.
+	*/
+	size_t get_page_cells() const noexcept {
+		return (size_t)1 << page_shift;
+	}
+
+	/**
+	* Return true if page was written, false if it is still the canonical page.
+	*/
+	bool is_written(size_t page) const noexcept {
+		return owned[page] != nullptr;
+	}
+
+	/**
+	* Same as write_cell, but several threads can call it at the same time.
+	* When two threads allocate the same page, the first one to publish it
+	* wins and the other one frees its copy.
+	*/
+	template <size_t CellSize = 0>
+	T *write_cell_concurrent(size_t index) {
+		const size_t page = index >> page_shift;
+		const T *current = load_page(pages[page]);
+		if (current == canonical->data()) {
+			T *copy = new T[page_size()];
+			std::copy(canonical->begin(), canonical->end(), copy);
+			if (publish_page(pages[page], current, copy)) {
+				owned[page].reset(copy);
+				current = copy;
+			}
+			else {
+				delete[] copy;
+			}
+		}
+		return const_cast<T *>(current) + offset<CellSize>(index);
+	}
+
+private:
+	size_t cell_size = 0;
+	unsigned page_shift = 0;
+
+	/**
+	* The initial values of the cells of a page.
+	*/
+	std::shared_ptr<const std::vector<T>> canonical;
+
+	/**
+	* pages[page] is the first value of page: the page in owned if it was
+	* written, the canonical page otherwise.
+	*/
+	std::vector<const T *> pages;
+	std::vector<std::unique_ptr<T[]>> owned;
+
+	/**
+	* Return the largest shift such that a page of 1 << shift cells of
+	* cell_size values fits in page_bytes, 0 if a single cell doesn't. A page
+	* is never larger than needed for nb_cells cells, so small arrays still
+	* take a single page of their size.
+	*/
+	static unsigned get_page_shift(size_t nb_cells, size_t cell_size) noexcept {
+		const size_t cell_bytes = std::max<size_t>(cell_size * sizeof(T), 1);
+		unsigned shift = 0;
+		while (((size_t)1 << shift) < nb_cells && ((size_t)2 << shift) * cell_bytes <= page_bytes) {
+			shift++;
+		}
+		return shift;
+	}
+
+	size_t page_size() const noexcept {
+		return get_page_cells() * cell_size;
+	}
+
+	template <size_t CellSize>
+	size_t offset(size_t index) const noexcept {
+		return (index & (get_page_cells() - 1)) * (CellSize != 0 ? CellSize : cell_size);
+	}
+
+	/**
+	* Atomically read a page pointer.
+	*/
+	static const T *load_page(const T *const &page) noexcept {
+#ifdef _MSC_VER
+		return *reinterpret_cast<const T *const volatile *>(&page);
+#else
+		return __atomic_load_n(&page, __ATOMIC_ACQUIRE);
+#endif
+	}
+
+	/**
+	* Atomically replace page by copy if it is still expected. Otherwise set
+	* expected to the current page and return false.
+	*/
+	static bool publish_page(const T *&page, const T *&expected, const T *copy) noexcept {
+#ifdef _MSC_VER
+		void *old = _InterlockedCompareExchangePointer(
+			reinterpret_cast<void *volatile *>(const_cast<T **>(&page)),
+			const_cast<T *>(copy), const_cast<T *>(expected));
+		if (old == expected) {
+			return true;
+		}
+		expected = static_cast<const T *>(old);
+		return false;
+#else
+		return __atomic_compare_exchange_n(&page, &expected, copy, false,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+	}
+
+	/**
+	* Allocate page as a copy of the canonical page, and return it.
+	*/
+	T *materialize(size_t page) {
+		owned[page].reset(new T[page_size()]);
+		std::copy(canonical->begin(), canonical->end(), owned[page].get());
+		pages[page] = owned[page].get();
+		return owned[page].get();
+	}
+};
+
+#endif // WFC_PAGED_ARRAY_HPP_
@@ -0,0 +1,384 @@
+#pragma once
+#ifndef WFC_ENGINE_HPP_
+#define WFC_ENGINE_HPP_
+
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "paged_array.hpp"
+
+/**
+* The kernels shared by the 2D engine (2D_test/fastwfc) and the 3D engine
+* (3D_proj/wfc). Both instantiate WFCEngine with their number of dimensions,
+* so the neighbor and index math and the propagation loop are written once,
+* and the direction tables are constants the compiler can fold into fully
+* unrolled direction loops. The waves, the models and the layouts of the
+* cells stay in the engines and are given to the kernels as parameters.
+*/
+
+/**
+* The directions of a grid of Dims dimensions, in the order of the engine of
+* that dimension: offsets[direction][axis], the axes going from the slowest
+* to the fastest coordinate of a cell.
+*/
+template <unsigned Dims> struct GridDirections;
+
+/**
+* The directions of 2D_test/fastwfc/direction.hpp, on the axes (y, x).
+*/
+template <> struct GridDirections<2> {
+	static constexpr int offsets[4][2] = { { -1, 0 }, { 0, -1 }, { 0, 1 }, { 1, 0 } };
+};
+
+/**
+* The directions of 3D_proj/wfc/direction.hpp, on the axes (z, y, x).
+*/
+template <> struct GridDirections<3> {
+	static constexpr int offsets[6][3] = { { 1, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 },
+		{ 0, -1, 0 }, { 0, 0, -1 }, { -1, 0, 0 } };
+};
+
+/**
+* Return true if the opposite of every direction, nb_directions - 1 -
+* direction in both engines, has the opposite offsets.
+*/
+template <unsigned Dims> constexpr bool check_grid_directions() noexcept {
+	for (unsigned direction = 0; direction < 2 * Dims; direction++) {
+		for (unsigned axis = 0; axis < Dims; axis++) {
+			if (GridDirections<Dims>::offsets[direction][axis] !=
+				-GridDirections<Dims>::offsets[2 * Dims - 1 - direction][axis]) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+* A bound on the number of patterns of a model, known at compile time. The
+* cells of a wave of such a model hold their domain in a bitset of nb_words
+* 64 bits words. MaxPatterns = 0 is the generic bound, whose number of words
+* is only known at runtime.
+*/
+template <unsigned MaxPatterns> struct PatternBound {
+	static constexpr unsigned max_patterns = MaxPatterns;
+	static constexpr unsigned nb_words = (MaxPatterns + 63) / 64;
+};
+
+/**
+* Call f(PatternBound<MaxPatterns>()) with the smallest of the bounds 64, 128
+* and 256 holding nb_patterns, or with the generic bound, and return its
+* result. The engines dispatch on the number of patterns of their model once
+* per call to a kernel, so the kernels are compiled for each bound with fixed
+* trip counts while the callers keep using a single type.
+*/
+template <typename F> decltype(auto) with_pattern_bound(unsigned nb_patterns, F &&f) {
+	if (nb_patterns <= 64) {
+		return f(PatternBound<64>());
+	}
+	if (nb_patterns <= 128) {
+		return f(PatternBound<128>());
+	}
+	if (nb_patterns <= 256) {
+		return f(PatternBound<256>());
+	}
+	return f(PatternBound<0>());
+}
+
+/**
+* Return the number of words of the bitset of a cell for a model of
+* nb_patterns patterns: the fixed width of its bound (the last words may stay
+* empty), or just enough words for the generic bound.
+*/
+inline unsigned pattern_bound_words(unsigned nb_patterns) noexcept {
+	return with_pattern_bound(nb_patterns, [&](auto bound) {
+		constexpr unsigned nb_words = decltype(bound)::nb_words;
+		return nb_words != 0 ? nb_words : (nb_patterns + 63) / 64;
+	});
+}
+
+/**
+* Return the largest number of decrements a compatible counter of model can
+* receive (see WFCEngine::propagate_item): the counter of a pattern in a
+* direction is decremented once for every pattern whose list in that
+* direction contains it. When the lists of the model are symmetric, it is the
+* largest value of model.initial_compatible.
+*/
+template <unsigned NbDirections, typename Model>
+unsigned max_compatible_support(const Model &model) {
+	std::vector<std::array<unsigned, NbDirections>> support(model.nb_patterns);
+	unsigned max_support = 0;
+	for (unsigned pattern = 0; pattern < model.nb_patterns; pattern++) {
+		for (unsigned direction = 0; direction < NbDirections; direction++) {
+			for (const unsigned *it = model.neighbors_begin(pattern, direction),
+				*it_end = model.neighbors_end(pattern, direction); it < it_end; ++it) {
+				max_support = std::max(max_support, ++support[*it][direction]);
+			}
+		}
+	}
+	return max_support;
+}
+
+/**
+* The compatible counters of a propagator with NbDirections directions (see
+* WFCEngine::propagate_item), one per pattern per cell, stored with the
+* narrowest of uint8_t, uint16_t and uint32_t holding the maximum support of
+* the model (see max_compatible_support) and the initial counters. For typical tile sets, whose
+* patterns have at most a few hundreds neighbors, they take a half or a
+* quarter of the memory of int counters. The counters of a cell are only
+* allocated once the propagation reaches it (see PagedArray).
+*/
+template <unsigned NbDirections> class CompatibleCounters {
+public:
+	template <typename Counter> using Counts = std::array<Counter, NbDirections>;
+
+	/**
+	* Set the counters of the nb_patterns patterns of the nb_cells cells to
+	* initial[pattern], for a model whose counters receive at most max_support
+	* decrements. The type holds max_support and every initial counter: when
+	* the lists of the model are not symmetric, an initial counter can be
+	* larger than max_support.
+	*/
+	CompatibleCounters(size_t nb_cells, unsigned nb_patterns, unsigned max_support,
+		const std::array<int, NbDirections> *initial) {
+		unsigned max_count = max_support;
+		for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+			for (unsigned direction = 0; direction < NbDirections; direction++) {
+				max_count = std::max(max_count, (unsigned)initial[pattern][direction]);
+			}
+		}
+		if (max_count <= UINT8_MAX) {
+			init<uint8_t>(nb_cells, nb_patterns, initial);
+		}
+		else if (max_count <= UINT16_MAX) {
+			init<uint16_t>(nb_cells, nb_patterns, initial);
+		}
+		else {
+			init<uint32_t>(nb_cells, nb_patterns, initial);
+		}
+	}
+
+	/**
+	* Return f(counters), the counters being given as the PagedArray of the
+	* Counts of their type, one cell of nb_patterns Counts per cell of the
+	* wave, so f is compiled for each type.
+	*/
+	template <typename F> decltype(auto) visit(F &&f) {
+		return std::visit([&](auto &counts) -> decltype(auto) { return f(counts); }, data);
+	}
+
+	/**
+	* Set the counters of pattern in cell to 0.
+	*/
+	void clear(size_t cell, unsigned pattern) {
+		std::visit([&](auto &counts) { counts.write_cell(cell)[pattern] = {}; }, data);
+	}
+
+private:
+	std::variant<PagedArray<Counts<uint8_t>>, PagedArray<Counts<uint16_t>>,
+		PagedArray<Counts<uint32_t>>> data;
+
+	/**
+	* Set data to the initial counters stored as Counter.
+	*/
+	template <typename Counter>
+	void init(size_t nb_cells, unsigned nb_patterns, const std::array<int, NbDirections> *initial) {
+		std::vector<Counts<Counter>> initial_cell(nb_patterns);
+		for (unsigned pattern = 0; pattern < nb_patterns; pattern++) {
+			for (unsigned direction = 0; direction < NbDirections; direction++) {
+				initial_cell[pattern][direction] = (Counter)initial[pattern][direction];
+			}
+		}
+		data = PagedArray<Counts<Counter>>(nb_cells, initial_cell);
+	}
+};
+
+/**
+* The topology of the wave: a bounded grid, whose cells on a side have no
+* neighbor past it, or a toric one.
+*/
+struct BoundedTopology {
+	static constexpr bool periodic = false;
+};
+
+struct PeriodicTopology {
+	static constexpr bool periodic = true;
+};
+
+/**
+* A pattern removed from a cell, whose removal has to be propagated.
+*/
+template <unsigned Dims> struct PropagationItem {
+	std::array<unsigned, Dims> cell;
+	unsigned pattern;
+};
+
+/**
+* The cell emptied by the propagation: pattern was its last pattern, removed
+* because of source_pattern in the cell next to it in the opposite of
+* direction.
+*/
+template <unsigned Dims> struct PropagationConflict {
+	std::array<unsigned, Dims> cell;
+	unsigned pattern;
+	unsigned direction;
+	unsigned source_pattern;
+};
+
+/**
+* The kernels of a wave of Dims dimensions with Topology. The directions are
+* those of GridDirections<Dims>, and the opposite of a direction is
+* nb_directions - 1 - direction.
+*/
+template <unsigned Dims, typename Topology> class WFCEngine {
+public:
+	static constexpr unsigned nb_directions = 2 * Dims;
+
+	using Coordinates = std::array<unsigned, Dims>;
+
+	/**
+	* The counters of a pattern in a cell, one per direction (see propagate).
+	*/
+	template <typename Counter> using Counts = std::array<Counter, nb_directions>;
+
+	using Item = PropagationItem<Dims>;
+	using Conflict = PropagationConflict<Dims>;
+
+	static constexpr unsigned get_opposite_direction(unsigned direction) noexcept {
+		return nb_directions - 1 - direction;
+	}
+
+	static_assert(check_grid_directions<Dims>(), "opposite directions must have opposite offsets");
+
+	/**
+	* Call f(std::integral_constant<unsigned, direction>()) for every direction
+	* in order, while it returns true, as a loop unrolled at compile time.
+	* Return false if f returned false.
+	*/
+	template <typename F> static bool for_each_direction(F &&f) noexcept {
+		return for_each_direction(f, std::make_index_sequence<nb_directions>());
+	}
+
+	/**
+	* Set neighbor to the cell next to cell in Direction, in a wave of size
+	* sizes. Return false if the wave is bounded and cell has no neighbor in
+	* Direction.
+	*/
+	template <unsigned Direction>
+	static bool get_neighbor(const Coordinates &sizes, const Coordinates &cell,
+		Coordinates &neighbor) noexcept {
+		for (unsigned axis = 0; axis < Dims; axis++) {
+			const int offset = GridDirections<Dims>::offsets[Direction][axis];
+			if (offset == 0) {
+				neighbor[axis] = cell[axis];
+			}
+			else if (Topology::periodic) {
+				neighbor[axis] = (cell[axis] + offset + sizes[axis]) % sizes[axis];
+			}
+			else {
+				// A negative coordinate is also larger than the size once unsigned.
+				neighbor[axis] = cell[axis] + offset;
+				if (neighbor[axis] >= sizes[axis]) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	/**
+	* Return the index of cell in the linear layout of a wave of size sizes,
+	* the last coordinate being the fastest.
+	*/
+	static unsigned linear_index(const Coordinates &sizes, const Coordinates &cell) noexcept {
+		unsigned index = 0;
+		for (unsigned axis = 0; axis < Dims; axis++) {
+			index = index * sizes[axis] + cell[axis];
+		}
+		return index;
+	}
+
+	/**
+	* Propagate the removal of item.pattern from item.cell to its neighbors,
+	* Bound being the bound of the model (see with_pattern_bound).
+	*
+	* compatible.cell(index)[pattern][direction] is the number of patterns of
+	* the cell next to cell index in the opposite of direction still
+	* compatible with pattern: when it drops to 0, pattern is removed from
+	* cell index with wave.remove<Bound::nb_words>(index, pattern), its
+	* counters are zeroed and its removal is pushed on propagating. Counter is
+	* wide enough for the maximum support of the model (see
+	* CompatibleCounters), so a zeroed counter, wrapping around, receives too
+	* few decrements to reach 0 again, like an int counter going negative.
+	* index_of(cell) gives the index of a cell in the wave.
+	* Return the first cell emptied, or nullopt.
+	*/
+	template <typename Bound, typename Model, typename Counter, typename Wave, typename IndexOf>
+	static std::optional<Conflict> propagate_item(const Model &model, const Coordinates &sizes,
+		const IndexOf &index_of, PagedArray<Counts<Counter>> &compatible, const Item &item,
+		std::vector<Item> &propagating, Wave &wave) noexcept {
+		std::optional<Conflict> conflict;
+		for_each_direction([&](auto direction_constant) {
+			constexpr unsigned direction = decltype(direction_constant)::value;
+			Coordinates cell2;
+			if (!get_neighbor<direction>(sizes, item.cell, cell2)) {
+				return true;
+			}
+			const unsigned i2 = index_of(cell2);
+			Counts<Counter> *compatible2 = compatible.write_cell(i2);
+			for (const unsigned *it = model.neighbors_begin(item.pattern, direction),
+				*it_end = model.neighbors_end(item.pattern, direction); it < it_end; ++it) {
+				Counts<Counter> &value = compatible2[*it];
+				value[direction]--;
+				if (value[direction] != 0) {
+					continue;
+				}
+				value = {};
+				propagating.push_back({ cell2, *it });
+				wave.template remove<Bound::nb_words>(i2, *it);
+				if (wave.impossible()) {
+					conflict = Conflict{ cell2, *it, direction, item.pattern };
+					return false;
+				}
+			}
+			return true;
+		});
+		return conflict;
+	}
+
+	/**
+	* Propagate the removals of propagating (see propagate_item), in the order
+	* of a stack, until none is left or a cell is emptied.
+	* Return the first cell emptied, with propagating cleared, or nullopt.
+	*/
+	template <typename Bound, typename Model, typename Counter, typename Wave, typename IndexOf>
+	static std::optional<Conflict> propagate(const Model &model, const Coordinates &sizes,
+		const IndexOf &index_of, PagedArray<Counts<Counter>> &compatible,
+		std::vector<Item> &propagating, Wave &wave) noexcept {
+		while (!propagating.empty()) {
+			const Item item = propagating.back();
+			propagating.pop_back();
+			std::optional<Conflict> conflict = propagate_item<Bound>(model, sizes, index_of,
+				compatible, item, propagating, wave);
+			if (conflict) {
+				propagating.clear();
+				return conflict;
+			}
+		}
+		return std::nullopt;
+	}
+
+private:
+	template <typename F, size_t... Directions>
+	static bool for_each_direction(F &f, std::index_sequence<Directions...>) noexcept {
+		return (f(std::integral_constant<unsigned, Directions>()) && ...);
+	}
+};
+
+#endif // WFC_ENGINE_HPP_